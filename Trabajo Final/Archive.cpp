@@ -0,0 +1,253 @@
+#include "Archive.h"
+#include "Checksum.h"
+#include "Endian.h"
+#include "Report.h"
+#include <cstring>
+#include <iostream>
+
+namespace {
+
+const char kMagic[4] = {'S', 'O', 'A', 'R'};
+const char kIndexMagic[4] = {'S', 'O', 'A', 'I'};
+const char kFooterMagic[8] = {'S', 'O', 'A', 'R', 'T', 'A', 'I', 'L'};
+const size_t kIndexHeaderSize = 16;
+const size_t kMemberFixedSize = 32; // Offset, sizes, checksum, name length
+
+uint32_t ChecksumOf(const char* data, size_t size, Report::FileStats* stats) {
+    Report::Timer timer(stats, Report::StageChecksum, size);
+    return Checksum::Crc32c(data, size);
+}
+
+} // namespace
+
+bool Archive::IsSafeName(const std::string& name) {
+    if (name.empty() || name[0] == '/' || name[0] == '\\' || name.find(':') != std::string::npos) return false;
+    size_t start = 0;
+    while (start <= name.size()) {
+        size_t end = name.find_first_of("/\\", start);
+        if (end == std::string::npos) end = name.size();
+        std::string component = name.substr(start, end - start);
+        if (component.empty() || component == "." || component == "..") return false;
+        start = end + 1;
+    }
+    return true;
+}
+
+bool Archive::Writer::Open(const std::string& path) {
+    this->path = path;
+    char header[HeaderSize] = {0};
+    std::memcpy(header, kMagic, sizeof(kMagic));
+    header[4] = static_cast<char>(Version);
+    if (!file.Open(path, 0) || !file.Write(header, sizeof(header))) {
+        std::cerr << "Error creating archive: " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool Archive::Writer::Add(const std::string& name, const std::string& inputPath, const BlockFormat::Options& options) {
+    FileManager::FileView view;
+    {
+        Report::Timer timer(options.stats, Report::StageRead, 0);
+        if (!FileManager::OpenView(inputPath, view)) return false;
+        if (!view.IsMapped()) timer.SetBytes(view.Size());
+    }
+
+    Member member;
+    member.name = name;
+    member.rawSize = view.Size();
+    member.checksum = ChecksumOf(view.Data(), view.Size(), options.stats);
+
+    if (view.Size() <= BufferedMemberLimit) {
+        // Encoded outside the lock, so workers only queue up for the write
+        std::vector<char> encoded;
+        if (!BlockFormat::EncodeBuffer(view.Data(), view.Size(), encoded, options)) return false;
+
+        Concurrency::ScopedLock lock(mutex);
+        if (failed) return false;
+        member.offset = file.Position();
+        member.storedSize = encoded.size();
+        Report::Timer timer(options.stats, Report::StageWrite, encoded.size());
+        if (!file.Write(encoded.data(), encoded.size())) {
+            failed = true;
+            return false;
+        }
+        members.push_back(member);
+        return true;
+    }
+
+    // Too big to hold encoded: its blocks go through the pool and straight
+    // into the archive
+    Concurrency::ScopedLock lock(mutex);
+    if (failed) return false;
+    member.offset = file.Position();
+    if (!BlockFormat::EncodeToWriter(view.Data(), view.Size(), file, options)) {
+        // Part of it may be in the archive already, and a failed write
+        // leaves the writer's position in doubt
+        std::cerr << "Error encoding file: " << inputPath << std::endl;
+        failed = true;
+        return false;
+    }
+    member.storedSize = file.Position() - member.offset;
+    members.push_back(member);
+    return true;
+}
+
+bool Archive::Writer::Finish(const BlockFormat::Options& options) {
+    Concurrency::ScopedLock lock(mutex);
+    size_t size = kIndexHeaderSize;
+    for (const Member& member : members) size += kMemberFixedSize + member.name.size();
+
+    std::vector<char> index(size, 0);
+    std::memcpy(index.data(), kIndexMagic, sizeof(kIndexMagic));
+    index[4] = static_cast<char>(Version);
+    Endian::PutU64(index.data() + 8, members.size());
+    char* p = index.data() + kIndexHeaderSize;
+    for (const Member& member : members) {
+        Endian::PutU64(p, member.offset);
+        Endian::PutU64(p + 8, member.storedSize);
+        Endian::PutU64(p + 16, member.rawSize);
+        Endian::PutU32(p + 24, member.checksum);
+        Endian::PutU32(p + 28, static_cast<uint32_t>(member.name.size()));
+        std::memcpy(p + kMemberFixedSize, member.name.data(), member.name.size());
+        p += kMemberFixedSize + member.name.size();
+    }
+
+    BlockFormat::Options indexOptions = options;
+    indexOptions.stats = nullptr;
+    std::vector<char> encoded;
+    bool ok = !failed && BlockFormat::EncodeBuffer(index.data(), index.size(), encoded, indexOptions);
+
+    char footer[FooterSize] = {0};
+    Endian::PutU64(footer, file.Position());
+    Endian::PutU64(footer + 8, encoded.size());
+    Endian::PutU32(footer + 16, Checksum::Crc32c(encoded.data(), encoded.size()));
+    std::memcpy(footer + 24, kFooterMagic, sizeof(kFooterMagic));
+
+    ok = ok && file.Write(encoded.data(), encoded.size()) && file.Write(footer, sizeof(footer));
+    if (!file.Finish()) ok = false;
+    if (!ok) std::cerr << "Error writing archive: " << path << std::endl;
+    return ok;
+}
+
+bool Archive::Reader::Open(const std::string& path, const BlockFormat::Options& options) {
+    this->path = path;
+    // Members are found by offset, so the archive has to be seekable
+    if (!FileManager::OpenView(path, view, true)) {
+        std::cerr << "Error opening archive: " << path << std::endl;
+        return false;
+    }
+    const char* data = view.Data();
+    size_t size = view.Size();
+    if (size < HeaderSize + FooterSize || std::memcmp(data, kMagic, sizeof(kMagic)) != 0 ||
+        std::memcmp(data + size - FooterSize + 24, kFooterMagic, sizeof(kFooterMagic)) != 0) {
+        std::cerr << "Error: not a complete archive: " << path << std::endl;
+        return false;
+    }
+    if (static_cast<uint8_t>(data[4]) != Version) {
+        std::cerr << "Error: unsupported archive version in " << path << std::endl;
+        return false;
+    }
+
+    const char* footer = data + size - FooterSize;
+    uint64_t indexOffset = Endian::GetU64(footer);
+    uint64_t indexSize = Endian::GetU64(footer + 8);
+    size_t indexEnd = size - FooterSize;
+    if (indexOffset < HeaderSize || indexOffset > indexEnd || indexSize != indexEnd - indexOffset ||
+        Checksum::Crc32c(data + indexOffset, static_cast<size_t>(indexSize)) != Endian::GetU32(footer + 16)) {
+        std::cerr << "Error: damaged archive index in " << path << std::endl;
+        return false;
+    }
+
+    BlockFormat::Options indexOptions = options;
+    indexOptions.stats = nullptr;
+    std::vector<char> index;
+    if (!BlockFormat::DecodeBuffer(data + indexOffset, static_cast<size_t>(indexSize), index, indexOptions, path)) {
+        std::cerr << "Error: cannot read the archive index of " << path << " (wrong key or options?)" << std::endl;
+        return false;
+    }
+    if (index.size() < kIndexHeaderSize || std::memcmp(index.data(), kIndexMagic, sizeof(kIndexMagic)) != 0) {
+        std::cerr << "Error: damaged archive index in " << path << std::endl;
+        return false;
+    }
+
+    uint64_t count = Endian::GetU64(index.data() + 8);
+    size_t position = kIndexHeaderSize;
+    for (uint64_t i = 0; i < count; ++i) {
+        if (index.size() - position < kMemberFixedSize) break;
+        const char* p = index.data() + position;
+        Member member;
+        member.offset = Endian::GetU64(p);
+        member.storedSize = Endian::GetU64(p + 8);
+        member.rawSize = Endian::GetU64(p + 16);
+        member.checksum = Endian::GetU32(p + 24);
+        uint32_t nameSize = Endian::GetU32(p + 28);
+        position += kMemberFixedSize;
+        if (index.size() - position < nameSize) break;
+        member.name.assign(index.data() + position, nameSize);
+        position += nameSize;
+        // Members live between the header and the index
+        if (member.offset < HeaderSize || member.offset > indexOffset ||
+            member.storedSize > indexOffset - member.offset) {
+            break;
+        }
+        members.push_back(member);
+    }
+    if (members.size() != count || position != index.size()) {
+        std::cerr << "Error: damaged archive index in " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+const Archive::Member* Archive::Reader::Find(const std::string& name) const {
+    for (const Member& member : members) {
+        if (member.name == name) return &member;
+    }
+    return nullptr;
+}
+
+bool Archive::Reader::Extract(const Member& member, const std::string& outputPath,
+                              const BlockFormat::Options& options) const {
+    const char* data = view.Data() + member.offset;
+    size_t size = static_cast<size_t>(member.storedSize);
+    std::string name = path + ":" + member.name;
+
+    uint32_t checksum = 0;
+    if (member.rawSize <= BufferedMemberLimit) {
+        std::vector<char> output;
+        if (!BlockFormat::DecodeBuffer(data, size, output, options, name)) return false;
+        if (output.size() != member.rawSize) {
+            std::cerr << "Error: " << name << " decodes to the wrong size" << std::endl;
+            return false;
+        }
+        checksum = ChecksumOf(output.data(), output.size(), options.stats);
+        if (checksum == member.checksum) {
+            Report::Timer timer(options.stats, Report::StageWrite, output.size());
+            if (!FileManager::WriteFileContent(outputPath, output)) {
+                FileManager::RemoveFile(outputPath);
+                return false;
+            }
+        }
+    } else {
+        // Checked from the page cache once written
+        if (!BlockFormat::DecodeToFile(data, size, outputPath, options, name)) return false;
+        FileManager::FileView written;
+        if (!FileManager::OpenView(outputPath, written, true) || written.Size() != member.rawSize) {
+            std::cerr << "Error: " << name << " decodes to the wrong size" << std::endl;
+            written.Close();
+            FileManager::RemoveFile(outputPath);
+            return false;
+        }
+        checksum = ChecksumOf(written.Data(), written.Size(), options.stats);
+        // Already on disk: a member that fails its check must not stay there
+        written.Close();
+        if (checksum != member.checksum) FileManager::RemoveFile(outputPath);
+    }
+
+    if (checksum != member.checksum) {
+        std::cerr << "Error: checksum mismatch in " << name << std::endl;
+        return false;
+    }
+    return true;
+}
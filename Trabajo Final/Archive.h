@@ -0,0 +1,113 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "BlockFormat.h"
+#include "Concurrency.h"
+#include "FileManager.h"
+
+// Single-file archive (--archive). Every input file becomes a member of one
+// output file instead of an output of its own, so a directory of many small
+// files costs one create and one sequential stream of writes rather than a
+// file (and inode) per input. A central index at the end lists the members,
+// so any one of them can be found and decoded without reading the others.
+//
+//   Header (16 bytes)
+//     0  magic "SOAR"
+//     4  version (1)
+//     5  reserved (0)
+//
+//   Members, back to back: each one a block container of its own, in the
+//   order they finished
+//
+//   Index: a block container (compressed and encrypted like the members, so
+//   the names are not readable without the key) holding
+//     0  magic "SOAI"
+//     4  version (1)
+//     8  member count
+//    16  per member: offset, stored size, raw size (8 bytes each), CRC-32C
+//        of the raw contents, name length (4 bytes each), name (UTF-8,
+//        relative to the input directory, '/' separated)
+//
+//   Footer (32 bytes), the last bytes of the file
+//     0  index offset
+//     8  index size
+//    16  CRC-32C of the stored index
+//    20  reserved (0)
+//    24  magic "SOARTAIL"
+//
+// All integers are little-endian. A reader maps the archive, finds the index
+// through the footer and reads only the members it extracts.
+class Archive {
+public:
+    static constexpr size_t HeaderSize = 16;
+    static constexpr size_t FooterSize = 32;
+    static constexpr uint8_t Version = 1;
+
+    // Members up to this size are encoded in memory by the worker that read
+    // them and appended in one write; larger ones are encoded straight into
+    // the archive, which holds it for as long as that takes
+    static constexpr unsigned long long BufferedMemberLimit = 64ULL << 20;
+
+    struct Member {
+        std::string name;
+        unsigned long long offset = 0;
+        unsigned long long storedSize = 0;
+        unsigned long long rawSize = 0;
+        uint32_t checksum = 0; // CRC-32C of the raw contents
+    };
+
+    // Builds an archive; Add may be called from any number of workers
+    class Writer {
+    public:
+        Writer() : failed(false) {}
+
+        // Create the archive and write its header
+        bool Open(const std::string& path);
+
+        // Encode the file at inputPath as member `name`
+        bool Add(const std::string& name, const std::string& inputPath, const BlockFormat::Options& options);
+
+        // Write the index and footer; false if the archive is incomplete
+        bool Finish(const BlockFormat::Options& options);
+
+    private:
+        Writer(const Writer&) = delete;
+        Writer& operator=(const Writer&) = delete;
+
+        std::string path;
+        Concurrency::Mutex mutex; // Guards everything below
+        FileManager::FileWriter file;
+        std::vector<Member> members;
+        bool failed; // A write went wrong; the archive cannot be trusted
+    };
+
+    // Reads an archive; Extract may be called from any number of workers
+    class Reader {
+    public:
+        // Map the archive and load its index
+        bool Open(const std::string& path, const BlockFormat::Options& options);
+
+        const std::vector<Member>& Members() const { return members; }
+
+        // The member with this name, or nullptr
+        const Member* Find(const std::string& name) const;
+
+        // Decode one member into outputPath and check its CRC-32C
+        bool Extract(const Member& member, const std::string& outputPath, const BlockFormat::Options& options) const;
+
+    private:
+        std::string path;
+        FileManager::FileView view;
+        std::vector<Member> members;
+    };
+
+    // False for names that would land outside the output directory:
+    // absolute paths, drive letters and ".." components
+    static bool IsSafeName(const std::string& name);
+};
+
+#endif // ARCHIVE_H
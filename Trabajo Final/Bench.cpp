@@ -0,0 +1,369 @@
+// so_bench: throughput of the codecs, ciphers and whole pipelines on
+// synthetic corpora, written as CSV so runs of different versions can be
+// compared. Built with `make bench`; not part of so_final.
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "BlockFormat.h"
+#include "Checksum.h"
+#include "Compression.h"
+#include "Concurrency.h"
+#include "CpuFeatures.h"
+#include "Encryption.h"
+#include "Pipeline.h"
+
+#ifdef CPU_FEATURES_X86
+#include <x86intrin.h>
+#endif
+
+struct BenchConfig {
+    size_t size = 16 << 20; // Bytes per corpus
+    std::vector<std::string> corpora = {"random", "repetitive", "log", "zero"};
+    std::vector<size_t> threads;  // Pool sizes for the block container rows
+    size_t reps = 5;
+    size_t warmup = 1;
+    Compression::Algorithm algorithm = Compression::AlgorithmRLE; // Block container rows
+    Encryption::Cipher cipher = Encryption::CipherVigenere;
+    std::string outputPath; // Empty: stdout
+};
+
+const char* const kKey = "benchmark key";
+
+// ---- Corpora (same seed every run, so versions see the same bytes) ----
+
+std::vector<char> RandomCorpus(size_t size) {
+    std::vector<char> data(size);
+    std::mt19937_64 rng(1);
+    for (size_t i = 0; i < size; i += 8) {
+        uint64_t v = rng();
+        for (size_t j = 0; j < 8 && i + j < size; ++j) data[i + j] = static_cast<char>(v >> (8 * j));
+    }
+    return data;
+}
+
+// Runs of one byte, 1 to 200 long: what RLE is for
+std::vector<char> RepetitiveCorpus(size_t size) {
+    std::vector<char> data;
+    data.reserve(size);
+    std::mt19937 rng(2);
+    while (data.size() < size) {
+        size_t length = std::min<size_t>(1 + rng() % 200, size - data.size());
+        data.insert(data.end(), length, static_cast<char>(rng() % 16));
+    }
+    return data;
+}
+
+// Web server access log lines in combined format
+std::vector<char> LogCorpus(size_t size) {
+    static const char* const paths[] = {"/index.html", "/api/v1/orders?id=", "/static/app.js", "/static/style.css",
+                                        "/login", "/api/v1/users/", "/images/logo.png", "/search?q="};
+    static const char* const agents[] = {
+        "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0 Safari/537.36",
+        "Mozilla/5.0 (X11; Linux x86_64; rv:121.0) Gecko/20100101 Firefox/121.0", "curl/8.4.0",
+        "Mozilla/5.0 (iPhone; CPU iPhone OS 17_0 like Mac OS X) AppleWebKit/605.1.15 Mobile/15E148"};
+    static const int statuses[] = {200, 200, 200, 200, 304, 404, 500};
+
+    std::vector<char> data;
+    data.reserve(size + 512);
+    std::mt19937 rng(3);
+    auto below = [&rng](unsigned n) { return static_cast<unsigned>(rng() % n); };
+    char line[512];
+    for (unsigned second = 0; data.size() < size; second += below(2)) {
+        int length = std::snprintf(line, sizeof(line),
+                                   "%u.%u.%u.%u - - [17/Oct/2026:%02u:%02u:%02u +0000] \"GET %s HTTP/1.1\" %d %u \"-\" \"%s\"\n",
+                                   below(256), below(256), below(256), below(256), second / 3600 % 24,
+                                   second / 60 % 60, second % 60, paths[below(8)], statuses[below(7)],
+                                   1000 + below(50000), agents[below(4)]);
+        data.insert(data.end(), line, line + length);
+    }
+    data.resize(size);
+    return data;
+}
+
+bool MakeCorpus(const std::string& name, size_t size, std::vector<char>& data) {
+    if (name == "random") data = RandomCorpus(size);
+    else if (name == "repetitive") data = RepetitiveCorpus(size);
+    else if (name == "log") data = LogCorpus(size);
+    else if (name == "zero") data.assign(size, 0);
+    else return false;
+    return true;
+}
+
+// ---- Timing ----
+
+uint64_t Ticks() {
+#ifdef CPU_FEATURES_X86
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// Median and 95th percentile (nearest rank) of the repetitions
+struct Result {
+    double medianSeconds = 0;
+    double p95Seconds = 0;
+    double medianTicks = 0;
+};
+
+template <class Func>
+Result Measure(const BenchConfig& config, Func run) {
+    for (size_t i = 0; i < config.warmup; ++i) run();
+
+    std::vector<double> seconds, ticks;
+    for (size_t i = 0; i < config.reps; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        uint64_t startTicks = Ticks();
+        run();
+        ticks.push_back(static_cast<double>(Ticks() - startTicks));
+        seconds.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    std::sort(seconds.begin(), seconds.end());
+    std::sort(ticks.begin(), ticks.end());
+
+    Result result;
+    size_t middle = seconds.size() / 2;
+    result.medianSeconds = seconds.size() % 2 ? seconds[middle] : (seconds[middle - 1] + seconds[middle]) / 2;
+    result.medianTicks = ticks.size() % 2 ? ticks[middle] : (ticks[middle - 1] + ticks[middle]) / 2;
+    size_t rank = (seconds.size() * 95 + 99) / 100;
+    result.p95Seconds = seconds[rank - 1];
+    return result;
+}
+
+// One CSV row. Throughput is in raw (uncompressed) MB/s for both
+// directions; ratio is stored size / raw size; cycles are TSC ticks.
+void WriteRow(std::ostream& out, const std::string& corpus, size_t bytes, const std::string& stage,
+              const std::string& operation, size_t threads, double ratio, const Result& result) {
+    char row[256];
+    std::snprintf(row, sizeof(row), "%s,%zu,%s,%s,%zu,%.4f,%.3f,%.3f,%.1f,", corpus.c_str(), bytes, stage.c_str(),
+                  operation.c_str(), threads, ratio, result.medianSeconds * 1e3, result.p95Seconds * 1e3,
+                  bytes / result.medianSeconds / 1e6);
+    out << row;
+    if (result.medianTicks > 0) {
+        std::snprintf(row, sizeof(row), "%.3f", result.medianTicks / bytes);
+        out << row;
+    }
+    out << std::endl;
+}
+
+// ---- Stages ----
+
+void BenchCodecs(std::ostream& out, const BenchConfig& config, const std::string& corpus, const std::vector<char>& data) {
+    const Compression::Algorithm algorithms[] = {
+        Compression::AlgorithmRLE, Compression::AlgorithmRLE2, Compression::AlgorithmLZ, Compression::AlgorithmHuffman,
+        Compression::AlgorithmRLEHuffman, Compression::AlgorithmLZHuffman, Compression::AlgorithmLZW};
+    for (Compression::Algorithm algorithm : algorithms) {
+        std::vector<char> compressed;
+        Result result = Measure(config, [&] { compressed = Compression::Compress(algorithm, data.data(), data.size()); });
+        double ratio = static_cast<double>(compressed.size()) / data.size();
+        WriteRow(out, corpus, data.size(), Compression::AlgorithmName(algorithm), "compress", 1, ratio, result);
+
+        std::vector<char> restored;
+        bool ok = true;
+        result = Measure(config, [&] {
+            ok = Compression::Decompress(algorithm, compressed.data(), compressed.size(), restored);
+        });
+        if (!ok || restored != data) {
+            std::cerr << "Round trip failed: " << Compression::AlgorithmName(algorithm) << " on " << corpus << std::endl;
+        }
+        WriteRow(out, corpus, data.size(), Compression::AlgorithmName(algorithm), "decompress", 1, ratio, result);
+    }
+}
+
+void BenchCiphers(std::ostream& out, const BenchConfig& config, const std::string& corpus, const std::vector<char>& data) {
+    const Encryption::Cipher ciphers[] = {Encryption::CipherVigenere, Encryption::CipherAES128,
+                                          Encryption::CipherAES256, Encryption::CipherChaCha20};
+    std::vector<char> buffer(data.size());
+    for (Encryption::Cipher cipher : ciphers) {
+        Result result = Measure(config, [&] {
+            Encryption::Encrypt(cipher, data.data(), buffer.data(), data.size(), kKey, 1, 0);
+        });
+        WriteRow(out, corpus, data.size(), Encryption::CipherName(cipher), "encrypt", 1, 1.0, result);
+    }
+
+    uint32_t crc = 0;
+    Result result = Measure(config, [&] { crc ^= Checksum::Crc32c(data.data(), data.size()); });
+    WriteRow(out, corpus, data.size(), "crc32c", "checksum", 1, 1.0, result);
+}
+
+// The legacy -ce / -ud paths: each stage over the whole buffer, as before
+// Pipeline.h, against the fused pipeline
+void BenchLegacy(std::ostream& out, const BenchConfig& config, const std::string& corpus, const std::vector<char>& data) {
+    std::vector<char> separate;
+    Result result = Measure(config, [&] {
+        separate = Compression::CompressRLE(data.data(), data.size());
+        Encryption::EncryptVigenereInPlace(separate.data(), separate.size(), kKey);
+    });
+    double ratio = static_cast<double>(separate.size()) / data.size();
+    WriteRow(out, corpus, data.size(), "legacy-separate", "-ce", 1, ratio, result);
+
+    std::vector<char> fused;
+    result = Measure(config, [&] {
+        fused.clear();
+        CompressEncryptPipeline<AppendStage>(ReadStage(data.data(), data.size()), CompressStage(), EncryptStage(kKey),
+                                             AppendStage(fused)).Run();
+    });
+    WriteRow(out, corpus, data.size(), "legacy-fused", "-ce", 1, ratio, result);
+
+    std::vector<char> restored;
+    result = Measure(config, [&] {
+        std::vector<char> decrypted = Encryption::DecryptVigenere(separate.data(), separate.size(), kKey);
+        restored = Compression::DecompressRLE(decrypted.data(), decrypted.size());
+    });
+    WriteRow(out, corpus, data.size(), "legacy-separate", "-ud", 1, ratio, result);
+
+    result = Measure(config, [&] {
+        restored.clear();
+        DecryptDecompressPipeline<AppendStage>(ReadStage(fused.data(), fused.size()), DecryptStage(kKey),
+                                               DecompressStage(), AppendStage(restored)).Run();
+    });
+    if (fused != separate || restored != data) std::cerr << "Legacy pipeline mismatch on " << corpus << std::endl;
+    WriteRow(out, corpus, data.size(), "legacy-fused", "-ud", 1, ratio, result);
+}
+
+// Block container -ce / -ud, blocks spread across a pool of each size:
+// ProcessFile's path minus the disk
+void BenchContainer(std::ostream& out, const BenchConfig& config, const std::string& corpus, const std::vector<char>& data) {
+    std::string stage = std::string("container-") + Compression::AlgorithmName(config.algorithm) + "+" +
+                        Encryption::CipherName(config.cipher);
+    for (size_t threads : config.threads) {
+        Concurrency::ThreadPool pool(threads);
+        BlockFormat::Options options;
+        options.compress = options.encrypt = true;
+        options.key = kKey;
+        options.algorithm = config.algorithm;
+        options.cipher = config.cipher;
+        options.pool = &pool;
+
+        std::vector<char> encoded;
+        Result result = Measure(config, [&] { BlockFormat::EncodeBuffer(data.data(), data.size(), encoded, options); });
+        double ratio = static_cast<double>(encoded.size()) / data.size();
+        WriteRow(out, corpus, data.size(), stage, "-ce", threads, ratio, result);
+
+        options.compress = options.encrypt = false;
+        options.decompress = options.decrypt = true;
+        std::vector<char> decoded;
+        result = Measure(config, [&] {
+            BlockFormat::DecodeBuffer(encoded.data(), encoded.size(), decoded, options, corpus);
+        });
+        if (decoded != data) std::cerr << "Container round trip failed on " << corpus << std::endl;
+        WriteRow(out, corpus, data.size(), stage, "-ud", threads, ratio, result);
+    }
+}
+
+// ---- Command line ----
+
+void PrintUsage() {
+    std::cout << "Usage: so_bench [--size <bytes>[K|M]] [--corpus <name,...>] [--threads <n,...>] [--reps <n>] "
+                 "[--warmup <n>] [--comp-alg <alg>] [--enc-alg <alg>] [--out <file.csv>]"
+              << std::endl;
+    std::cout << "Corpora: random, repetitive, log, zero" << std::endl;
+}
+
+std::vector<std::string> SplitList(const std::string& text) {
+    std::vector<std::string> items;
+    std::stringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (!item.empty()) items.push_back(item);
+    }
+    return items;
+}
+
+// Strictly positive decimal count, optionally with a K or M suffix
+bool ParseNumber(std::string text, size_t& value, bool allowSuffix) {
+    size_t multiplier = 1;
+    if (allowSuffix && !text.empty()) {
+        char unit = text.back();
+        if (unit == 'K' || unit == 'k') multiplier = 1 << 10;
+        else if (unit == 'M' || unit == 'm') multiplier = 1 << 20;
+        if (multiplier != 1) text.pop_back();
+    }
+    if (text.empty() || text.size() > 9) return false;
+    size_t result = 0;
+    for (char ch : text) {
+        if (ch < '0' || ch > '9') return false;
+        result = result * 10 + static_cast<size_t>(ch - '0');
+    }
+    if (result == 0) return false;
+    value = result * multiplier;
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    BenchConfig config;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        bool ok = true;
+        if (arg == "--size" && hasValue) {
+            ok = ParseNumber(argv[++i], config.size, true);
+        } else if (arg == "--corpus" && hasValue) {
+            config.corpora = SplitList(argv[++i]);
+        } else if (arg == "--threads" && hasValue) {
+            config.threads.clear();
+            for (const std::string& item : SplitList(argv[++i])) {
+                size_t threads = 0;
+                ok = ok && ParseNumber(item, threads, false);
+                config.threads.push_back(threads);
+            }
+        } else if (arg == "--reps" && hasValue) {
+            ok = ParseNumber(argv[++i], config.reps, false);
+        } else if (arg == "--warmup" && hasValue) {
+            std::string text = argv[++i];
+            config.warmup = 0;
+            ok = text == "0" || ParseNumber(text, config.warmup, false);
+        } else if (arg == "--comp-alg" && hasValue) {
+            ok = Compression::ParseAlgorithm(argv[++i], config.algorithm);
+        } else if (arg == "--enc-alg" && hasValue) {
+            ok = Encryption::ParseCipher(argv[++i], config.cipher);
+        } else if (arg == "--out" && hasValue) {
+            config.outputPath = argv[++i];
+        } else {
+            PrintUsage();
+            return 1;
+        }
+        if (!ok) {
+            std::cerr << "Invalid value for " << arg << ": " << argv[i] << std::endl;
+            return 1;
+        }
+    }
+    if (config.threads.empty()) {
+        config.threads.push_back(1);
+        size_t cores = Concurrency::GetCoreCount();
+        if (cores > 1) config.threads.push_back(cores);
+    }
+
+    std::ofstream file;
+    if (!config.outputPath.empty()) {
+        file.open(config.outputPath);
+        if (!file) {
+            std::cerr << "Error opening file for writing: " << config.outputPath << std::endl;
+            return 1;
+        }
+    }
+    std::ostream& out = config.outputPath.empty() ? std::cout : file;
+
+    out << "corpus,bytes,stage,operation,threads,ratio,median_ms,p95_ms,mb_per_s,cycles_per_byte" << std::endl;
+    for (const std::string& corpus : config.corpora) {
+        std::vector<char> data;
+        if (!MakeCorpus(corpus, config.size, data)) {
+            std::cerr << "Unknown corpus: " << corpus << " (expected random, repetitive, log or zero)" << std::endl;
+            return 1;
+        }
+        std::cerr << "Corpus: " << corpus << std::endl;
+        BenchCodecs(out, config, corpus, data);
+        BenchCiphers(out, config, corpus, data);
+        BenchLegacy(out, config, corpus, data);
+        BenchContainer(out, config, corpus, data);
+    }
+    return 0;
+}
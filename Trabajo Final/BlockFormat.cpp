@@ -0,0 +1,917 @@
+#include "BlockFormat.h"
+#include "FileManager.h"
+#include "Compression.h"
+#include "Encryption.h"
+#include "Checksum.h"
+#include "Endian.h"
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <vector>
+#include <cstring>
+#include <iostream>
+
+namespace {
+
+const char kMagic[4] = {'S', 'O', 'B', 'K'};
+
+// RLE never more than doubles its input; anything larger is corruption
+size_t MaxStoredSize(size_t rawSize) {
+    return 2 * rawSize + 64;
+}
+
+uint8_t CodecFor(Compression::Algorithm algorithm) {
+    switch (algorithm) {
+    case Compression::AlgorithmRLE2: return BlockFormat::CodecRLE2;
+    case Compression::AlgorithmLZ: return BlockFormat::CodecLZ;
+    case Compression::AlgorithmHuffman: return BlockFormat::CodecHuffman;
+    case Compression::AlgorithmRLEHuffman: return BlockFormat::CodecRLEHuffman;
+    case Compression::AlgorithmLZHuffman: return BlockFormat::CodecLZHuffman;
+    case Compression::AlgorithmLZW: return BlockFormat::CodecLZW;
+    case Compression::AlgorithmRLE:
+    default: return BlockFormat::CodecRLE;
+    }
+}
+
+// Algorithm that undoes a block's codec; false for store and unknown codecs
+bool AlgorithmFor(uint8_t codec, Compression::Algorithm& algorithm) {
+    switch (codec) {
+    case BlockFormat::CodecRLE: algorithm = Compression::AlgorithmRLE; return true;
+    case BlockFormat::CodecRLE2: algorithm = Compression::AlgorithmRLE2; return true;
+    case BlockFormat::CodecLZ: algorithm = Compression::AlgorithmLZ; return true;
+    case BlockFormat::CodecHuffman: algorithm = Compression::AlgorithmHuffman; return true;
+    case BlockFormat::CodecRLEHuffman: algorithm = Compression::AlgorithmRLEHuffman; return true;
+    case BlockFormat::CodecLZHuffman: algorithm = Compression::AlgorithmLZHuffman; return true;
+    case BlockFormat::CodecLZW: algorithm = Compression::AlgorithmLZW; return true;
+    default: return false;
+    }
+}
+
+uint8_t CipherFor(Encryption::Cipher cipher) {
+    switch (cipher) {
+    case Encryption::CipherAES128: return BlockFormat::CipherAES128;
+    case Encryption::CipherAES256: return BlockFormat::CipherAES256;
+    case Encryption::CipherChaCha20: return BlockFormat::CipherChaCha20;
+    case Encryption::CipherVigenere:
+    default: return BlockFormat::CipherVigenere;
+    }
+}
+
+// Cipher that undoes a container's cipher id; false for none and unknown ids
+bool CipherOf(uint8_t id, Encryption::Cipher& cipher) {
+    switch (id) {
+    case BlockFormat::CipherVigenere: cipher = Encryption::CipherVigenere; return true;
+    case BlockFormat::CipherAES128: cipher = Encryption::CipherAES128; return true;
+    case BlockFormat::CipherAES256: cipher = Encryption::CipherAES256; return true;
+    case BlockFormat::CipherChaCha20: cipher = Encryption::CipherChaCha20; return true;
+    default: return false;
+    }
+}
+
+// Stream position block i is encrypted at; see the format notes in the header
+unsigned long long BlockKeyOffset(unsigned long long index) {
+    return index << 32;
+}
+
+// Where block bytes come from. Regular files are mapped and blocks point
+// straight into the mapping, as do in-memory buffers handed in by the
+// caller; pipes and special files are read block by block into a buffer
+// owned by the job.
+class BlockSource {
+public:
+    explicit BlockSource(Report::FileStats* stats = nullptr)
+        : memory(nullptr), memorySize(0), position(0), file(), fileOpen(false), stats(stats) {}
+
+    ~BlockSource() {
+        if (fileOpen) FileManager::CloseFile(file);
+    }
+
+    bool Open(const std::string& path) {
+        if (FileManager::OpenView(path, view, true)) {
+            Attach(view.Data(), view.Size());
+            return true;
+        }
+        unsigned long long size = 0;
+        fileOpen = FileManager::OpenForRead(path, file, size);
+        return fileOpen;
+    }
+
+    // Total input size; 0 when reading a pipe
+    size_t Size() const { return fileOpen ? 0 : memorySize; }
+
+    void Attach(const char* data, size_t size) {
+        memory = data;
+        memorySize = size;
+        position = 0;
+    }
+
+    // Pass over the first `size` bytes of a memory source; false if it is
+    // shorter or is a pipe
+    bool Skip(size_t size) {
+        if (fileOpen || memorySize - position < size) return false;
+        position += size;
+        return true;
+    }
+
+    // Next `size` bytes; got < size only at end of file. Nothing is copied
+    // for memory sources, otherwise the bytes land in `scratch`.
+    bool Next(size_t size, std::vector<char>& scratch, const char*& data, size_t& got) {
+        if (!fileOpen) {
+            got = (memorySize - position < size) ? memorySize - position : size;
+            data = memory + position;
+            position += got;
+            return true;
+        }
+        Report::Timer timer(stats, Report::StageRead, size);
+        scratch.resize(size);
+        if (!FileManager::ReadChunk(file, scratch.data(), size, got)) return false;
+        timer.SetBytes(got);
+        scratch.resize(got);
+        data = scratch.data();
+        return true;
+    }
+
+private:
+    FileManager::FileView view;
+    const char* memory;
+    size_t memorySize;
+    size_t position;
+    FileManager::NativeFile file;
+    bool fileOpen;
+    Report::FileStats* stats; // Times reads from a pipe
+};
+
+// Where finished bytes go: an output file or a caller's buffer. A sink can
+// be told to drop its first `skip` bytes and keep at most `limit` after
+// them (DecodeRange).
+class BlockSink {
+public:
+    // start: where the container begins in the file (AppendFile continues one)
+    BlockSink(FileManager::FileWriter& f, Report::FileStats* stats, unsigned long long start = 0)
+        : file(&f), buffer(nullptr), stats(stats), position(start) {}
+    explicit BlockSink(std::vector<char>& out) : file(nullptr), buffer(&out), stats(nullptr), position(0) {}
+
+    // Bytes written since the container began, for the block index
+    unsigned long long Position() const { return position; }
+
+    void SetRange(unsigned long long skipBytes, unsigned long long limitBytes) {
+        skip = skipBytes;
+        limit = limitBytes;
+    }
+
+    bool Write(const char* data, size_t size) {
+        size_t dropped = static_cast<size_t>(std::min<unsigned long long>(skip, size));
+        skip -= dropped;
+        data += dropped;
+        size -= dropped;
+        if (size > limit) size = static_cast<size_t>(limit);
+        limit -= size;
+        position += size;
+        if (size == 0) return true;
+        if (buffer) {
+            buffer->insert(buffer->end(), data, data + size);
+            return true;
+        }
+        Report::Timer timer(stats, Report::StageWrite, size);
+        return file->Write(data, size);
+    }
+
+private:
+    FileManager::FileWriter* file;
+    std::vector<char>* buffer;
+    Report::FileStats* stats; // Times file writes
+    unsigned long long position;
+    unsigned long long skip = 0;
+    unsigned long long limit = ~0ULL;
+};
+
+// One entry of the block index: where a block's raw bytes start in the
+// original file, and where its header is in the container
+struct BlockIndexEntry {
+    uint64_t rawOffset;
+    uint64_t position;
+};
+
+const char kIndexMagic[8] = {'S', 'O', 'B', 'K', 'I', 'N', 'D', 'X'};
+const size_t kIndexEntrySize = 16;
+const size_t kIndexFooterSize = 24; // Count, CRC-32C, reserved, magic
+
+// After the end marker of a container of more than one block; a single
+// block needs no index to be found
+bool WriteBlockIndex(BlockSink& out, const std::vector<BlockIndexEntry>& index) {
+    if (index.size() < 2) return true;
+    std::vector<char> bytes(index.size() * kIndexEntrySize + kIndexFooterSize, 0);
+    for (size_t i = 0; i < index.size(); ++i) {
+        Endian::PutU64(bytes.data() + i * kIndexEntrySize, index[i].rawOffset);
+        Endian::PutU64(bytes.data() + i * kIndexEntrySize + 8, index[i].position);
+    }
+    char* footer = bytes.data() + index.size() * kIndexEntrySize;
+    Endian::PutU64(footer, index.size());
+    Endian::PutU32(footer + 8, Checksum::Crc32c(bytes.data(), index.size() * kIndexEntrySize));
+    std::memcpy(footer + 16, kIndexMagic, sizeof(kIndexMagic));
+    return out.Write(bytes.data(), bytes.size());
+}
+
+// The block index at the end of a container, if it has a sound one.
+// indexStart is where the index begins, right after the end marker.
+bool ReadBlockIndex(const char* data, size_t size, std::vector<BlockIndexEntry>& index, size_t& indexStart) {
+    if (size < kIndexFooterSize) return false;
+    const char* footer = data + size - kIndexFooterSize;
+    if (std::memcmp(footer + 16, kIndexMagic, sizeof(kIndexMagic)) != 0) return false;
+    uint64_t count = Endian::GetU64(footer);
+    if (count < 2 || count > (size - kIndexFooterSize) / kIndexEntrySize) return false;
+    size_t entriesSize = static_cast<size_t>(count) * kIndexEntrySize;
+    indexStart = size - kIndexFooterSize - entriesSize;
+    if (Checksum::Crc32c(data + indexStart, entriesSize) != Endian::GetU32(footer + 8)) return false;
+
+    index.resize(static_cast<size_t>(count));
+    for (size_t i = 0; i < index.size(); ++i) {
+        index[i].rawOffset = Endian::GetU64(data + indexStart + i * kIndexEntrySize);
+        index[i].position = Endian::GetU64(data + indexStart + i * kIndexEntrySize + 8);
+        // Both only ever grow from the first block, and every header sits
+        // before the end marker
+        if (index[i].position + BlockFormat::BlockHeaderSize * 2 > indexStart ||
+            (i == 0 && index[i].rawOffset != 0) ||
+            (i > 0 && (index[i].rawOffset <= index[i - 1].rawOffset || index[i].position <= index[i - 1].position))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// What the file header of a container says
+struct ContainerInfo {
+    uint8_t cipher;
+    uint64_t nonce = 0;
+    std::string key; // What the cipher is given: see ContainerKey
+    size_t blockSize;
+};
+
+// One block on its way through the pool. source is the block as found in
+// the input (in the mapped view, or in `input` when read); `data` holds the
+// transformed bytes, and payload points at whichever of the two is the
+// result once the job's TaskGroup has drained.
+struct BlockJob {
+    const BlockFormat::Options* options;
+    unsigned long long index;
+    const char* source = nullptr;
+    size_t sourceSize = 0;
+    std::vector<char> input;
+    std::vector<char> data;
+    const char* payload = nullptr;
+    size_t payloadSize = 0;
+    uint32_t rawSize = 0;
+    uint32_t checksum = 0;
+    uint8_t codec = BlockFormat::CodecStore;
+    uint8_t cipher = BlockFormat::CipherNone;
+    uint64_t nonce = 0;
+    const std::string* key = nullptr; // Of the container, for the cipher
+    bool ok = true;
+    std::string error;
+    Concurrency::TaskGroup group;
+};
+
+typedef std::deque<std::unique_ptr<BlockJob>> BlockWindow;
+
+// Blocks kept in flight per file: enough to keep every worker busy on a
+// single large file plus one being read, without holding the whole file
+size_t WindowSize(const BlockFormat::Options& options) {
+    return options.pool ? options.pool->WorkerCount() + 1 : 1;
+}
+
+void Launch(const BlockFormat::Options& options, Concurrency::ThreadFunc func, BlockJob* job) {
+    if (options.pool) {
+        options.pool->Submit(func, job, &job->group);
+    } else {
+        func(job);
+    }
+}
+
+void Finish(const BlockFormat::Options& options, BlockJob* job) {
+    if (options.pool) {
+        options.pool->Wait(job->group);
+    }
+}
+
+void SetPayload(BlockJob* job, const char* data, size_t size) {
+    job->payload = data;
+    job->payloadSize = size;
+}
+
+// Compress -> Encrypt, then checksum what actually lands on disk
+int EncodeBlockTask(void* param) {
+    BlockJob* job = static_cast<BlockJob*>(param);
+    const BlockFormat::Options& options = *job->options;
+
+    job->rawSize = static_cast<uint32_t>(job->sourceSize);
+    SetPayload(job, job->source, job->sourceSize);
+    Compression::Algorithm algorithm = options.algorithm;
+    bool compress = options.compress;
+    if (compress && algorithm == Compression::AlgorithmAuto) {
+        // Blocks that sample as incompressible are stored without trying
+        compress = Compression::SelectAlgorithm(job->source, job->sourceSize, algorithm);
+    }
+    if (compress) {
+        Report::Timer timer(options.stats, Report::StageCompress, job->payloadSize);
+        job->data = Compression::Compress(algorithm, job->payload, job->payloadSize, options.lzwBits);
+        job->codec = CodecFor(algorithm);
+        if (algorithm != Compression::AlgorithmRLE && job->data.size() >= job->sourceSize) {
+            // Did not shrink: keep the raw bytes, so the block costs
+            // nothing beyond its header (classic RLE keeps its old output)
+            job->codec = BlockFormat::CodecStore;
+        } else {
+            SetPayload(job, job->data.data(), job->data.size());
+        }
+    }
+    if (options.encrypt) {
+        Report::Timer timer(options.stats, Report::StageEncrypt, job->payloadSize);
+        // A compressed block is ours already and is encrypted where it is
+        if (job->payload != job->data.data()) job->data.resize(job->payloadSize);
+        Encryption::Encrypt(options.cipher, job->payload, job->data.data(), job->payloadSize, *job->key, job->nonce,
+                            BlockKeyOffset(job->index));
+        SetPayload(job, job->data.data(), job->data.size());
+    }
+    Report::Timer timer(options.stats, Report::StageChecksum, job->payloadSize);
+    job->checksum = Checksum::Crc32c(job->payload, job->payloadSize);
+    return 0;
+}
+
+// The stored CRC against the stored payload
+bool BlockIntact(BlockJob* job) {
+    Report::Timer timer(job->options->stats, Report::StageChecksum, job->sourceSize);
+    if (Checksum::Crc32c(job->source, job->sourceSize) != job->checksum) {
+        job->ok = false;
+        job->error = "checksum mismatch";
+        return false;
+    }
+    return true;
+}
+
+// Verify -> Decrypt -> Decompress
+int DecodeBlockTask(void* param) {
+    BlockJob* job = static_cast<BlockJob*>(param);
+    const BlockFormat::Options& options = *job->options;
+
+    SetPayload(job, job->source, job->sourceSize);
+    if (!BlockIntact(job)) return 1;
+
+    Encryption::Cipher cipher;
+    if (CipherOf(job->cipher, cipher)) {
+        Report::Timer timer(options.stats, Report::StageDecrypt, job->payloadSize);
+        job->data.resize(job->payloadSize);
+        Encryption::Decrypt(cipher, job->payload, job->data.data(), job->payloadSize, *job->key, job->nonce,
+                            BlockKeyOffset(job->index));
+        SetPayload(job, job->data.data(), job->data.size());
+    }
+
+    Compression::Algorithm algorithm;
+    if (AlgorithmFor(job->codec, algorithm)) {
+        Report::Timer timer(options.stats, Report::StageDecompress, job->payloadSize);
+        // The payload may live in job->data, so decode into a fresh buffer
+        std::vector<char> raw;
+        if (!Compression::Decompress(algorithm, job->payload, job->payloadSize, raw)) {
+            job->ok = false;
+            job->error = "corrupt compressed data";
+            return 1;
+        }
+        job->data.swap(raw);
+        SetPayload(job, job->data.data(), job->data.size());
+    } else if (job->codec != BlockFormat::CodecStore) {
+        job->ok = false;
+        job->error = "unknown codec " + std::to_string(job->codec);
+        return 1;
+    }
+
+    if (job->payloadSize != job->rawSize) {
+        job->ok = false;
+        job->error = "decoded size does not match block header";
+        return 1;
+    }
+    return 0;
+}
+
+// --verify: the stored CRC only; nothing is decrypted or decompressed
+int VerifyBlockTask(void* param) {
+    BlockJob* job = static_cast<BlockJob*>(param);
+    return BlockIntact(job) ? 0 : 1;
+}
+
+bool WriteEncodedBlock(BlockSink& out, const BlockJob& job) {
+    char header[BlockFormat::BlockHeaderSize] = {0};
+    Endian::PutU32(header, job.rawSize);
+    Endian::PutU32(header + 4, static_cast<uint32_t>(job.payloadSize));
+    Endian::PutU32(header + 8, job.checksum);
+    header[12] = static_cast<char>(job.codec);
+    return out.Write(header, sizeof(header)) && out.Write(job.payload, job.payloadSize);
+}
+
+bool WriteEndMarker(BlockSink& out) {
+    char header[BlockFormat::BlockHeaderSize] = {0};
+    return out.Write(header, sizeof(header));
+}
+
+// Wait for every block still in flight; their tasks reference the jobs
+void Drain(const BlockFormat::Options& options, BlockWindow& window) {
+    for (auto& job : window) Finish(options, job.get());
+    window.clear();
+}
+
+bool IsContainerHeader(const char* data, size_t size) {
+    return size >= 5 &&
+           std::memcmp(data, kMagic, sizeof(kMagic)) == 0 &&
+           static_cast<uint8_t>(data[4]) == BlockFormat::Version;
+}
+
+// The key handed to the cipher: the passphrase for Vigenère, the derived
+// per-container key for the nonce ciphers
+std::string ContainerKey(const std::string& passphrase, Encryption::Cipher cipher, uint64_t nonce) {
+    if (!Encryption::UsesNonce(cipher)) return passphrase;
+    return Encryption::FileKey(passphrase, nonce);
+}
+
+// Every block from index `first` on, in order, then the end marker and the
+// block index. index holds the entries of the blocks before `first`, and
+// rawOffset the raw bytes they cover.
+bool EncodeBlockRange(BlockSource& in, BlockSink& out, const BlockFormat::Options& options, uint64_t nonce,
+                      unsigned long long first, std::vector<BlockIndexEntry>& blockIndex,
+                      unsigned long long rawOffset) {
+    size_t blockSize = options.blockSize ? options.blockSize : 1 << 20;
+    std::string key = options.encrypt ? ContainerKey(options.key, options.cipher, nonce) : "";
+    BlockWindow window;
+    size_t maxInFlight = WindowSize(options);
+    unsigned long long index = first;
+    bool endOfFile = false;
+    bool ok = true;
+
+    while (ok && !endOfFile) {
+        std::unique_ptr<BlockJob> job(new BlockJob());
+        job->options = &options;
+        job->index = index;
+        job->nonce = nonce;
+        job->key = &key;
+
+        size_t bytesRead = 0;
+        if (!in.Next(blockSize, job->input, job->source, bytesRead)) {
+            ok = false;
+            break;
+        }
+        if (bytesRead < blockSize) endOfFile = true;
+
+        // An empty read still has to flush the blocks already in flight
+        if (bytesRead > 0) {
+            job->sourceSize = bytesRead;
+            Launch(options, EncodeBlockTask, job.get());
+            window.push_back(std::move(job));
+            index++;
+        }
+
+        // Write blocks in order as soon as the window is full
+        while (ok && (window.size() >= maxInFlight || (endOfFile && !window.empty()))) {
+            BlockJob* oldest = window.front().get();
+            Finish(options, oldest);
+            blockIndex.push_back(BlockIndexEntry{rawOffset, out.Position()});
+            rawOffset += oldest->rawSize;
+            ok = WriteEncodedBlock(out, *oldest);
+            window.pop_front();
+        }
+    }
+
+    Drain(options, window);
+    if (ok) ok = WriteEndMarker(out) && WriteBlockIndex(out, blockIndex);
+    return ok;
+}
+
+// File header, then every block in order, then the end marker
+bool EncodeBlocks(BlockSource& in, BlockSink& out, const BlockFormat::Options& options) {
+    size_t blockSize = options.blockSize ? options.blockSize : 1 << 20;
+
+    // Ciphers with a nonce get a fresh one per file, stored after the
+    // original header fields
+    bool withNonce = options.encrypt && Encryption::UsesNonce(options.cipher);
+    uint64_t nonce = withNonce ? Encryption::NewNonce() : 0;
+    size_t headerSize = withNonce ? BlockFormat::NonceHeaderSize : BlockFormat::FileHeaderSize;
+
+    char fileHeader[BlockFormat::NonceHeaderSize] = {0};
+    std::memcpy(fileHeader, kMagic, sizeof(kMagic));
+    fileHeader[4] = static_cast<char>(BlockFormat::Version);
+    fileHeader[5] = static_cast<char>(options.encrypt ? CipherFor(options.cipher) : static_cast<uint8_t>(BlockFormat::CipherNone));
+    Endian::PutU16(fileHeader + 6, static_cast<uint16_t>(headerSize));
+    Endian::PutU32(fileHeader + 8, static_cast<uint32_t>(blockSize));
+    if (withNonce) Endian::PutU64(fileHeader + 16, nonce);
+    std::vector<BlockIndexEntry> blockIndex;
+    return out.Write(fileHeader, headerSize) && EncodeBlockRange(in, out, options, nonce, 0, blockIndex, 0);
+}
+
+// Validate the file header and check the requested operations can undo it
+bool ReadContainerHeader(BlockSource& in, const std::string& name, const BlockFormat::Options& options, ContainerInfo& info) {
+    std::vector<char> scratch;
+    const char* fileHeader = nullptr;
+    size_t got = 0;
+    if (!in.Next(BlockFormat::FileHeaderSize, scratch, fileHeader, got) || got != BlockFormat::FileHeaderSize ||
+        !IsContainerHeader(fileHeader, got)) {
+        std::cerr << "Error: not a block container: " << name << std::endl;
+        return false;
+    }
+
+    info.cipher = static_cast<uint8_t>(fileHeader[5]);
+    size_t headerSize = Endian::GetU16(fileHeader + 6);
+    info.blockSize = Endian::GetU32(fileHeader + 8);
+
+    if (info.cipher != BlockFormat::CipherNone && !options.decrypt && !options.verify) {
+        std::cerr << "Error: " << name << " is encrypted; add -u and the key." << std::endl;
+        return false;
+    }
+    Encryption::Cipher cipher = Encryption::CipherVigenere;
+    if (info.cipher != BlockFormat::CipherNone && !CipherOf(info.cipher, cipher)) {
+        std::cerr << "Error: unknown cipher " << static_cast<int>(info.cipher) << " in " << name << std::endl;
+        return false;
+    }
+    bool withNonce = info.cipher != BlockFormat::CipherNone && Encryption::UsesNonce(cipher);
+    if (withNonce && headerSize < BlockFormat::NonceHeaderSize) {
+        std::cerr << "Error: missing nonce in " << name << std::endl;
+        return false;
+    }
+
+    // The nonce, if any, then header fields added by newer writers
+    if (headerSize > BlockFormat::FileHeaderSize) {
+        const char* extra = nullptr;
+        size_t extraSize = headerSize - BlockFormat::FileHeaderSize;
+        if (!in.Next(extraSize, scratch, extra, got) || got != extraSize) {
+            std::cerr << "Error: truncated header in " << name << std::endl;
+            return false;
+        }
+        if (withNonce) info.nonce = Endian::GetU64(extra);
+    }
+    // Verifying only checks CRCs, so the key is not stretched for it
+    if (info.cipher != BlockFormat::CipherNone && options.decrypt) {
+        info.key = ContainerKey(options.key, cipher, info.nonce);
+    }
+    return true;
+}
+
+// What DecodeBlocks went through
+struct BlockTally {
+    unsigned long long blocks = 0;
+    unsigned long long damaged = 0;
+};
+
+// Every block after the file header, up to the end marker. When verifying
+// there is no sink, and damaged blocks are counted instead of ending the
+// scan. DecodeRange starts the source at block `first` and stops before
+// block `stop`.
+bool DecodeBlocks(BlockSource& in, BlockSink* out, const BlockFormat::Options& options,
+                  const ContainerInfo& info, const std::string& name, BlockTally& tally,
+                  unsigned long long first = 0, unsigned long long stop = ~0ULL) {
+    std::vector<char> scratch;
+    BlockWindow window;
+    size_t maxInFlight = WindowSize(options);
+    unsigned long long index = first;
+    size_t got = 0;
+    bool ok = true;
+    bool sawEnd = false;
+
+    while (ok && !sawEnd) {
+        const char* header = nullptr;
+        uint32_t rawSize = 0;
+        uint32_t storedSize = 0;
+        if (index < stop) {
+            if (!in.Next(BlockFormat::BlockHeaderSize, scratch, header, got)) {
+                ok = false;
+                break;
+            }
+            if (got != BlockFormat::BlockHeaderSize) {
+                std::cerr << "Error: " << name << " is truncated after block " << index << std::endl;
+                ok = false;
+                break;
+            }
+            rawSize = Endian::GetU32(header);
+            storedSize = Endian::GetU32(header + 4);
+        }
+        if (rawSize == 0 && storedSize == 0) {
+            sawEnd = true;
+        } else {
+            if (rawSize > info.blockSize || storedSize > MaxStoredSize(info.blockSize)) {
+                std::cerr << "Error: corrupt header for block " << index << " in " << name << std::endl;
+                ok = false;
+                break;
+            }
+
+            std::unique_ptr<BlockJob> job(new BlockJob());
+            job->options = &options;
+            job->index = index;
+            job->rawSize = rawSize;
+            job->checksum = Endian::GetU32(header + 8);
+            job->codec = static_cast<uint8_t>(header[12]);
+            job->cipher = info.cipher;
+            job->nonce = info.nonce;
+            job->key = &info.key;
+
+            if (job->codec != BlockFormat::CodecStore && !options.decompress && !options.verify) {
+                std::cerr << "Error: " << name << " is compressed; add -d." << std::endl;
+                ok = false;
+                break;
+            }
+
+            job->sourceSize = storedSize;
+            if (!in.Next(storedSize, job->input, job->source, got) || got != storedSize) {
+                std::cerr << "Error: " << name << " is truncated in block " << index << std::endl;
+                ok = false;
+                break;
+            }
+
+            Launch(options, options.verify ? VerifyBlockTask : DecodeBlockTask, job.get());
+            window.push_back(std::move(job));
+            index++;
+        }
+
+        while (ok && (window.size() >= maxInFlight || (sawEnd && !window.empty()))) {
+            BlockJob* oldest = window.front().get();
+            Finish(options, oldest);
+            tally.blocks++;
+            if (!oldest->ok) {
+                std::cerr << "Error: block " << oldest->index << " of " << name << ": " << oldest->error << std::endl;
+                tally.damaged++;
+                if (!options.verify) ok = false;
+            } else if (out) {
+                ok = out->Write(oldest->payload, oldest->payloadSize);
+            }
+            window.pop_front();
+        }
+    }
+
+    Drain(options, window);
+    return ok && tally.damaged == 0;
+}
+
+// Follow the block headers from `position` (just past the file header) to
+// the end marker without decoding anything, listing where every block
+// starts. False if a header is malformed or the end marker is missing.
+bool WalkBlocks(const char* data, size_t size, size_t position, size_t blockSize,
+                std::vector<BlockIndexEntry>& blocks, unsigned long long& rawBytes, size_t& endMarker) {
+    rawBytes = 0;
+    while (size - position >= BlockFormat::BlockHeaderSize) {
+        uint32_t rawSize = Endian::GetU32(data + position);
+        uint32_t storedSize = Endian::GetU32(data + position + 4);
+        if (rawSize == 0 && storedSize == 0) {
+            endMarker = position;
+            return true;
+        }
+        if (rawSize > blockSize || storedSize > size - position - BlockFormat::BlockHeaderSize) return false;
+        blocks.push_back(BlockIndexEntry{rawBytes, position});
+        position += BlockFormat::BlockHeaderSize + storedSize;
+        rawBytes += rawSize;
+    }
+    return false;
+}
+
+// Where an existing container can be extended from (AppendFile)
+struct ContainerTail {
+    size_t blockSize = 0;
+    uint64_t nonce = 0;
+    unsigned long long blocks = 0;    // Blocks already stored
+    unsigned long long rawBytes = 0;  // Input bytes they hold
+    unsigned long long endMarker = 0; // Offset of the end marker
+    std::vector<BlockIndexEntry> index; // Of the blocks already stored
+};
+
+// Walk a container's block headers without decoding anything. It has to be
+// one EncodeBlocks could have written with these options: same cipher,
+// well formed, nothing after the end marker but a block index.
+bool FindTail(const std::string& path, const BlockFormat::Options& options, ContainerTail& tail) {
+    FileManager::FileView view;
+    if (!FileManager::OpenView(path, view, true)) return false;
+    const char* data = view.Data();
+    size_t size = view.Size();
+    if (size < BlockFormat::FileHeaderSize || !IsContainerHeader(data, size)) return false;
+
+    uint8_t cipher = options.encrypt ? CipherFor(options.cipher) : static_cast<uint8_t>(BlockFormat::CipherNone);
+    size_t headerSize = Endian::GetU16(data + 6);
+    bool withNonce = options.encrypt && Encryption::UsesNonce(options.cipher);
+    if (static_cast<uint8_t>(data[5]) != cipher || headerSize < BlockFormat::FileHeaderSize || headerSize > size ||
+        (withNonce && headerSize < BlockFormat::NonceHeaderSize)) {
+        return false;
+    }
+    tail.blockSize = Endian::GetU32(data + 8);
+    tail.nonce = withNonce ? Endian::GetU64(data + 16) : 0;
+    if (tail.blockSize == 0) return false;
+
+    size_t endMarker = 0;
+    if (!WalkBlocks(data, size, headerSize, tail.blockSize, tail.index, tail.rawBytes, endMarker)) return false;
+    tail.blocks = tail.index.size();
+    tail.endMarker = endMarker;
+
+    std::vector<BlockIndexEntry> stored;
+    size_t indexStart = 0;
+    return endMarker + BlockFormat::BlockHeaderSize == size ||
+           (ReadBlockIndex(data, size, stored, indexStart) && indexStart == endMarker + BlockFormat::BlockHeaderSize);
+}
+
+// The writer's last flush counts as writing
+bool FinishOutput(FileManager::FileWriter& file, const BlockFormat::Options& options) {
+    Report::Timer timer(options.stats, Report::StageWrite, 0);
+    return file.Finish();
+}
+
+} // namespace
+
+bool BlockFormat::IsFramed(const std::string& path, bool assumeIfUnseekable) {
+    // Sniff through a mapping: reading a pipe would eat the bytes the
+    // decoder needs, so pipes and devices get the caller's assumption
+    FileManager::FileView view;
+    if (!FileManager::OpenView(path, view, true)) return assumeIfUnseekable;
+    return IsContainerHeader(view.Data(), view.Size());
+}
+
+bool BlockFormat::IsFramed(const char* data, size_t size) {
+    return IsContainerHeader(data, size);
+}
+
+bool BlockFormat::EncodeFile(const std::string& inputPath, const std::string& outputPath, const Options& options) {
+    BlockSource in(options.stats);
+    FileManager::FileWriter file;
+    if (!in.Open(inputPath)) return false;
+
+    // Reserve room for the worst case, every block stored; Finish trims it
+    size_t blockSize = options.blockSize ? options.blockSize : 1 << 20;
+    unsigned long long expected = in.Size() + (in.Size() / blockSize + 2) * BlockHeaderSize + NonceHeaderSize;
+    if (!file.Open(outputPath, in.Size() ? expected : 0)) return false;
+
+    BlockSink out(file, options.stats);
+    bool ok = EncodeBlocks(in, out, options);
+
+    if (!FinishOutput(file, options)) ok = false;
+    if (!ok) {
+        std::cerr << "Error encoding file: " << inputPath << std::endl;
+    }
+    return ok;
+}
+
+bool BlockFormat::AppendFile(const std::string& inputPath, const std::string& outputPath, const Options& options) {
+    ContainerTail tail;
+    if (!FindTail(outputPath, options, tail)) return EncodeFile(inputPath, outputPath, options);
+
+    BlockSource in(options.stats);
+    if (!in.Open(inputPath)) return false;
+    if (!in.Skip(static_cast<size_t>(tail.rawBytes))) return EncodeFile(inputPath, outputPath, options);
+
+    // The new blocks follow the old ones: same size and nonce, and the
+    // numbering (hence the keystream position) carries on
+    Options appendOptions = options;
+    appendOptions.blockSize = tail.blockSize;
+
+    FileManager::FileWriter file;
+    if (!file.OpenAt(outputPath, tail.endMarker)) return false;
+    BlockSink out(file, options.stats, tail.endMarker);
+    bool ok = EncodeBlockRange(in, out, appendOptions, tail.nonce, tail.blocks, tail.index, tail.rawBytes);
+
+    if (!FinishOutput(file, options)) ok = false;
+    if (!ok) {
+        std::cerr << "Error appending to file: " << outputPath << std::endl;
+    }
+    return ok;
+}
+
+bool BlockFormat::DecodeFile(const std::string& inputPath, const std::string& outputPath, const Options& options) {
+    BlockSource in(options.stats);
+    FileManager::FileWriter file;
+    ContainerInfo info;
+    if (!in.Open(inputPath)) return false;
+    if (!ReadContainerHeader(in, inputPath, options, info)) return false;
+    // The raw size is only known block by block; the container size is a
+    // fair guess (exact for stored blocks) and the file grows past it if needed
+    if (!file.Open(outputPath, in.Size())) return false;
+
+    BlockSink out(file, options.stats);
+    BlockTally tally;
+    bool ok = DecodeBlocks(in, &out, options, info, inputPath, tally);
+
+    if (!FinishOutput(file, options)) ok = false;
+    if (!ok) {
+        // A half-restored file would pass for a real output
+        FileManager::RemoveFile(outputPath);
+        std::cerr << "Error decoding file: " << inputPath << std::endl;
+    }
+    return ok;
+}
+
+bool BlockFormat::DecodeRange(const std::string& inputPath, const std::string& outputPath, const Options& options,
+                              unsigned long long start, unsigned long long length) {
+    // Blocks are reached by offset, so the input has to be mappable
+    FileManager::FileView view;
+    if (!FileManager::OpenView(inputPath, view, true)) {
+        std::cerr << "Error: a range can only be read from a regular file: " << inputPath << std::endl;
+        return false;
+    }
+    const char* data = view.Data();
+    size_t size = view.Size();
+    BlockSource in(options.stats);
+    ContainerInfo info;
+    in.Attach(data, size);
+    if (!ReadContainerHeader(in, inputPath, options, info)) return false;
+
+    // Where every block starts: from the block index, or for containers
+    // written before it existed (or with a single block) from the headers
+    std::vector<BlockIndexEntry> blocks;
+    unsigned long long total = 0;
+    size_t indexStart = 0;
+    size_t endMarker = 0;
+    if (ReadBlockIndex(data, size, blocks, indexStart)) {
+        total = blocks.back().rawOffset + Endian::GetU32(data + blocks.back().position);
+    } else if (!WalkBlocks(data, size, Endian::GetU16(data + 6), info.blockSize, blocks, total, endMarker)) {
+        std::cerr << "Error: corrupt block headers in " << inputPath << std::endl;
+        return false;
+    }
+    if (start >= total || length == 0) {
+        std::cerr << "Error: range starts past the " << total << " bytes held in " << inputPath << std::endl;
+        return false;
+    }
+    unsigned long long end = length > total - start ? total : start + length;
+
+    // The block holding `start`, and the first block past `end`
+    auto before = [](unsigned long long offset, const BlockIndexEntry& entry) { return offset < entry.rawOffset; };
+    size_t first = std::upper_bound(blocks.begin(), blocks.end(), start, before) - blocks.begin() - 1;
+    size_t stop = std::upper_bound(blocks.begin(), blocks.end(), end - 1, before) - blocks.begin();
+
+    FileManager::FileWriter file;
+    if (!file.Open(outputPath, end - start)) return false;
+    in.Attach(data + blocks[first].position, size - blocks[first].position);
+    BlockSink out(file, options.stats);
+    out.SetRange(start - blocks[first].rawOffset, end - start);
+    BlockTally tally;
+    bool ok = DecodeBlocks(in, &out, options, info, inputPath, tally, first, stop);
+
+    if (!FinishOutput(file, options)) ok = false;
+    if (!ok) {
+        // A half-restored file would pass for a real output
+        FileManager::RemoveFile(outputPath);
+        std::cerr << "Error decoding a range of " << inputPath << std::endl;
+    }
+    return ok;
+}
+
+bool BlockFormat::VerifyFile(const std::string& inputPath, const Options& options) {
+    BlockSource in(options.stats);
+    ContainerInfo info;
+    if (!in.Open(inputPath)) return false;
+    if (!ReadContainerHeader(in, inputPath, options, info)) return false;
+
+    BlockTally tally;
+    bool ok = DecodeBlocks(in, nullptr, options, info, inputPath, tally);
+    if (tally.damaged) {
+        std::cerr << "Error: " << tally.damaged << " of " << tally.blocks << " blocks damaged in " << inputPath
+                  << std::endl;
+    } else if (!ok) {
+        std::cerr << "Error verifying file: " << inputPath << std::endl;
+    }
+    return ok;
+}
+
+bool BlockFormat::EncodeBuffer(const char* data, size_t size, std::vector<char>& output, const Options& options) {
+    BlockSource in;
+    in.Attach(data, size);
+    output.clear();
+    BlockSink out(output);
+    return EncodeBlocks(in, out, options);
+}
+
+bool BlockFormat::EncodeToWriter(const char* data, size_t size, FileManager::FileWriter& writer,
+                                 const Options& options) {
+    BlockSource in;
+    in.Attach(data, size);
+    BlockSink out(writer, options.stats);
+    return EncodeBlocks(in, out, options);
+}
+
+bool BlockFormat::DecodeToFile(const char* data, size_t size, const std::string& outputPath, const Options& options,
+                               const std::string& name) {
+    BlockSource in;
+    ContainerInfo info;
+    in.Attach(data, size);
+    if (!ReadContainerHeader(in, name, options, info)) return false;
+    FileManager::FileWriter file;
+    if (!file.Open(outputPath, size)) return false;
+
+    BlockSink out(file, options.stats);
+    BlockTally tally;
+    bool ok = DecodeBlocks(in, &out, options, info, name, tally);
+
+    if (!FinishOutput(file, options)) ok = false;
+    if (!ok) {
+        // A half-restored file would pass for a real output
+        FileManager::RemoveFile(outputPath);
+        std::cerr << "Error decoding " << name << std::endl;
+    }
+    return ok;
+}
+
+bool BlockFormat::DecodeBuffer(const char* data, size_t size, std::vector<char>& output, const Options& options,
+                               const std::string& name) {
+    BlockSource in;
+    ContainerInfo info;
+    in.Attach(data, size);
+    output.clear();
+    if (!ReadContainerHeader(in, name, options, info)) return false;
+    BlockSink out(output);
+    BlockTally tally;
+    return DecodeBlocks(in, &out, options, info, name, tally);
+}
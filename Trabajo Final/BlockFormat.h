@@ -0,0 +1,153 @@
+#ifndef BLOCKFORMAT_H
+#define BLOCKFORMAT_H
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include "Concurrency.h"
+#include "Compression.h"
+#include "Encryption.h"
+#include "FileManager.h"
+#include "Report.h"
+
+// Block-framed container written by -c/-e.
+//
+// The input is cut into fixed-size raw blocks; each block is compressed and
+// encrypted on its own, so the blocks of one large file are spread across
+// the worker pool and reassembled in order. All integers are little-endian.
+//
+//   File header (16 bytes)
+//     0  magic "SOBK"
+//     4  version (1)
+//     5  cipher applied to the payloads (Cipher)
+//     6  header size in bytes; readers skip anything past the fields they know
+//     8  raw block size used by the writer
+//    12  reserved (0)
+//    16  nonce (8 bytes), present only for ciphers that use one
+//        (AES, ChaCha20); the header size is then 24
+//
+//   Block header (16 bytes), followed by storedSize payload bytes
+//     0  raw (uncompressed) size
+//     4  stored (compressed + encrypted) size
+//     8  CRC-32C of the stored payload
+//    12  codec (Codec)
+//    13  reserved (0)
+//
+//   End marker: a block header with raw size and stored size both 0.
+//
+//   Block index, after the end marker of containers with more than one
+//   block, so a byte range can be decoded without reading the blocks
+//   before it (DecodeRange). Readers that stop at the end marker never
+//   see it.
+//     per block (16 bytes): offset of its raw bytes in the original file,
+//                           offset of its block header in the container
+//     footer (24 bytes): block count (8), CRC-32C of the entries (4),
+//                        reserved (4), magic "SOBKINDX"
+//
+// Blocks hold at most the header's block size. Only the last one is short,
+// except in containers extended by AppendFile, where each append starts a
+// new block.
+//
+// Block i is encrypted as if it started at stream position i << 32, so any
+// block can be decrypted without the ones before it. For AES and ChaCha20 that
+// position selects the counter blocks, and the nonce keeps files with the same key
+// from sharing a keystream. Their key is Encryption::FileKey(passphrase, nonce).
+class BlockFormat {
+public:
+    static constexpr size_t FileHeaderSize = 16;
+    static constexpr size_t NonceHeaderSize = 24; // File header with a nonce
+    static constexpr size_t BlockHeaderSize = 16;
+    static constexpr uint8_t Version = 1;
+
+    enum Codec : uint8_t {
+        CodecStore = 0,      // Payload is the raw block
+        CodecRLE = 1,        // Compression::CompressRLE
+        CodecRLE2 = 2,       // Compression::CompressRLE2
+        CodecLZ = 3,         // Compression::CompressLZ
+        CodecHuffman = 4,    // Compression::CompressHuffman
+        CodecRLEHuffman = 5, // CompressRLE, then CompressHuffman
+        CodecLZHuffman = 6,  // CompressLZ, then CompressHuffman
+        CodecLZW = 7         // Compression::CompressLZW
+    };
+
+    enum Cipher : uint8_t {
+        CipherNone = 0,
+        CipherVigenere = 1,
+        CipherAES128 = 2,
+        CipherAES256 = 3,
+        CipherChaCha20 = 4
+    };
+
+    struct Options {
+        bool compress = false;
+        bool decompress = false;
+        bool encrypt = false;
+        bool decrypt = false;
+        bool verify = false; // Check stored checksums only (VerifyFile)
+        std::string key;
+        Encryption::Cipher cipher = Encryption::CipherVigenere; // Used by -e
+        Compression::Algorithm algorithm = Compression::AlgorithmRLE; // Used by -c
+        unsigned lzwBits = Compression::DefaultLZWBits;
+        size_t blockSize = 1 << 20;
+        // Blocks are transformed on this pool; nullptr runs them inline
+        Concurrency::ThreadPool* pool = nullptr;
+        // Stage timings of the file, for --report; nullptr measures nothing
+        Report::FileStats* stats = nullptr;
+    };
+
+    // True if the file starts with a block container header. Pipes and
+    // devices cannot be inspected without consuming them, so for those the
+    // answer is assumeIfUnseekable.
+    static bool IsFramed(const std::string& path, bool assumeIfUnseekable);
+    static bool IsFramed(const char* data, size_t size);
+
+    // Compress/encrypt a raw file into a block container
+    static bool EncodeFile(const std::string& inputPath, const std::string& outputPath, const Options& options);
+
+    // Bring the container at outputPath up to date with an input that has
+    // only grown since it was encoded with the same options (an appended
+    // log): the stored blocks stay as they are and the new bytes are
+    // encoded into further blocks written in place of the end marker, so
+    // the work is proportional to the new data. Each append starts a new
+    // block, so the previous last block stays short. The caller vouches
+    // that the input still starts with the bytes the container holds. If
+    // outputPath is not a container these options could have written, the
+    // input is encoded from scratch instead.
+    static bool AppendFile(const std::string& inputPath, const std::string& outputPath, const Options& options);
+
+    // Decrypt/decompress a block container back into the raw file
+    static bool DecodeFile(const std::string& inputPath, const std::string& outputPath, const Options& options);
+
+    // Decode only raw bytes [start, start + length) of a container into
+    // outputPath. The block index (or, without one, a walk over the block
+    // headers) finds the blocks holding them, and only those are read,
+    // decrypted and decompressed. A range running past the end of the data
+    // is cut short there.
+    static bool DecodeRange(const std::string& inputPath, const std::string& outputPath, const Options& options,
+                            unsigned long long start, unsigned long long length);
+
+    // Check every block's CRC-32C against its stored payload without
+    // decrypting, decompressing or writing anything; blocks are checked on
+    // the pool like decoded ones. Each damaged block is reported and the
+    // scan goes on; false if any block is damaged or the container itself
+    // is truncated or malformed.
+    static bool VerifyFile(const std::string& inputPath, const Options& options);
+
+    // Same, for callers that already hold the whole input in memory.
+    // name only labels error messages.
+    static bool EncodeBuffer(const char* data, size_t size, std::vector<char>& output, const Options& options);
+    static bool DecodeBuffer(const char* data, size_t size, std::vector<char>& output, const Options& options,
+                             const std::string& name);
+
+    // Encode data into a writer that is already open, after whatever it
+    // holds (an archive member); the writer is left open
+    static bool EncodeToWriter(const char* data, size_t size, FileManager::FileWriter& writer, const Options& options);
+
+    // Decode a container held in memory (an archive member) straight into
+    // a file, never holding the whole result
+    static bool DecodeToFile(const char* data, size_t size, const std::string& outputPath, const Options& options,
+                             const std::string& name);
+};
+
+#endif // BLOCKFORMAT_H
@@ -0,0 +1,246 @@
+#include "Checksum.h"
+#include "CpuFeatures.h"
+#include <cstring>
+
+#ifdef CPU_FEATURES_X86
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// Reflected form of the Castagnoli polynomial 0x1EDC6F41
+const uint32_t kCrc32cPoly = 0x82F63B78u;
+
+// Stream lengths of the interleaved hardware kernel
+const size_t kCrcLong = 8192;
+const size_t kCrcShort = 256;
+
+// The kernels work on the raw CRC register; Crc32c adds the inversions
+typedef uint32_t (*CrcKernel)(uint32_t crc, const unsigned char* data, size_t size);
+
+uint64_t Load64(const unsigned char* p) {
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+// Tables built on first use:
+//   slicing[k][b]  CRC of byte b followed by k zero bytes (slicing-by-8)
+//   longShift, shortShift  the register after kCrcLong / kCrcShort zero
+//                  bytes, one table per byte of the register, so that
+//                  crc(A + B) = shift(crc(A), |B|) ^ crc(B) can merge
+//                  streams computed side by side
+struct Crc32cTables {
+    uint32_t slicing[8][256];
+    uint32_t longShift[4][256];
+    uint32_t shortShift[4][256];
+
+    Crc32cTables() {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; ++bit) {
+                crc = (crc & 1) ? (crc >> 1) ^ kCrc32cPoly : crc >> 1;
+            }
+            slicing[0][i] = crc;
+        }
+        for (int k = 1; k < 8; ++k) {
+            for (uint32_t i = 0; i < 256; ++i) {
+                uint32_t prev = slicing[k - 1][i];
+                slicing[k][i] = (prev >> 8) ^ slicing[0][prev & 0xFF];
+            }
+        }
+        BuildShift(kCrcLong, longShift);
+        BuildShift(kCrcShort, shortShift);
+    }
+
+    // The shift is linear in the register: run each register bit through
+    // the zeros, then combine the bits of every byte value
+    void BuildShift(size_t zeros, uint32_t shift[4][256]) {
+        uint32_t basis[32];
+        for (int bit = 0; bit < 32; ++bit) {
+            uint32_t crc = 1u << bit;
+            for (size_t i = 0; i < zeros; ++i) crc = slicing[0][crc & 0xFF] ^ (crc >> 8);
+            basis[bit] = crc;
+        }
+        for (int byte = 0; byte < 4; ++byte) {
+            for (uint32_t v = 0; v < 256; ++v) {
+                uint32_t result = 0;
+                for (int bit = 0; bit < 8; ++bit) {
+                    if (v & (1u << bit)) result ^= basis[8 * byte + bit];
+                }
+                shift[byte][v] = result;
+            }
+        }
+    }
+};
+
+const Crc32cTables& GetCrcTables() {
+    static const Crc32cTables tables;
+    return tables;
+}
+
+uint32_t Shift(const uint32_t shift[4][256], uint32_t crc) {
+    return shift[0][crc & 0xFF] ^ shift[1][(crc >> 8) & 0xFF] ^ shift[2][(crc >> 16) & 0xFF] ^ shift[3][crc >> 24];
+}
+
+// Eight bytes per step through eight tables
+uint32_t Crc32cSlicing(uint32_t crc, const unsigned char* data, size_t size) {
+    const Crc32cTables& t = GetCrcTables();
+    for (; size >= 8; data += 8, size -= 8) {
+        uint64_t word = Load64(data) ^ crc;
+        crc = t.slicing[7][word & 0xFF] ^ t.slicing[6][(word >> 8) & 0xFF] ^
+              t.slicing[5][(word >> 16) & 0xFF] ^ t.slicing[4][(word >> 24) & 0xFF] ^
+              t.slicing[3][(word >> 32) & 0xFF] ^ t.slicing[2][(word >> 40) & 0xFF] ^
+              t.slicing[1][(word >> 48) & 0xFF] ^ t.slicing[0][word >> 56];
+    }
+    for (; size > 0; ++data, --size) crc = t.slicing[0][(crc ^ *data) & 0xFF] ^ (crc >> 8);
+    return crc;
+}
+
+#if defined(CPU_FEATURES_X86) && defined(__x86_64__)
+// The crc32 instruction takes three cycles but starts one per cycle, so
+// three independent streams over adjacent stretches keep it busy; their
+// results are merged with the shift tables
+__attribute__((target("sse4.2")))
+uint32_t Crc32cSSE42(uint32_t crc, const unsigned char* data, size_t size) {
+    const Crc32cTables& t = GetCrcTables();
+    uint64_t c0 = crc;
+    for (; size >= 3 * kCrcLong; data += 3 * kCrcLong, size -= 3 * kCrcLong) {
+        uint64_t c1 = 0, c2 = 0;
+        for (size_t i = 0; i < kCrcLong; i += 8) {
+            c0 = _mm_crc32_u64(c0, Load64(data + i));
+            c1 = _mm_crc32_u64(c1, Load64(data + kCrcLong + i));
+            c2 = _mm_crc32_u64(c2, Load64(data + 2 * kCrcLong + i));
+        }
+        c0 = Shift(t.longShift, static_cast<uint32_t>(c0)) ^ c1;
+        c0 = Shift(t.longShift, static_cast<uint32_t>(c0)) ^ c2;
+    }
+    for (; size >= 3 * kCrcShort; data += 3 * kCrcShort, size -= 3 * kCrcShort) {
+        uint64_t c1 = 0, c2 = 0;
+        for (size_t i = 0; i < kCrcShort; i += 8) {
+            c0 = _mm_crc32_u64(c0, Load64(data + i));
+            c1 = _mm_crc32_u64(c1, Load64(data + kCrcShort + i));
+            c2 = _mm_crc32_u64(c2, Load64(data + 2 * kCrcShort + i));
+        }
+        c0 = Shift(t.shortShift, static_cast<uint32_t>(c0)) ^ c1;
+        c0 = Shift(t.shortShift, static_cast<uint32_t>(c0)) ^ c2;
+    }
+    for (; size >= 8; data += 8, size -= 8) c0 = _mm_crc32_u64(c0, Load64(data));
+    uint32_t c = static_cast<uint32_t>(c0);
+    for (; size > 0; ++data, --size) c = _mm_crc32_u8(c, *data);
+    return c;
+}
+#endif
+
+// Best kernel for this processor, picked on first use
+CrcKernel SelectCrcKernel() {
+#if defined(CPU_FEATURES_X86) && defined(__x86_64__)
+    if (CpuFeatures::HasSSE42()) return Crc32cSSE42;
+#endif
+    return Crc32cSlicing;
+}
+
+const uint32_t kSha256K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+uint32_t Rotr(uint32_t x, unsigned n) {
+    return (x >> n) | (x << (32 - n));
+}
+
+// Fold one 64-byte block into the hash state
+void Sha256Block(uint32_t state[8], const unsigned char* block) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; ++i) {
+        w[i] = (uint32_t(block[4 * i]) << 24) | (uint32_t(block[4 * i + 1]) << 16) |
+               (uint32_t(block[4 * i + 2]) << 8) | uint32_t(block[4 * i + 3]);
+    }
+    for (int i = 16; i < 64; ++i) {
+        uint32_t s0 = Rotr(w[i - 15], 7) ^ Rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = Rotr(w[i - 2], 17) ^ Rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; ++i) {
+        uint32_t t1 = h + (Rotr(e, 6) ^ Rotr(e, 11) ^ Rotr(e, 25)) + ((e & f) ^ (~e & g)) + kSha256K[i] + w[i];
+        uint32_t t2 = (Rotr(a, 2) ^ Rotr(a, 13) ^ Rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+} // namespace
+
+uint32_t Checksum::Crc32c(const char* data, size_t size, uint32_t crc) {
+    static const CrcKernel kernel = SelectCrcKernel();
+    return ~kernel(~crc, reinterpret_cast<const unsigned char*>(data), size);
+}
+
+void Checksum::Sha256(const char* data, size_t size, unsigned char digest[Sha256Size]) {
+    Sha256Hasher hasher;
+    hasher.Update(data, size);
+    hasher.Digest(digest);
+}
+
+Checksum::Sha256Hasher::Sha256Hasher()
+    : state{0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19},
+      buffer(), buffered(0), length(0) {}
+
+void Checksum::Sha256Hasher::Update(const char* data, size_t size) {
+    const unsigned char* in = reinterpret_cast<const unsigned char*>(data);
+    length += size;
+    if (buffered > 0) {
+        size_t take = 64 - buffered < size ? 64 - buffered : size;
+        for (size_t i = 0; i < take; ++i) buffer[buffered + i] = in[i];
+        buffered += take;
+        in += take;
+        size -= take;
+        if (buffered < 64) return;
+        Sha256Block(state, buffer);
+        buffered = 0;
+    }
+    for (; size >= 64; in += 64, size -= 64) Sha256Block(state, in);
+    for (size_t i = 0; i < size; ++i) buffer[i] = in[i];
+    buffered = size;
+}
+
+void Checksum::Sha256Hasher::Digest(unsigned char digest[Sha256Size]) const {
+    uint32_t result[8];
+    for (int i = 0; i < 8; ++i) result[i] = state[i];
+
+    // Last partial block, a 1 bit, zeros and the length in bits
+    unsigned char tail[128] = {0};
+    for (size_t i = 0; i < buffered; ++i) tail[i] = buffer[i];
+    tail[buffered] = 0x80;
+    size_t tailSize = buffered < 56 ? 64 : 128;
+    unsigned long long bits = length * 8;
+    for (int i = 0; i < 8; ++i) tail[tailSize - 1 - i] = static_cast<unsigned char>(bits >> (8 * i));
+    Sha256Block(result, tail);
+    if (tailSize == 128) Sha256Block(result, tail + 64);
+
+    for (int i = 0; i < 8; ++i) {
+        digest[4 * i] = static_cast<unsigned char>(result[i] >> 24);
+        digest[4 * i + 1] = static_cast<unsigned char>(result[i] >> 16);
+        digest[4 * i + 2] = static_cast<unsigned char>(result[i] >> 8);
+        digest[4 * i + 3] = static_cast<unsigned char>(result[i]);
+    }
+}
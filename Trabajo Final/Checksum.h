@@ -0,0 +1,35 @@
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <cstddef>
+#include <cstdint>
+
+class Checksum {
+public:
+    // CRC-32C (Castagnoli polynomial, as used by iSCSI and ext4).
+    // Pass the previous result as crc to checksum data in several pieces.
+    // Uses the SSE4.2 crc32 instruction on three interleaved streams when
+    // the processor has it (64-bit builds), slicing-by-8 tables otherwise.
+    static uint32_t Crc32c(const char* data, size_t size, uint32_t crc = 0);
+
+    // SHA-256 (FIPS 180-4) of data, written to digest
+    static const size_t Sha256Size = 32;
+    static void Sha256(const char* data, size_t size, unsigned char digest[Sha256Size]);
+
+    // SHA-256 of data fed in pieces. Digest does not end the hash, so the
+    // digest of a prefix can be taken on the way to that of the whole.
+    class Sha256Hasher {
+    public:
+        Sha256Hasher();
+        void Update(const char* data, size_t size);
+        void Digest(unsigned char digest[Sha256Size]) const;
+
+    private:
+        uint32_t state[8];
+        unsigned char buffer[64]; // Bytes short of a whole block
+        size_t buffered;
+        unsigned long long length; // Bytes fed so far
+    };
+};
+
+#endif // CHECKSUM_H
@@ -1,34 +1,502 @@
 #include "Compression.h"
+#include "CpuFeatures.h"
+#include <cmath>
+#include <cstdint>
+#include <cstring>
 
-std::vector<char> Compression::CompressRLE(const std::vector<char>& data) {
-    std::vector<char> compressed;
-    if (data.empty()) return compressed;
+#ifdef CPU_FEATURES_X86
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// Longest run one (value, count) pair can describe
+const size_t kMaxRun = 255;
+
+// Collects (value, count) pairs in a fixed buffer and appends them to the
+// output in large pieces, so the encoder loop never grows a vector
+class PairWriter {
+public:
+    static const size_t Capacity = 1 << 14;
+
+    explicit PairWriter(std::vector<char>& out) : output(out), used(0) {}
+
+    // Room for `bytes` more bytes at the returned pointer
+    char* Reserve(size_t bytes) {
+        if (used + bytes > Capacity) Flush();
+        return buffer + used;
+    }
 
-    size_t n = data.size();
-    for (size_t i = 0; i < n; ++i) {
-        unsigned char count = 1;
-        while (i + 1 < n && data[i] == data[i + 1] && count < 255) {
-            i++;
-            count++;
+    void Commit(size_t bytes) { used += bytes; }
+
+    // A run of any length, split into pairs of at most kMaxRun bytes
+    void Run(char value, size_t length) {
+        while (length > 0) {
+            size_t count = length < kMaxRun ? length : kMaxRun;
+            char* p = Reserve(2);
+            p[0] = value;
+            p[1] = static_cast<char>(count);
+            Commit(2);
+            length -= count;
         }
-        compressed.push_back(data[i]);
-        compressed.push_back(static_cast<char>(count));
     }
-    return compressed;
+
+    void Flush() {
+        output.insert(output.end(), buffer, buffer + used);
+        used = 0;
+    }
+
+private:
+    std::vector<char>& output;
+    size_t used;
+    char buffer[Capacity];
+};
+
+// Length of the run starting at data[i], counting from data[from]
+size_t ScanRunScalar(const char* data, size_t size, size_t i, size_t from) {
+    size_t j = from;
+    while (j < size && data[j] == data[i]) j++;
+    return j - i;
+}
+
+// Every kernel below keeps the original pairing: a run of L equal bytes
+// becomes L / 255 pairs of 255 plus one pair for the rest.
+void CompressScalar(const char* data, size_t size, PairWriter& out) {
+    for (size_t i = 0; i < size;) {
+        size_t length = ScanRunScalar(data, size, i, i + 1);
+        out.Run(data[i], length);
+        i += length;
+    }
+}
+
+#ifdef CPU_FEATURES_X86
+// Runs of 1 (literals) are found 16 at a time by comparing the input with
+// itself shifted by one byte: a clear bit in the movemask means the byte
+// differs from its successor. The literals are interleaved with a count of
+// 1 and stored as whole vectors; longer runs are measured by comparing
+// against the broadcast value.
+__attribute__((target("sse2")))
+void CompressSSE2(const char* data, size_t size, PairWriter& out) {
+    const __m128i ones = _mm_set1_epi8(1);
+    size_t i = 0;
+
+    while (i + 17 <= size) {
+        __m128i current = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        __m128i next = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 1));
+        unsigned equal = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(current, next)));
+
+        if (!(equal & 1)) {
+            // data[i..i+literals) each differ from the byte after them
+            size_t literals = equal ? __builtin_ctz(equal) : 16;
+            char* p = out.Reserve(32);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(p), _mm_unpacklo_epi8(current, ones));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(p + 16), _mm_unpackhi_epi8(current, ones));
+            out.Commit(2 * literals);
+            i += literals;
+            continue;
+        }
+
+        // A run starts at i; the mask covers its first 17 bytes
+        unsigned differ = ~equal & 0xFFFFu;
+        size_t length;
+        if (differ) {
+            length = __builtin_ctz(differ) + 1;
+        } else {
+            const __m128i value = _mm_set1_epi8(data[i]);
+            size_t j = i + 17;
+            for (; j + 16 <= size; j += 16) {
+                __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + j));
+                unsigned same = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, value)));
+                if (same != 0xFFFFu) {
+                    j += __builtin_ctz(~same);
+                    break;
+                }
+            }
+            length = ScanRunScalar(data, size, i, j);
+        }
+        out.Run(data[i], length);
+        i += length;
+    }
+
+    CompressScalar(data + i, size - i, out);
+}
+
+// Same scan 32 bytes at a time
+__attribute__((target("avx2")))
+void CompressAVX2(const char* data, size_t size, PairWriter& out) {
+    const __m128i ones = _mm_set1_epi8(1);
+    size_t i = 0;
+
+    while (i + 33 <= size) {
+        __m256i current = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        __m256i next = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + 1));
+        unsigned equal = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(current, next)));
+
+        if (!(equal & 1)) {
+            size_t literals = equal ? __builtin_ctz(equal) : 32;
+            __m128i low = _mm256_castsi256_si128(current);
+            __m128i high = _mm256_extracti128_si256(current, 1);
+            char* p = out.Reserve(64);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(p), _mm_unpacklo_epi8(low, ones));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(p + 16), _mm_unpackhi_epi8(low, ones));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(p + 32), _mm_unpacklo_epi8(high, ones));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(p + 48), _mm_unpackhi_epi8(high, ones));
+            out.Commit(2 * literals);
+            i += literals;
+            continue;
+        }
+
+        unsigned differ = ~equal;
+        size_t length;
+        if (differ) {
+            length = __builtin_ctz(differ) + 1;
+        } else {
+            const __m256i value = _mm256_set1_epi8(data[i]);
+            size_t j = i + 33;
+            for (; j + 32 <= size; j += 32) {
+                __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + j));
+                unsigned same = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, value)));
+                if (same != 0xFFFFFFFFu) {
+                    j += __builtin_ctz(~same);
+                    break;
+                }
+            }
+            length = ScanRunScalar(data, size, i, j);
+        }
+        out.Run(data[i], length);
+        i += length;
+    }
+
+    CompressScalar(data + i, size - i, out);
+}
+#endif
+
+typedef void (*CompressKernel)(const char* data, size_t size, PairWriter& out);
+
+// Best encoder for this processor, picked on first use
+CompressKernel SelectCompressKernel() {
+#ifdef CPU_FEATURES_X86
+    if (CpuFeatures::HasAVX2()) return CompressAVX2;
+    if (CpuFeatures::HasSSE2()) return CompressSSE2;
+#endif
+    return CompressScalar;
+}
+
+// SelectAlgorithm looks at this many slices of this many bytes, and spots
+// repeated 4-byte sequences with a table of this many slots
+const size_t kSampleSlices = 16;
+const size_t kSampleSliceSize = 4096;
+const unsigned kSampleHashBits = 12;
+const size_t kSampleHashSize = size_t(1) << kSampleHashBits;
+
+// RLE2 packets: literal spans of 1..128 bytes, repeat runs of 3..130 bytes
+const size_t kMaxLiteralSpan = 128;
+const size_t kMinRepeat = 3;
+const size_t kMaxRepeat = 130;
+
+// First position at or after `from` where a run of at least kMinRepeat
+// bytes starts, or size if there is none
+size_t FindRunScalar(const char* data, size_t size, size_t from) {
+    for (size_t k = from; k + 2 < size; ++k) {
+        if (data[k] == data[k + 1] && data[k] == data[k + 2]) return k;
+    }
+    return size;
+}
+
+#ifdef CPU_FEATURES_X86
+// Compare with the input shifted by one and by two bytes: a position whose
+// bit is set in both masks starts three equal bytes
+__attribute__((target("sse2")))
+size_t FindRunSSE2(const char* data, size_t size, size_t from) {
+    size_t k = from;
+    for (; k + 18 <= size; k += 16) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + k));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + k + 1));
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + k + 2));
+        unsigned starts = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) &
+                                                _mm_movemask_epi8(_mm_cmpeq_epi8(b, c)));
+        if (starts) return k + __builtin_ctz(starts);
+    }
+    return FindRunScalar(data, size, k);
+}
+
+__attribute__((target("avx2")))
+size_t FindRunAVX2(const char* data, size_t size, size_t from) {
+    size_t k = from;
+    for (; k + 34 <= size; k += 32) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + k));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + k + 1));
+        __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + k + 2));
+        unsigned starts = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b)) &
+                                                _mm256_movemask_epi8(_mm256_cmpeq_epi8(b, c)));
+        if (starts) return k + __builtin_ctz(starts);
+    }
+    return FindRunScalar(data, size, k);
+}
+#endif
+
+typedef size_t (*FindRunKernel)(const char* data, size_t size, size_t from);
+
+FindRunKernel SelectFindRunKernel() {
+#ifdef CPU_FEATURES_X86
+    if (CpuFeatures::HasAVX2()) return FindRunAVX2;
+    if (CpuFeatures::HasSSE2()) return FindRunSSE2;
+#endif
+    return FindRunScalar;
+}
+
+char* PutLiterals(char* out, const char* data, size_t count) {
+    while (count > 0) {
+        size_t span = count < kMaxLiteralSpan ? count : kMaxLiteralSpan;
+        *out++ = static_cast<char>(span - 1);
+        std::memcpy(out, data, span);
+        out += span;
+        data += span;
+        count -= span;
+    }
+    return out;
+}
+
+// Size of each RLE2 packet's output; false stops at a truncated packet
+bool NextPacket(const char* data, size_t size, size_t i, size_t& packetSize, size_t& outputSize) {
+    unsigned char control = static_cast<unsigned char>(data[i]);
+    if (control < 128) {
+        outputSize = control + 1;
+        packetSize = 1 + outputSize;
+    } else {
+        outputSize = control - 128 + kMinRepeat;
+        packetSize = 2;
+    }
+    return packetSize <= size - i;
+}
+
+} // namespace
+
+bool Compression::ParseAlgorithm(const std::string& name, Algorithm& algorithm) {
+    if (name == "rle") algorithm = AlgorithmRLE;
+    else if (name == "rle2") algorithm = AlgorithmRLE2;
+    else if (name == "lz") algorithm = AlgorithmLZ;
+    else if (name == "huff") algorithm = AlgorithmHuffman;
+    else if (name == "rle+huff") algorithm = AlgorithmRLEHuffman;
+    else if (name == "lz+huff") algorithm = AlgorithmLZHuffman;
+    else if (name == "lzw") algorithm = AlgorithmLZW;
+    else if (name == "auto") algorithm = AlgorithmAuto;
+    else return false;
+    return true;
+}
+
+const char* Compression::AlgorithmName(Algorithm algorithm) {
+    switch (algorithm) {
+    case AlgorithmRLE2: return "rle2";
+    case AlgorithmLZ: return "lz";
+    case AlgorithmHuffman: return "huff";
+    case AlgorithmRLEHuffman: return "rle+huff";
+    case AlgorithmLZHuffman: return "lz+huff";
+    case AlgorithmLZW: return "lzw";
+    case AlgorithmAuto: return "auto";
+    case AlgorithmRLE:
+    default: return "rle";
+    }
+}
+
+bool Compression::SelectAlgorithm(const char* data, size_t size, Algorithm& algorithm) {
+    const unsigned char* in = reinterpret_cast<const unsigned char*>(data);
+
+    // Up to kSampleSlices slices spread evenly over the block; small blocks
+    // are looked at whole
+    size_t slice = size < kSampleSlices * kSampleSliceSize ? size : kSampleSliceSize;
+    size_t slices = slice ? (size < kSampleSlices * kSampleSliceSize ? 1 : kSampleSlices) : 0;
+    size_t stride = slices > 1 ? (size - slice) / (slices - 1) : 0;
+
+    size_t histogram[256] = {0};
+    uint32_t seen[kSampleHashSize] = {0};
+    size_t sampled = 0;
+    size_t runs = 0;
+    size_t matches = 0;
+    for (size_t n = 0; n < slices; ++n) {
+        const unsigned char* p = in + n * stride;
+        for (size_t i = 0; i < slice; ++i) {
+            histogram[p[i]]++;
+            if (i > 0 && p[i] == p[i - 1]) runs++;
+            if (i + 4 <= slice) {
+                uint32_t quad;
+                std::memcpy(&quad, p + i, sizeof(quad));
+                uint32_t& slot = seen[(quad * 2654435761u) >> (32 - kSampleHashBits)];
+                if (slot == quad + 1) matches++;
+                slot = quad + 1;
+            }
+        }
+        sampled += slice;
+    }
+    if (sampled == 0) return false;
+
+    double entropy = 0; // Bits per byte of the order-0 model
+    for (size_t count : histogram) {
+        if (count == 0) continue;
+        double p = static_cast<double>(count) / sampled;
+        entropy -= p * std::log2(p);
+    }
+    double runShare = static_cast<double>(runs) / sampled;
+    double matchShare = static_cast<double>(matches) / sampled;
+
+    // Runs are cheapest to find and decode as runs; repeated strings need
+    // LZ, whose output still profits from Huffman when the bytes are
+    // skewed; skewed bytes alone need Huffman; anything else (already
+    // compressed or encrypted data) is stored without trying
+    if (runShare >= 0.5) algorithm = AlgorithmRLE2;
+    else if (matchShare >= 0.15) algorithm = entropy < 6.5 ? AlgorithmLZHuffman : AlgorithmLZ;
+    else if (entropy < 7.0) algorithm = AlgorithmHuffman;
+    else if (runShare >= 0.1) algorithm = AlgorithmRLE2;
+    else return false;
+    return true;
+}
+
+std::vector<char> Compression::Compress(Algorithm algorithm, const char* data, size_t size, unsigned lzwBits) {
+    switch (algorithm) {
+    case AlgorithmRLE2: return CompressRLE2(data, size);
+    case AlgorithmLZ: return CompressLZ(data, size);
+    case AlgorithmHuffman: return CompressHuffman(data, size);
+    case AlgorithmRLEHuffman: {
+        std::vector<char> stage = CompressRLE(data, size);
+        return CompressHuffman(stage.data(), stage.size());
+    }
+    case AlgorithmLZHuffman: {
+        std::vector<char> stage = CompressLZ(data, size);
+        return CompressHuffman(stage.data(), stage.size());
+    }
+    case AlgorithmLZW: return CompressLZW(data, size, lzwBits);
+    case AlgorithmRLE:
+    default: return CompressRLE(data, size);
+    }
+}
+
+bool Compression::Decompress(Algorithm algorithm, const char* data, size_t size, std::vector<char>& decompressed) {
+    switch (algorithm) {
+    case AlgorithmRLE2:
+        decompressed = DecompressRLE2(data, size);
+        return true;
+    case AlgorithmLZ: return DecompressLZ(data, size, decompressed);
+    case AlgorithmHuffman: return DecompressHuffman(data, size, decompressed);
+    case AlgorithmRLEHuffman: {
+        std::vector<char> stage;
+        if (!DecompressHuffman(data, size, stage)) return false;
+        decompressed = DecompressRLE(stage.data(), stage.size());
+        return true;
+    }
+    case AlgorithmLZHuffman: {
+        std::vector<char> stage;
+        return DecompressHuffman(data, size, stage) && DecompressLZ(stage.data(), stage.size(), decompressed);
+    }
+    case AlgorithmLZW: return DecompressLZW(data, size, decompressed);
+    case AlgorithmRLE:
+    default:
+        decompressed = DecompressRLE(data, size);
+        return true;
+    }
+}
+
+std::vector<char> Compression::CompressRLE(const std::vector<char>& data) {
+    return CompressRLE(data.data(), data.size());
 }
 
 std::vector<char> Compression::DecompressRLE(const std::vector<char>& data) {
+    return DecompressRLE(data.data(), data.size());
+}
+
+std::vector<char> Compression::CompressRLE(const char* data, size_t size) {
+    std::vector<char> compressed;
+    CompressRLE(data, size, compressed);
+    return compressed;
+}
+
+void Compression::CompressRLE(const char* data, size_t size, std::vector<char>& compressed) {
+    static const CompressKernel kernel = SelectCompressKernel();
+    if (size == 0) return;
+
+    // Worst case is two bytes per input byte. Reserving only takes address
+    // space; pages are touched as pairs are appended.
+    compressed.reserve(compressed.size() + 2 * size);
+    PairWriter out(compressed);
+    kernel(data, size, out);
+    out.Flush();
+}
+
+std::vector<char> Compression::DecompressRLE(const char* data, size_t size) {
     std::vector<char> decompressed;
-    if (data.empty()) return decompressed;
+    DecompressRLE(data, size, decompressed, 0);
+    return decompressed;
+}
+
+size_t Compression::DecompressRLE(const char* data, size_t size, std::vector<char>& decompressed, size_t at) {
+    // A trailing odd byte should not happen if valid RLE; it is ignored
+    size_t n = size - size % 2;
+
+    // Sum the counts first so every run is a memset into its final place
+    size_t total = 0;
+    for (size_t i = 1; i < n; i += 2) {
+        total += static_cast<unsigned char>(data[i]);
+    }
+    if (total == 0) return at; // Nothing to place; the vector may not even have storage
+    if (decompressed.size() < at + total) decompressed.resize(at + total);
 
-    size_t n = data.size();
+    char* out = decompressed.data() + at;
     for (size_t i = 0; i < n; i += 2) {
-        if (i + 1 >= n) break; // Should not happen if valid RLE
-        char val = data[i];
         unsigned char count = static_cast<unsigned char>(data[i + 1]);
-        for (int k = 0; k < count; ++k) {
-            decompressed.push_back(val);
+        if (count == 0) continue;
+        std::memset(out, data[i], count);
+        out += count;
+    }
+    return at + total;
+}
+
+std::vector<char> Compression::CompressRLE2(const char* data, size_t size) {
+    static const FindRunKernel findRun = SelectFindRunKernel();
+    std::vector<char> compressed(size + size / kMaxLiteralSpan + 1);
+    char* out = compressed.data();
+
+    size_t i = 0;
+    while (i < size) {
+        size_t run = findRun(data, size, i);
+        out = PutLiterals(out, data + i, run - i);
+        if (run == size) break;
+
+        size_t length = ScanRunScalar(data, size, run, run + kMinRepeat);
+        i = run + length;
+        while (length >= kMinRepeat) {
+            size_t count = length < kMaxRepeat ? length : kMaxRepeat;
+            *out++ = static_cast<char>(128 + count - kMinRepeat);
+            *out++ = data[run];
+            length -= count;
+        }
+        i -= length; // One or two bytes too few for a run start the next literals
+    }
+
+    compressed.resize(out - compressed.data());
+    return compressed;
+}
+
+std::vector<char> Compression::DecompressRLE2(const char* data, size_t size) {
+    // First pass sizes the output (and finds where a truncated stream ends),
+    // so the second can memcpy/memset every packet into its final place
+    size_t total = 0;
+    size_t end = 0;
+    size_t packetSize = 0;
+    size_t outputSize = 0;
+    while (end < size && NextPacket(data, size, end, packetSize, outputSize)) {
+        total += outputSize;
+        end += packetSize;
+    }
+
+    std::vector<char> decompressed(total);
+    char* out = decompressed.data();
+    for (size_t i = 0; i < end; i += packetSize) {
+        NextPacket(data, size, i, packetSize, outputSize);
+        if (static_cast<unsigned char>(data[i]) >= 128) {
+            std::memset(out, data[i + 1], outputSize);
+        } else {
+            std::memcpy(out, data + i + 1, outputSize);
         }
+        out += outputSize;
     }
     return decompressed;
 }
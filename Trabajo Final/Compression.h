@@ -2,12 +2,105 @@
 #define COMPRESSION_H
 
 #include <vector>
+#include <string>
+#include <cstddef>
 
 class Compression {
 public:
+    // Algorithms selectable with --comp-alg
+    enum Algorithm {
+        AlgorithmRLE,        // "rle": (value, count) pairs, the original format
+        AlgorithmRLE2,       // "rle2": packets of literal spans and repeat runs
+        AlgorithmLZ,         // "lz": LZ77 with a 64 KB window
+        AlgorithmHuffman,    // "huff": canonical Huffman coding of the bytes
+        AlgorithmRLEHuffman, // "rle+huff": RLE, then Huffman over its output
+        AlgorithmLZHuffman,  // "lz+huff": LZ77, then Huffman over its output
+        AlgorithmLZW,        // "lzw": LZW with variable-width codes
+        AlgorithmAuto        // "auto": chosen per block by SelectAlgorithm
+    };
+
+    // Range and default of the LZW code width (--lzw-bits); the dictionary
+    // holds 2^bits codes and starts over once it is full
+    static constexpr unsigned MinLZWBits = 9;
+    static constexpr unsigned MaxLZWBits = 16;
+    static constexpr unsigned DefaultLZWBits = 16;
+
+    // Map a --comp-alg name to its algorithm; false if unknown
+    static bool ParseAlgorithm(const std::string& name, Algorithm& algorithm);
+
+    // The --comp-alg name, also used as the output file suffix
+    static const char* AlgorithmName(Algorithm algorithm);
+
+    // Guess the algorithm that suits a block from a sample of it: byte
+    // entropy, how many bytes repeat the one before (runs) and how many
+    // 4-byte sequences were already seen (matches). False means the block
+    // looks incompressible and is better stored as is.
+    static bool SelectAlgorithm(const char* data, size_t size, Algorithm& algorithm);
+
+    // Run the selected algorithm; lzwBits only matters to AlgorithmLZW.
+    // AlgorithmAuto is resolved per block by the block container.
+    // Decompress returns false when the data is truncated or corrupt, and
+    // decompressed is then not to be used.
+    static std::vector<char> Compress(Algorithm algorithm, const char* data, size_t size,
+                                      unsigned lzwBits = DefaultLZWBits);
+    static bool Decompress(Algorithm algorithm, const char* data, size_t size, std::vector<char>& decompressed);
+
     // Run-Length Encoding
     static std::vector<char> CompressRLE(const std::vector<char>& data);
     static std::vector<char> DecompressRLE(const std::vector<char>& data);
+
+    // Same, reading straight from memory the caller owns (e.g. a mapped file)
+    static std::vector<char> CompressRLE(const char* data, size_t size);
+    static std::vector<char> DecompressRLE(const char* data, size_t size);
+
+    // Same, reusing a buffer from call to call (Pipeline.h): CompressRLE
+    // appends to out; DecompressRLE writes at out[at..], growing out only
+    // when it is too small, and returns the end of what it wrote
+    static void CompressRLE(const char* data, size_t size, std::vector<char>& out);
+    static size_t DecompressRLE(const char* data, size_t size, std::vector<char>& out, size_t at);
+
+    // Packetized RLE. Each packet starts with a control byte:
+    //   0..127    literal span: the next (control + 1) bytes are copied as is
+    //   128..255  repeat run: the next byte repeated (control - 128 + 3) times
+    // Bytes that do not repeat cost one control byte per 128 instead of a
+    // count each, so the output is at most size + size / 128 + 1 bytes.
+    static std::vector<char> CompressRLE2(const char* data, size_t size);
+    static std::vector<char> DecompressRLE2(const char* data, size_t size);
+
+    // LZ77 (CompressionLZ.cpp), in the spirit of LZ4. The stream starts with
+    // the raw size as a base-128 varint, followed by sequences:
+    //   token      high nibble literal length, low nibble match length - 4;
+    //              a nibble of 15 continues in bytes of 255 plus a remainder
+    //   literals   copied as is
+    //   offset     2 bytes, little-endian, distance back to the match (1..65535)
+    // The last sequence has literals only. Matches are found with a hash
+    // chain over 4-byte prefixes. DecompressLZ fails unless the sequences
+    // rebuild exactly the raw size.
+    static std::vector<char> CompressLZ(const char* data, size_t size);
+    static bool DecompressLZ(const char* data, size_t size, std::vector<char>& decompressed);
+
+    // Canonical Huffman (CompressionHuffman.cpp). The stream starts with the
+    // raw size as a base-128 varint, then 128 bytes holding the code length
+    // (0..11, 0 = unused) of each byte value in 4 bits, low nibble first,
+    // then the codes packed from the least significant bit up. Codes of the
+    // same length are numbered in byte-value order, so the lengths alone
+    // rebuild the code; the decoder looks each one up in an 11-bit table.
+    // DecompressHuffman fails on a damaged table or stream.
+    static std::vector<char> CompressHuffman(const char* data, size_t size);
+    static bool DecompressHuffman(const char* data, size_t size, std::vector<char>& decompressed);
+
+    // LZW (CompressionLZW.cpp). The stream starts with the raw size as a
+    // base-128 varint and one byte with the largest code width, followed by
+    // the codes packed from the least significant bit up. Codes 0..255 are
+    // the bytes, 256 clears the dictionary, and new strings are numbered
+    // from 257. Codes start 9 bits wide and widen as the dictionary grows;
+    // once all 2^maxBits codes are used the encoder sends a clear and
+    // starts over. Memory is bounded by maxBits, not by the input: the
+    // encoder's hash table takes 6 * 2^(maxBits + 1) bytes and the decoder
+    // 12 * 2^maxBits (768 KB each at 16 bits).
+    // DecompressLZW fails unless the codes rebuild exactly the raw size.
+    static std::vector<char> CompressLZW(const char* data, size_t size, unsigned maxBits = DefaultLZWBits);
+    static bool DecompressLZW(const char* data, size_t size, std::vector<char>& decompressed);
 };
 
 #endif // COMPRESSION_H
@@ -0,0 +1,452 @@
+#include "Compression.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <queue>
+
+// Canonical Huffman codec (--comp-alg huff). See Compression.h for the
+// stream layout.
+
+namespace {
+
+const unsigned kSymbols = 256;
+const unsigned kMaxCodeLength = 11;             // Longest code; also the lookup width
+const size_t kTableSize = size_t(1) << kMaxCodeLength;
+const size_t kLengthsSize = kSymbols / 2;       // Two 4-bit code lengths per byte
+const size_t kStreams = 4;                      // Independent bit streams per block
+
+uint64_t Load64(const char* p) {
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+void Store64(char* p, uint64_t v) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    std::memcpy(p, &v, sizeof(v));
+}
+
+char* PutVarint(char* out, unsigned long long value) {
+    while (value >= 0x80) {
+        *out++ = static_cast<char>(value | 0x80);
+        value >>= 7;
+    }
+    *out++ = static_cast<char>(value);
+    return out;
+}
+
+// Code lengths of a Huffman tree over the used symbols. A lone symbol
+// still gets a 1-bit code so that every symbol costs at least one bit.
+void BuildLengths(const uint64_t* freq, unsigned char* lengths) {
+    struct Node {
+        uint64_t weight;
+        int left, right;
+    };
+    std::vector<Node> nodes;
+    typedef std::pair<uint64_t, int> Entry; // (weight, node), lightest first
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> heap;
+
+    for (unsigned s = 0; s < kSymbols; ++s) {
+        lengths[s] = 0;
+        if (freq[s] == 0) continue;
+        nodes.push_back({freq[s], -1, static_cast<int>(s)});
+        heap.push(Entry(freq[s], static_cast<int>(nodes.size() - 1)));
+    }
+    if (nodes.size() == 1) {
+        lengths[nodes[0].right] = 1;
+        return;
+    }
+    while (heap.size() > 1) {
+        Entry a = heap.top(); heap.pop();
+        Entry b = heap.top(); heap.pop();
+        nodes.push_back({a.first + b.first, a.second, b.second});
+        heap.push(Entry(a.first + b.first, static_cast<int>(nodes.size() - 1)));
+    }
+
+    // Depth of every leaf; children always come before their parent
+    std::vector<unsigned> depth(nodes.size(), 0);
+    for (size_t n = nodes.size(); n-- > 0;) {
+        if (nodes[n].left < 0) {
+            lengths[nodes[n].right] = static_cast<unsigned char>(depth[n] < 255 ? depth[n] : 255);
+        } else {
+            depth[nodes[n].left] = depth[n] + 1;
+            depth[nodes[n].right] = depth[n] + 1;
+        }
+    }
+}
+
+// Cap the code lengths at kMaxCodeLength and repair the Kraft sum: codes
+// that were too long are cut, then the longest remaining ones below the
+// cap are lengthened until the code fits again, and finally any room left
+// is given back to the most frequent symbols.
+void LimitLengths(const uint64_t* freq, unsigned char* lengths) {
+    const uint32_t budget = 1u << kMaxCodeLength;
+    uint32_t kraft = 0;
+    for (unsigned s = 0; s < kSymbols; ++s) {
+        if (lengths[s] > kMaxCodeLength) lengths[s] = kMaxCodeLength;
+        if (lengths[s]) kraft += budget >> lengths[s];
+    }
+    if (kraft <= budget) return;
+
+    // Used symbols, most frequent first
+    std::vector<unsigned> order;
+    for (unsigned s = 0; s < kSymbols; ++s) {
+        if (lengths[s]) order.push_back(s);
+    }
+    std::stable_sort(order.begin(), order.end(), [&](unsigned a, unsigned b) { return freq[a] > freq[b]; });
+
+    while (kraft > budget) {
+        // Lengthening the deepest code below the cap frees the least
+        unsigned pick = kSymbols;
+        for (size_t i = order.size(); i-- > 0;) {
+            unsigned s = order[i];
+            if (lengths[s] < kMaxCodeLength && (pick == kSymbols || lengths[s] > lengths[pick])) pick = s;
+        }
+        kraft -= budget >> (lengths[pick] + 1);
+        lengths[pick]++;
+    }
+    for (unsigned s : order) {
+        while (lengths[s] > 1 && kraft + (budget >> lengths[s]) <= budget) {
+            kraft += budget >> lengths[s];
+            lengths[s]--;
+        }
+    }
+}
+
+unsigned ReverseBits(unsigned code, unsigned length) {
+    unsigned reversed = 0;
+    for (unsigned i = 0; i < length; ++i) {
+        reversed = (reversed << 1) | (code & 1);
+        code >>= 1;
+    }
+    return reversed;
+}
+
+// Canonical codes: shorter codes first, ties broken by symbol value. The
+// bit stream is read from the least significant bit up, so each code is
+// stored bit-reversed. False if the lengths over-subscribe the code space.
+bool AssignCodes(const unsigned char* lengths, uint16_t* codes) {
+    unsigned count[kMaxCodeLength + 1] = {0};
+    for (unsigned s = 0; s < kSymbols; ++s) count[lengths[s]]++;
+    count[0] = 0;
+
+    unsigned next[kMaxCodeLength + 1] = {0};
+    unsigned code = 0;
+    for (unsigned len = 1; len <= kMaxCodeLength; ++len) {
+        code = (code + count[len - 1]) << 1;
+        next[len] = code;
+        if (code + count[len] > (1u << len)) return false;
+    }
+    for (unsigned s = 0; s < kSymbols; ++s) {
+        if (lengths[s]) codes[s] = static_cast<uint16_t>(ReverseBits(next[lengths[s]]++, lengths[s]));
+    }
+    return true;
+}
+
+// Every kMaxCodeLength-bit window maps straight to (symbol << 4 | length);
+// windows no code starts with stay 0
+void BuildTable(const unsigned char* lengths, const uint16_t* codes, uint16_t* table) {
+    std::fill(table, table + kTableSize, 0);
+    for (unsigned s = 0; s < kSymbols; ++s) {
+        unsigned len = lengths[s];
+        if (!len) continue;
+        uint16_t entry = static_cast<uint16_t>((s << 4) | len);
+        for (size_t i = codes[s]; i < kTableSize; i += size_t(1) << len) table[i] = entry;
+    }
+}
+
+// Packs one stream's codes from the least significant bit up
+class BitWriter {
+public:
+    BitWriter(char* out, char* end) : out(out), end(end), bits(0), count(0) {}
+
+    void Put(const unsigned char* lengths, const uint16_t* codes, unsigned char symbol) {
+        bits |= static_cast<uint64_t>(codes[symbol]) << count;
+        count += lengths[symbol];
+    }
+
+    // Room for Flush, which stores 8 bytes whatever it keeps
+    bool CanFlush() const { return end - out >= 8; }
+
+    // Write out the whole bytes; at most 7 bits stay behind, so four more
+    // codes (44 bits) always fit before the next flush
+    void Flush() {
+        Store64(out, bits);
+        out += count >> 3;
+        bits >>= count & ~7u;
+        count &= 7;
+    }
+
+    // Same, one byte at a time so nothing lands past the stream
+    void FlushExact(bool last) {
+        unsigned keep = last ? 0 : (count & 7);
+        while (count > keep) {
+            *out++ = static_cast<char>(bits);
+            bits >>= 8;
+            count = count > 8 ? count - 8 : 0;
+        }
+    }
+
+private:
+    char* out;
+    char* end;
+    uint64_t bits;
+    unsigned count;
+};
+
+// Reads one stream's codes through the lookup table
+class BitReader {
+public:
+    BitReader(const char* begin, const char* end)
+        : begin(begin), in(begin), end(end), bits(0), count(0), missing(0) {}
+
+    // Enough input left for Refill
+    bool CanRefill() const { return end - in >= 8; }
+
+    // Top up to at least 56 bits (four codes) with one unaligned load. The
+    // bits loaded past count are loaded again, unchanged, by the next call.
+    void Refill() {
+        bits |= Load64(in) << count;
+        in += (63 - count) >> 3;
+        count |= 56;
+    }
+
+    // Decode one code after Refill. A window no code starts with has
+    // length 0 and stalls the stream, which Finished then catches.
+    void Decode(const uint16_t* table, char& symbol) {
+        uint16_t entry = table[bits & (kTableSize - 1)];
+        symbol = static_cast<char>(entry >> 4);
+        bits >>= entry & 15;
+        count -= entry & 15;
+    }
+
+    // Byte-wise version for the end of the stream: past the input the
+    // stream reads as zeros, which is only valid while no code needs them
+    bool DecodeTail(const uint16_t* table, char& symbol) {
+        while (count <= 56) {
+            if (in < end) {
+                bits |= static_cast<uint64_t>(static_cast<unsigned char>(*in++)) << count;
+            } else {
+                missing += 8;
+            }
+            count += 8;
+        }
+        uint16_t entry = table[bits & (kTableSize - 1)];
+        unsigned len = entry & 15;
+        if (!len || count - len < missing) return false;
+        symbol = static_cast<char>(entry >> 4);
+        bits >>= len;
+        count -= len;
+        return true;
+    }
+
+    // Whether the codes read used up the stream, short of the padding bits
+    // in its last byte
+    bool Finished() const {
+        unsigned long long loaded = static_cast<unsigned long long>(in - begin) * 8 + missing;
+        unsigned long long used = loaded - count;
+        return (used + 7) / 8 == static_cast<unsigned long long>(end - begin);
+    }
+
+private:
+    const char* begin;
+    const char* in;
+    const char* end;
+    uint64_t bits;
+    unsigned count;
+    unsigned missing;
+};
+
+unsigned long long GetVarint(const char*& in, const char* end, bool& ok) {
+    unsigned long long value = 0;
+    ok = false;
+    for (unsigned shift = 0; in < end && shift <= 63; shift += 7) {
+        unsigned char byte = static_cast<unsigned char>(*in++);
+        value |= static_cast<unsigned long long>(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            ok = true;
+            break;
+        }
+    }
+    return value;
+}
+
+// Symbols [k * quarter, (k + 1) * quarter) of the input form stream k
+size_t StreamLength(size_t size, size_t k) {
+    size_t quarter = (size + kStreams - 1) / kStreams;
+    size_t begin = std::min(size, k * quarter);
+    return std::min(size, begin + quarter) - begin;
+}
+
+} // namespace
+
+std::vector<char> Compression::CompressHuffman(const char* data, size_t size) {
+    // Worst case: every symbol takes the longest code
+    std::vector<char> compressed(10 + kLengthsSize + kStreams * 10 + size / 8 * kMaxCodeLength +
+                                 kStreams * (kMaxCodeLength + 1) + 16);
+    char* out = PutVarint(compressed.data(), size);
+    if (size == 0) {
+        compressed.resize(out - compressed.data());
+        return compressed;
+    }
+
+    // One histogram per stream gives each stream's exact size, so all four
+    // can be written at once. Odd and even positions count separately to
+    // avoid stalls on runs of one byte value.
+    const unsigned char* in = reinterpret_cast<const unsigned char*>(data);
+    const size_t quarter = (size + kStreams - 1) / kStreams;
+    const size_t common = StreamLength(size, kStreams - 1);
+    std::vector<uint64_t> counts(kStreams * 2 * kSymbols);
+    uint64_t* freq[kStreams][2];
+    for (size_t k = 0; k < kStreams; ++k) {
+        freq[k][0] = &counts[(2 * k) * kSymbols];
+        freq[k][1] = &counts[(2 * k + 1) * kSymbols];
+    }
+    size_t i = 0;
+    for (; i + 2 <= common; i += 2) {
+        for (size_t k = 0; k < kStreams; ++k) {
+            freq[k][0][in[k * quarter + i]]++;
+            freq[k][1][in[k * quarter + i + 1]]++;
+        }
+    }
+    for (size_t k = 0; k < kStreams; ++k) {
+        for (size_t j = i; j < StreamLength(size, k); ++j) freq[k][0][in[k * quarter + j]]++;
+    }
+    uint64_t total[kSymbols] = {0};
+    for (size_t k = 0; k < kStreams; ++k) {
+        for (unsigned s = 0; s < kSymbols; ++s) {
+            freq[k][0][s] += freq[k][1][s];
+            total[s] += freq[k][0][s];
+        }
+    }
+
+    unsigned char lengths[kSymbols];
+    uint16_t codes[kSymbols];
+    BuildLengths(total, lengths);
+    LimitLengths(total, lengths);
+    AssignCodes(lengths, codes);
+
+    for (unsigned s = 0; s < kSymbols; s += 2) {
+        *out++ = static_cast<char>(lengths[s] | (lengths[s + 1] << 4));
+    }
+    size_t streamSize[kStreams];
+    for (size_t k = 0; k < kStreams; ++k) {
+        uint64_t streamBits = 0;
+        for (unsigned s = 0; s < kSymbols; ++s) streamBits += freq[k][0][s] * lengths[s];
+        streamSize[k] = static_cast<size_t>((streamBits + 7) / 8);
+        if (k + 1 < kStreams) out = PutVarint(out, streamSize[k]);
+    }
+
+    BitWriter writers[kStreams] = {
+        BitWriter(out, out + streamSize[0]),
+        BitWriter(out + streamSize[0], out + streamSize[0] + streamSize[1]),
+        BitWriter(out + streamSize[0] + streamSize[1], out + streamSize[0] + streamSize[1] + streamSize[2]),
+        BitWriter(out + streamSize[0] + streamSize[1] + streamSize[2],
+                  out + streamSize[0] + streamSize[1] + streamSize[2] + streamSize[3])};
+    out += streamSize[0] + streamSize[1] + streamSize[2] + streamSize[3];
+
+    // Four independent streams keep four bit buffers in flight at once
+    i = 0;
+    for (; i + 4 <= common; i += 4) {
+        bool room = true;
+        for (size_t k = 0; k < kStreams; ++k) room &= writers[k].CanFlush();
+        if (!room) break;
+        for (size_t n = 0; n < 4; ++n) {
+            for (size_t k = 0; k < kStreams; ++k) writers[k].Put(lengths, codes, in[k * quarter + i + n]);
+        }
+        for (size_t k = 0; k < kStreams; ++k) writers[k].Flush();
+    }
+    for (size_t k = 0; k < kStreams; ++k) {
+        size_t length = StreamLength(size, k);
+        for (size_t j = i; j < length; ++j) {
+            writers[k].Put(lengths, codes, in[k * quarter + j]);
+            if ((j - i) % 4 == 3) writers[k].FlushExact(false);
+        }
+        writers[k].FlushExact(true);
+    }
+
+    compressed.resize(out - compressed.data());
+    return compressed;
+}
+
+bool Compression::DecompressHuffman(const char* data, size_t size, std::vector<char>& decompressed) {
+    decompressed.clear();
+    const char* in = data;
+    const char* end = data + size;
+
+    bool ok;
+    unsigned long long rawSize = GetVarint(in, end, ok);
+    if (!ok) return false;
+    if (rawSize == 0) return true; // Empty input: the size is all there is
+    // Every symbol takes at least one bit; a larger claim is corruption
+    if (static_cast<size_t>(end - in) < kLengthsSize || rawSize / 8 > size) return false;
+
+    unsigned char lengths[kSymbols];
+    for (unsigned s = 0; s < kSymbols; s += 2) {
+        unsigned char packed = static_cast<unsigned char>(*in++);
+        lengths[s] = packed & 15;
+        lengths[s + 1] = packed >> 4;
+        if (lengths[s] > kMaxCodeLength || lengths[s + 1] > kMaxCodeLength) return false;
+    }
+    uint16_t codes[kSymbols];
+    if (!AssignCodes(lengths, codes)) return false;
+    std::vector<uint16_t> table(kTableSize);
+    BuildTable(lengths, codes, table.data());
+
+    const char* streamBegin[kStreams + 1];
+    size_t streamSize[kStreams];
+    for (size_t k = 0; k + 1 < kStreams; ++k) {
+        streamSize[k] = static_cast<size_t>(GetVarint(in, end, ok));
+        if (!ok) return false;
+    }
+    streamBegin[0] = in;
+    for (size_t k = 0; k + 1 < kStreams; ++k) {
+        if (streamSize[k] > static_cast<size_t>(end - streamBegin[k])) return false;
+        streamBegin[k + 1] = streamBegin[k] + streamSize[k];
+    }
+    streamBegin[kStreams] = end;
+
+    decompressed.resize(static_cast<size_t>(rawSize));
+    const size_t quarter = (decompressed.size() + kStreams - 1) / kStreams;
+    BitReader r0(streamBegin[0], streamBegin[1]);
+    BitReader r1(streamBegin[1], streamBegin[2]);
+    BitReader r2(streamBegin[2], streamBegin[3]);
+    BitReader r3(streamBegin[3], streamBegin[4]);
+    const uint16_t* lookup = table.data();
+    char* out = decompressed.data();
+
+    // The four streams are independent, so their lookups overlap instead of
+    // each waiting on the previous code's length. They advance in step
+    // until the shortest one (the last) is nearly done.
+    size_t i = 0;
+    const size_t common = StreamLength(decompressed.size(), kStreams - 1);
+    for (; i + 4 <= common; i += 4) {
+        if (!r0.CanRefill() || !r1.CanRefill() || !r2.CanRefill() || !r3.CanRefill()) break;
+        r0.Refill();
+        r1.Refill();
+        r2.Refill();
+        r3.Refill();
+        for (size_t n = i; n < i + 4; ++n) {
+            r0.Decode(lookup, out[n]);
+            r1.Decode(lookup, out[quarter + n]);
+            r2.Decode(lookup, out[2 * quarter + n]);
+            r3.Decode(lookup, out[3 * quarter + n]);
+        }
+    }
+    BitReader* readers[kStreams] = {&r0, &r1, &r2, &r3};
+    bool valid = true;
+    for (size_t k = 0; k < kStreams && valid; ++k) {
+        size_t length = StreamLength(decompressed.size(), k);
+        for (size_t n = i; n < length && valid; ++n) {
+            valid = readers[k]->DecodeTail(lookup, out[k * quarter + n]);
+        }
+        valid = valid && readers[k]->Finished();
+    }
+
+    return valid;
+}
@@ -0,0 +1,237 @@
+#include "Compression.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+// LZ77 codec (--comp-alg lz). See Compression.h for the stream layout.
+
+namespace {
+
+const size_t kMinMatch = 4;
+const size_t kWindow = 65535;          // Largest offset a 16-bit field holds
+const size_t kMaxChainDepth = 16;      // Candidates tried per position
+const size_t kMaxHashBits = 16;
+const size_t kSegment = size_t(1) << 30; // Positions restart every segment so they fit 32 bits
+
+uint32_t Read32(const char* p) {
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+uint64_t Read64(const char* p) {
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// Multiplicative hash of the next four bytes
+uint32_t Hash4(const char* p, unsigned bits) {
+    return (Read32(p) * 2654435761u) >> (32 - bits);
+}
+
+// Bytes data[a..] and data[b..] have in common, a < b, up to data[limit]
+size_t MatchLength(const char* data, size_t a, size_t b, size_t limit) {
+    size_t length = 0;
+    while (b + length + 8 <= limit) {
+        uint64_t diff = Read64(data + a + length) ^ Read64(data + b + length);
+        if (diff) return length + (__builtin_ctzll(diff) >> 3);
+        length += 8;
+    }
+    while (b + length < limit && data[a + length] == data[b + length]) length++;
+    return length;
+}
+
+char* PutVarint(char* out, unsigned long long value) {
+    while (value >= 0x80) {
+        *out++ = static_cast<char>(value | 0x80);
+        value >>= 7;
+    }
+    *out++ = static_cast<char>(value);
+    return out;
+}
+
+// Lengths of 15 or more continue in extra bytes of 255 and a final remainder
+char* PutLengthTail(char* out, size_t length) {
+    for (length -= 15; length >= 255; length -= 255) *out++ = static_cast<char>(255);
+    *out++ = static_cast<char>(length);
+    return out;
+}
+
+char* PutSequence(char* out, const char* literals, size_t literalLength, size_t offset, size_t matchLength) {
+    size_t matchCode = matchLength ? matchLength - kMinMatch : 0;
+    char* token = out++;
+    *token = static_cast<char>(((literalLength < 15 ? literalLength : 15) << 4) | (matchCode < 15 ? matchCode : 15));
+    if (literalLength >= 15) out = PutLengthTail(out, literalLength);
+    if (literalLength) std::memcpy(out, literals, literalLength); // literals is null for empty input
+    out += literalLength;
+    if (matchLength == 0) return out; // Final sequence: literals only
+
+    *out++ = static_cast<char>(offset);
+    *out++ = static_cast<char>(offset >> 8);
+    if (matchCode >= 15) out = PutLengthTail(out, matchCode);
+    return out;
+}
+
+// Greedy parse of data[begin, end) with a hash chain: every position is
+// linked to the previous one with the same 4-byte hash, and up to
+// kMaxChainDepth of them are tried. Runs of unmatched input are skipped
+// faster the longer they get, so incompressible data passes through
+// quickly. The tables hold positions relative to begin (+1, 0 = empty);
+// literals pending from the previous segment start at anchor, and those
+// left at the end are for the caller to flush.
+char* CompressSegment(const char* data, size_t begin, size_t end, size_t& anchor, char* out,
+                      std::vector<uint32_t>& head, std::vector<uint32_t>& chain, unsigned hashBits) {
+    std::fill(head.begin(), head.end(), 0);
+    size_t ip = begin;
+
+    while (ip + kMinMatch <= end) {
+        uint32_t h = Hash4(data + ip, hashBits);
+        size_t bestLength = 0;
+        size_t bestOffset = 0;
+
+        uint32_t candidate = head[h];
+        for (size_t depth = 0; candidate && depth < kMaxChainDepth; ++depth) {
+            size_t pos = begin + candidate - 1;
+            if (ip - pos > kWindow) break;
+            if (Read32(data + pos) == Read32(data + ip)) {
+                size_t length = kMinMatch + MatchLength(data, pos + kMinMatch, ip + kMinMatch, end);
+                if (length > bestLength) {
+                    bestLength = length;
+                    bestOffset = ip - pos;
+                }
+            }
+            uint32_t next = chain[pos & kWindow];
+            if (next >= candidate) break; // Slot reused by a newer position
+            candidate = next;
+        }
+        chain[ip & kWindow] = head[h];
+        head[h] = static_cast<uint32_t>(ip - begin + 1);
+
+        if (bestLength < kMinMatch) {
+            ip += 1 + ((ip - anchor) >> 6);
+            continue;
+        }
+
+        out = PutSequence(out, data + anchor, ip - anchor, bestOffset, bestLength);
+
+        // Link the positions inside the match so later data can refer to them
+        size_t matchEnd = ip + bestLength;
+        for (size_t p = ip + 1; p < matchEnd && p + kMinMatch <= end; ++p) {
+            uint32_t hp = Hash4(data + p, hashBits);
+            chain[p & kWindow] = head[hp];
+            head[hp] = static_cast<uint32_t>(p - begin + 1);
+        }
+        ip = matchEnd;
+        anchor = ip;
+    }
+    return out;
+}
+
+// Length field continuation; false if the input ends first
+bool GetLengthTail(const char*& in, const char* end, size_t& length) {
+    unsigned char extra;
+    do {
+        if (in >= end) return false;
+        extra = static_cast<unsigned char>(*in++);
+        length += extra;
+    } while (extra == 255);
+    return true;
+}
+
+} // namespace
+
+std::vector<char> Compression::CompressLZ(const char* data, size_t size) {
+    // Worst case: everything literal, one extra length byte per 255
+    std::vector<char> compressed(10 + size + size / 255 + 16);
+    char* out = PutVarint(compressed.data(), size);
+
+    // Hash tables sized to the input so small files do not pay for 64K slots
+    unsigned hashBits = 10;
+    while (hashBits < kMaxHashBits && (size_t(1) << hashBits) < size) hashBits++;
+    std::vector<uint32_t> head(size_t(1) << hashBits);
+    std::vector<uint32_t> chain(kWindow + 1);
+
+    size_t anchor = 0;
+    for (size_t begin = 0; begin < size; begin += kSegment) {
+        size_t end = size - begin < kSegment ? size : begin + kSegment;
+        out = CompressSegment(data, begin, end, anchor, out, head, chain, hashBits);
+    }
+    out = PutSequence(out, data + anchor, size - anchor, 0, 0);
+
+    compressed.resize(out - compressed.data());
+    return compressed;
+}
+
+bool Compression::DecompressLZ(const char* data, size_t size, std::vector<char>& decompressed) {
+    const char* in = data;
+    const char* end = data + size;
+
+    unsigned long long rawSize = 0;
+    for (unsigned shift = 0;; shift += 7) {
+        if (in >= end || shift > 63) return false;
+        unsigned char byte = static_cast<unsigned char>(*in++);
+        rawSize |= static_cast<unsigned long long>(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) break;
+    }
+    // No sequence expands more than ~255 times; a larger claim is corruption
+    if (rawSize / 256 > size) return false;
+
+    // Slack past the end lets short copies be done in whole 16-byte words
+    const size_t slack = 32;
+    decompressed.resize(static_cast<size_t>(rawSize) + slack);
+    char* base = decompressed.data();
+    char* op = base;
+    char* outEnd = base + rawSize;
+
+    while (in < end) {
+        unsigned char token = static_cast<unsigned char>(*in++);
+
+        size_t literalLength = token >> 4;
+        if (literalLength == 15 && !GetLengthTail(in, end, literalLength)) return false;
+        if (literalLength > static_cast<size_t>(end - in) || literalLength > static_cast<size_t>(outEnd - op)) return false;
+        if (literalLength <= 16 && end - in >= 16) {
+            std::memcpy(op, in, 16); // Fixed size: a couple of moves instead of a call
+        } else {
+            std::memcpy(op, in, literalLength);
+        }
+        op += literalLength;
+        in += literalLength;
+        if (in >= end) break; // Final sequence
+
+        if (end - in < 2) return false;
+        size_t offset = static_cast<unsigned char>(in[0]) | (static_cast<unsigned char>(in[1]) << 8);
+        in += 2;
+        size_t matchLength = token & 15;
+        if (matchLength == 15 && !GetLengthTail(in, end, matchLength)) return false;
+        matchLength += kMinMatch;
+        if (offset == 0 || offset > static_cast<size_t>(op - base) || matchLength > static_cast<size_t>(outEnd - op)) {
+            return false;
+        }
+
+        const char* match = op - offset;
+        char* copyEnd = op + matchLength;
+        if (offset >= 16) {
+            while (op < copyEnd) {
+                std::memcpy(op, match, 16);
+                op += 16;
+                match += 16;
+            }
+        } else if (offset >= 8) {
+            // Each word is read before it is overwritten, even when overlapping
+            while (op < copyEnd) {
+                std::memcpy(op, match, 8);
+                op += 8;
+                match += 8;
+            }
+        } else {
+            while (op < copyEnd) *op++ = *match++; // Short period: byte by byte
+        }
+        op = copyEnd;
+    }
+
+    // Short of the declared size: the stream was cut off
+    if (op != outEnd) return false;
+    decompressed.resize(op - base);
+    return true;
+}
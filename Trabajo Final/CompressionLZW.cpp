@@ -0,0 +1,258 @@
+#include "Compression.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+// LZW codec (--comp-alg lzw). See Compression.h for the stream layout.
+
+namespace {
+
+const unsigned kClearCode = 256;
+const unsigned kFirstCode = 257;
+const unsigned kMinBits = 9;
+
+void Store64(char* p, uint64_t v) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    std::memcpy(p, &v, sizeof(v));
+}
+
+char* PutVarint(char* out, unsigned long long value) {
+    while (value >= 0x80) {
+        *out++ = static_cast<char>(value | 0x80);
+        value >>= 7;
+    }
+    *out++ = static_cast<char>(value);
+    return out;
+}
+
+// Width of the codes written while nextCode is the next free code: wide
+// enough for any code below it
+unsigned CodeWidth(unsigned nextCode, unsigned maxBits) {
+    unsigned width = kMinBits;
+    while (width < maxBits && (nextCode - 1) >> width) width++;
+    return width;
+}
+
+// The encoder's dictionary: (prefix code, next byte) -> code, in an
+// open-addressing table with linear probing kept at most half full. Keys
+// are stored plus one so that 0 marks an empty slot.
+class Dictionary {
+public:
+    explicit Dictionary(unsigned maxBits)
+        : mask((size_t(2) << maxBits) - 1), keys(mask + 1), codes(mask + 1) {}
+
+    void Clear() { std::fill(keys.begin(), keys.end(), 0); }
+
+    // Code for prefix + byte; slot is where it goes if absent (returns -1)
+    int Find(unsigned prefix, unsigned char byte, size_t& slot) const {
+        uint32_t key = ((prefix << 8) | byte) + 1;
+        slot = (key * 2654435761u >> 8) & mask;
+        while (keys[slot]) {
+            if (keys[slot] == key) return codes[slot];
+            slot = (slot + 1) & mask;
+        }
+        return -1;
+    }
+
+    void Insert(size_t slot, unsigned prefix, unsigned char byte, unsigned code) {
+        keys[slot] = ((prefix << 8) | byte) + 1;
+        codes[slot] = static_cast<uint16_t>(code);
+    }
+
+private:
+    size_t mask;
+    std::vector<uint32_t> keys;
+    std::vector<uint16_t> codes;
+};
+
+// Codes packed from the least significant bit up
+class CodeWriter {
+public:
+    explicit CodeWriter(char* out) : out(out), bits(0), count(0) {}
+
+    void Put(unsigned code, unsigned width) {
+        bits |= static_cast<uint64_t>(code) << count;
+        count += width;
+        if (count >= 32) {
+            Store64(out, bits);
+            out += 4;
+            bits >>= 32;
+            count -= 32;
+        }
+    }
+
+    char* Finish() {
+        Store64(out, bits);
+        return out + (count + 7) / 8;
+    }
+
+private:
+    char* out;
+    uint64_t bits;
+    unsigned count;
+};
+
+class CodeReader {
+public:
+    CodeReader(const char* in, const char* end) : in(in), end(end), bits(0), count(0) {}
+
+    // False once the input runs out
+    bool Get(unsigned width, unsigned& code) {
+        while (count < width) {
+            if (in >= end) return false;
+            bits |= static_cast<uint64_t>(static_cast<unsigned char>(*in++)) << count;
+            count += 8;
+        }
+        code = static_cast<unsigned>(bits & ((1u << width) - 1));
+        bits >>= width;
+        count -= width;
+        return true;
+    }
+
+private:
+    const char* in;
+    const char* end;
+    uint64_t bits;
+    unsigned count;
+};
+
+} // namespace
+
+std::vector<char> Compression::CompressLZW(const char* data, size_t size, unsigned maxBits) {
+    maxBits = std::max(MinLZWBits, std::min(MaxLZWBits, maxBits));
+    const unsigned maxCodes = 1u << maxBits;
+
+    // One code per input byte at worst, plus a clear code per full dictionary
+    size_t codes = size + size / (maxCodes - kFirstCode) + 2;
+    std::vector<char> compressed(11 + codes / 8 * maxBits + maxBits + 16);
+    char* out = PutVarint(compressed.data(), size);
+    *out++ = static_cast<char>(maxBits);
+    if (size == 0) {
+        compressed.resize(out - compressed.data());
+        return compressed;
+    }
+
+    Dictionary dictionary(maxBits);
+    CodeWriter writer(out);
+    const unsigned char* in = reinterpret_cast<const unsigned char*>(data);
+    unsigned nextCode = kFirstCode;
+    unsigned width = kMinBits;
+    unsigned prefix = in[0];
+
+    for (size_t i = 1; i < size; ++i) {
+        size_t slot;
+        int code = dictionary.Find(prefix, in[i], slot);
+        if (code >= 0) {
+            prefix = static_cast<unsigned>(code);
+            continue;
+        }
+        writer.Put(prefix, width);
+        if (nextCode < maxCodes) {
+            dictionary.Insert(slot, prefix, in[i], nextCode++);
+            width = CodeWidth(nextCode, maxBits);
+        } else {
+            // Full: start over, so the dictionary follows the data
+            writer.Put(kClearCode, width);
+            dictionary.Clear();
+            nextCode = kFirstCode;
+            width = kMinBits;
+        }
+        prefix = in[i];
+    }
+    writer.Put(prefix, width);
+    out = writer.Finish();
+
+    compressed.resize(out - compressed.data());
+    return compressed;
+}
+
+bool Compression::DecompressLZW(const char* data, size_t size, std::vector<char>& decompressed) {
+    const char* in = data;
+    const char* end = data + size;
+
+    unsigned long long rawSize = 0;
+    for (unsigned shift = 0;; shift += 7) {
+        if (in >= end || shift > 63) return false;
+        unsigned char byte = static_cast<unsigned char>(*in++);
+        rawSize |= static_cast<unsigned long long>(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) break;
+    }
+    if (in >= end) return false;
+    unsigned maxBits = static_cast<unsigned char>(*in++);
+    if (maxBits < MinLZWBits || maxBits > MaxLZWBits) return false;
+    const unsigned maxCodes = 1u << maxBits;
+    // No code expands to more than maxCodes bytes; a larger claim is corruption
+    if (rawSize / maxCodes > size) return false;
+
+    // Every code's string already sits in the output, so a code is just
+    // where its first copy starts and how long it is
+    std::vector<size_t> start(maxCodes);
+    std::vector<uint32_t> length(maxCodes);
+    decompressed.resize(static_cast<size_t>(rawSize));
+    char* base = decompressed.data();
+    size_t op = 0;
+
+    CodeReader reader(in, end);
+    unsigned nextCode = kFirstCode;
+    bool first = true; // No previous code right after a clear
+    size_t prevStart = 0;
+    uint32_t prevLength = 0;
+
+    while (op < rawSize) {
+        // The encoder is one dictionary entry ahead of us
+        unsigned width = first ? kMinBits : CodeWidth(std::min(nextCode + 1, maxCodes), maxBits);
+        unsigned code;
+        if (!reader.Get(width, code)) break;
+
+        if (code == kClearCode) {
+            nextCode = kFirstCode;
+            first = true;
+            continue;
+        }
+
+        size_t from;
+        uint32_t count;
+        if (code < 256) {
+            base[op] = static_cast<char>(code);
+            from = op;
+            count = 1;
+        } else if (code < nextCode && !first) {
+            from = start[code];
+            count = length[code];
+        } else if (code == nextCode && !first) {
+            // Defined by this very step: the previous string plus its own first byte
+            from = prevStart;
+            count = prevLength + 1;
+        } else {
+            break;
+        }
+        if (count > rawSize - op) break;
+
+        if (code >= 256) {
+            if (from + count <= op) {
+                std::memcpy(base + op, base + from, count);
+            } else {
+                for (uint32_t k = 0; k < count; ++k) base[op + k] = base[from + k]; // Overlaps by one byte
+            }
+        }
+
+        // The entry the encoder added after the previous code: that string
+        // plus this one's first byte, which directly follows it in the output
+        if (!first && nextCode < maxCodes) {
+            start[nextCode] = prevStart;
+            length[nextCode] = prevLength + 1;
+            nextCode++;
+        }
+        first = false;
+        prevStart = op;
+        prevLength = count;
+        op += count;
+    }
+
+    // A stream that ran out of codes, or held a bad one, fell short
+    if (op != rawSize) return false;
+    decompressed.resize(op);
+    return true;
+}
@@ -1,48 +1,221 @@
 #include "Concurrency.h"
 #include <iostream>
 
-HANDLE Concurrency::RunTask(ThreadFunc func, LPVOID param) {
-    DWORD threadId;
-    HANDLE hThread = CreateThread(
-        NULL,                   // Default security attributes
-        0,                      // Default stack size
-        func,                   // Thread function
-        param,                  // Argument to thread function
-        0,                      // Default creation flags
-        &threadId               // Returns the thread identifier
-    );
+Concurrency::ThreadPool::ThreadPool(size_t workers) : queued(0), running(0), nextQueue(0), stopping(false) {
+    if (workers == 0) workers = GetCoreCount();
 
-    if (hThread == NULL) {
-        std::cerr << "Error creating thread. Error: " << GetLastError() << std::endl;
+    // Every deque exists before any worker starts looking for work
+    for (size_t i = 0; i < workers; ++i) {
+        queues.emplace_back(new WorkerQueue());
     }
 
-    return hThread;
+    threads.reserve(workers);
+    for (size_t i = 0; i < workers; ++i) {
+        ThreadHandle handle;
+        WorkerStart* start = new WorkerStart{this, i};
+        if (!RunTask(WorkerMain, start, handle)) {
+            delete start;
+            break; // Run with the workers we managed to start; they steal the rest
+        }
+        threads.push_back(handle);
+    }
+
+    if (threads.empty()) {
+        std::cerr << "Error: could not start any worker thread." << std::endl;
+    }
+}
+
+Concurrency::ThreadPool::~ThreadPool() {
+    Wait();
+    {
+        ScopedLock lock(mutex);
+        stopping = true;
+    }
+    workAvailable.Broadcast();
+    WaitForAll(threads);
 }
 
-void Concurrency::WaitForAll(const std::vector<HANDLE>& threads) {
-    if (threads.empty()) return;
+namespace {
+
+// Which pool (and which of its deques) the calling thread works for.
+// Lets Submit and Wait(group) tell a worker's nested subtasks apart
+// from work handed in from outside the pool.
+thread_local Concurrency::ThreadPool* currentPool = nullptr;
+thread_local size_t currentIndex = 0;
+
+} // namespace
+
+int Concurrency::ThreadPool::CurrentWorker() {
+    return currentPool ? static_cast<int>(currentIndex) : -1;
+}
+
+void Concurrency::ThreadPool::Submit(ThreadFunc func, void* param, TaskGroup* group) {
+    if (threads.empty()) {
+        // No worker could be created; degrade to running inline
+        func(param);
+        return;
+    }
+
+    if (group) {
+        ScopedLock lock(group->mutex);
+        group->pending++;
+    }
+
+    bool nested = (currentPool == this);
+    size_t target;
+    {
+        // Count the task before it becomes visible, so a worker that pops
+        // it right away never sees the counter go below zero
+        ScopedLock lock(mutex);
+        if (nested) {
+            target = currentIndex;
+        } else {
+            target = nextQueue;
+            nextQueue = (nextQueue + 1) % queues.size();
+        }
+        queued++;
+    }
+
+    {
+        ScopedLock lock(queues[target]->mutex);
+        if (nested) {
+            queues[target]->subtasks.push_back(Task{func, param, group});
+        } else {
+            queues[target]->tasks.push_back(Task{func, param, group});
+        }
+    }
+    workAvailable.Signal();
+}
 
-    // WaitForMultipleObjects can wait for at most MAXIMUM_WAIT_OBJECTS (64)
-    // If we have more, we need to loop.
-    const DWORD maxWait = MAXIMUM_WAIT_OBJECTS;
-    size_t count = threads.size();
-    size_t processed = 0;
+void Concurrency::ThreadPool::Wait() {
+    ScopedLock lock(mutex);
+    while (queued > 0 || running > 0) {
+        idle.Wait(mutex);
+    }
+}
 
-    while (processed < count) {
-        DWORD batchSize = (count - processed > maxWait) ? maxWait : static_cast<DWORD>(count - processed);
-        const HANDLE* pHandles = &threads[processed];
+void Concurrency::ThreadPool::Wait(TaskGroup& group) {
+    for (;;) {
+        {
+            ScopedLock lock(group.mutex);
+            if (group.pending == 0) return;
+        }
 
-        DWORD result = WaitForMultipleObjects(batchSize, pHandles, TRUE, INFINITE);
-        if (result == WAIT_FAILED) {
-            std::cerr << "WaitForMultipleObjects failed. Error: " << GetLastError() << std::endl;
-            break;
+        // Only this worker pushes to its subtask FIFO, so once it is empty
+        // every remaining task of the group is already running elsewhere
+        // and sleeping until they finish cannot deadlock.
+        Task task;
+        if (currentPool == this && PopSubtask(currentIndex, task)) {
+            Execute(task);
+            continue;
         }
 
-        processed += batchSize;
+        ScopedLock lock(group.mutex);
+        while (group.pending > 0) {
+            group.done.Wait(group.mutex);
+        }
+        return;
     }
+}
 
-    // Close handles
-    for (HANDLE h : threads) {
-        CloseHandle(h);
+bool Concurrency::ThreadPool::PopLocal(size_t index, Task& task) {
+    WorkerQueue& q = *queues[index];
+    ScopedLock lock(q.mutex);
+    if (!q.subtasks.empty()) {
+        task = q.subtasks.front();
+        q.subtasks.pop_front();
+        return true;
+    }
+    if (q.tasks.empty()) return false;
+    task = q.tasks.front();
+    q.tasks.pop_front();
+    return true;
+}
+
+bool Concurrency::ThreadPool::PopSubtask(size_t index, Task& task) {
+    WorkerQueue& q = *queues[index];
+    ScopedLock lock(q.mutex);
+    if (q.subtasks.empty()) return false;
+    task = q.subtasks.front();
+    q.subtasks.pop_front();
+    return true;
+}
+
+bool Concurrency::ThreadPool::Steal(size_t thief, Task& task) {
+    size_t n = queues.size();
+
+    // Subtasks first: their owner is waiting on them, and the oldest one
+    // is the next it needs
+    for (size_t k = 1; k < n; ++k) {
+        WorkerQueue& q = *queues[(thief + k) % n];
+        ScopedLock lock(q.mutex);
+        if (!q.subtasks.empty()) {
+            task = q.subtasks.front();
+            q.subtasks.pop_front();
+            return true;
+        }
+    }
+
+    for (size_t k = 1; k < n; ++k) {
+        WorkerQueue& q = *queues[(thief + k) % n];
+        ScopedLock lock(q.mutex);
+        if (!q.tasks.empty()) {
+            // The back holds the most recently dealt, i.e. smallest, jobs
+            task = q.tasks.back();
+            q.tasks.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
+
+void Concurrency::ThreadPool::Execute(const Task& task) {
+    {
+        ScopedLock lock(mutex);
+        queued--;
+        running++;
+    }
+
+    task.func(task.param);
+
+    if (task.group) {
+        ScopedLock lock(task.group->mutex);
+        if (--task.group->pending == 0) {
+            task.group->done.Broadcast();
+        }
+    }
+
+    {
+        ScopedLock lock(mutex);
+        running--;
+        if (queued == 0 && running == 0) {
+            idle.Broadcast();
+        }
+    }
+}
+
+int Concurrency::ThreadPool::WorkerMain(void* param) {
+    WorkerStart* start = static_cast<WorkerStart*>(param);
+    ThreadPool* pool = start->pool;
+    size_t index = start->index;
+    delete start;
+
+    currentPool = pool;
+    currentIndex = index;
+
+    for (;;) {
+        Task task;
+        if (pool->PopLocal(index, task) || pool->Steal(index, task)) {
+            pool->Execute(task);
+            continue;
+        }
+
+        ScopedLock lock(pool->mutex);
+        while (pool->queued == 0 && !pool->stopping) {
+            pool->workAvailable.Wait(pool->mutex);
+        }
+        if (pool->queued == 0) break; // Stopping and nothing left to do
+        // Otherwise a task was queued; go back and look for it
     }
+    return 0;
 }
@@ -1,20 +1,191 @@
 #ifndef CONCURRENCY_H
 #define CONCURRENCY_H
 
-#include <windows.h>
 #include <vector>
+#include <deque>
+#include <memory>
+#include <cstddef>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
 
+// Concurrency is implemented once per platform backend:
+//   ConcurrencyWin32.cpp - Windows API (CreateThread, WaitForMultipleObjects,
+//                          CRITICAL_SECTION, CONDITION_VARIABLE)
+//   ConcurrencyPosix.cpp - pthreads (pthread_create, pthread_join,
+//                          pthread_mutex_t, pthread_cond_t)
+// Concurrency.cpp holds the work-stealing worker pool, which is built only
+// on top of the primitives below and is shared by both backends.
 class Concurrency {
 public:
     // Type for the function to be executed in a thread
-    typedef DWORD (WINAPI *ThreadFunc)(LPVOID lpParam);
+    // Returns 0 on success, non-zero on failure
+    typedef int (*ThreadFunc)(void* param);
+
+    // Native handle of a thread started by RunTask
+#ifdef _WIN32
+    typedef HANDLE ThreadHandle;
+#else
+    typedef pthread_t ThreadHandle;
+#endif
 
     // Run a task in a new thread
-    // Returns handle to the thread
-    static HANDLE RunTask(ThreadFunc func, LPVOID param);
+    // Returns false if the thread could not be created
+    static bool RunTask(ThreadFunc func, void* param, ThreadHandle& handle);
 
     // Wait for all threads to complete
-    static void WaitForAll(const std::vector<HANDLE>& threads);
+    static void WaitForAll(const std::vector<ThreadHandle>& threads);
+
+    // Number of logical processors available to this process (at least 1)
+    static size_t GetCoreCount();
+
+    class Condition;
+    class ThreadPool;
+
+    // Mutual exclusion lock (CRITICAL_SECTION / pthread_mutex_t)
+    class Mutex {
+    public:
+        Mutex();
+        ~Mutex();
+        void Lock();
+        void Unlock();
+
+    private:
+        Mutex(const Mutex&) = delete;
+        Mutex& operator=(const Mutex&) = delete;
+        friend class Condition;
+#ifdef _WIN32
+        CRITICAL_SECTION native;
+#else
+        pthread_mutex_t native;
+#endif
+    };
+
+    // Locks a Mutex for the lifetime of the scope
+    class ScopedLock {
+    public:
+        explicit ScopedLock(Mutex& m) : mutex(m) { mutex.Lock(); }
+        ~ScopedLock() { mutex.Unlock(); }
+
+    private:
+        ScopedLock(const ScopedLock&) = delete;
+        ScopedLock& operator=(const ScopedLock&) = delete;
+        Mutex& mutex;
+    };
+
+    // Condition variable (CONDITION_VARIABLE / pthread_cond_t)
+    class Condition {
+    public:
+        Condition();
+        ~Condition();
+        // Atomically releases the mutex and sleeps; the mutex is held again on return
+        void Wait(Mutex& mutex);
+        void Signal();
+        void Broadcast();
+
+    private:
+        Condition(const Condition&) = delete;
+        Condition& operator=(const Condition&) = delete;
+#ifdef _WIN32
+        CONDITION_VARIABLE native;
+#else
+        pthread_cond_t native;
+#endif
+    };
+
+    // Counts the outstanding tasks submitted with it, so a caller can wait
+    // for exactly those tasks (ThreadPool::Wait(group)) instead of the pool.
+    class TaskGroup {
+    public:
+        TaskGroup() : pending(0) {}
+
+    private:
+        TaskGroup(const TaskGroup&) = delete;
+        TaskGroup& operator=(const TaskGroup&) = delete;
+        friend class ThreadPool;
+        Mutex mutex;
+        Condition done;
+        size_t pending;
+    };
+
+    // Fixed-size pool of worker threads with one task deque per worker.
+    // Submitted tasks are dealt round-robin across the deques, so submitting
+    // the largest jobs first puts one long job at the front of every deque.
+    // A worker takes from the front of its own deque; when that is empty it
+    // steals from the back of another worker's deque, where the smallest
+    // jobs sit. The number of threads never depends on how many tasks exist.
+    //
+    // A task may split its own work into subtasks (e.g. the blocks of a large
+    // file). Those go to a FIFO owned by the submitting worker; while that
+    // worker waits on their TaskGroup it runs them itself, oldest first, and
+    // idle workers steal them before stealing whole files.
+    class ThreadPool {
+    public:
+        // workers == 0 sizes the pool to GetCoreCount()
+        explicit ThreadPool(size_t workers = 0);
+        // Waits for queued tasks and joins every worker
+        ~ThreadPool();
+
+        // Queue a task. From outside the pool it goes on the next worker's
+        // deque (round-robin); from a worker it goes on that worker's subtask
+        // FIFO. If group is given, the task is counted in it.
+        void Submit(ThreadFunc func, void* param, TaskGroup* group = nullptr);
+
+        // Block until every deque is empty and no task is running
+        void Wait();
+
+        // Block until every task of the group has finished. A worker thread
+        // runs its own queued subtasks meanwhile instead of sleeping.
+        void Wait(TaskGroup& group);
+
+        size_t WorkerCount() const { return threads.size(); }
+
+        // Index of the calling thread among its pool's workers; -1 when
+        // called from outside any pool
+        static int CurrentWorker();
+
+    private:
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        struct Task {
+            ThreadFunc func;
+            void* param;
+            TaskGroup* group;
+        };
+
+        // Per-worker queues; the owner pops the fronts, thieves pop
+        // subtasks from the front and tasks from the back
+        struct WorkerQueue {
+            Mutex mutex;
+            std::deque<Task> tasks;     // Dealt by Submit from outside the pool
+            std::deque<Task> subtasks;  // Submitted by this worker's own task
+        };
+
+        struct WorkerStart {
+            ThreadPool* pool;
+            size_t index;
+        };
+
+        static int WorkerMain(void* param);
+        bool PopLocal(size_t index, Task& task);
+        bool PopSubtask(size_t index, Task& task);
+        bool Steal(size_t thief, Task& task);
+        void Execute(const Task& task);
+
+        std::vector<ThreadHandle> threads;
+        std::vector<std::unique_ptr<WorkerQueue>> queues;
+        Mutex mutex;             // Guards the counters below
+        Condition workAvailable;
+        Condition idle;
+        size_t queued;           // Tasks sitting in some deque
+        size_t running;          // Tasks currently executing
+        size_t nextQueue;        // Round-robin cursor for Submit
+        bool stopping;
+    };
 };
 
 #endif // CONCURRENCY_H
@@ -0,0 +1,95 @@
+#include "Concurrency.h"
+#include <iostream>
+#include <cstring>
+#include <unistd.h>
+
+namespace {
+
+// pthread_create expects void* (*)(void*), so the portable ThreadFunc
+// is carried through this small heap record and called from a trampoline.
+struct TaskStart {
+    Concurrency::ThreadFunc func;
+    void* param;
+};
+
+void* TaskTrampoline(void* arg) {
+    TaskStart* start = static_cast<TaskStart*>(arg);
+    Concurrency::ThreadFunc func = start->func;
+    void* param = start->param;
+    delete start;
+    func(param);
+    return NULL;
+}
+
+} // namespace
+
+bool Concurrency::RunTask(ThreadFunc func, void* param, ThreadHandle& handle) {
+    TaskStart* start = new TaskStart{func, param};
+
+    int rc = pthread_create(
+        &handle,                // Returns the thread identifier
+        NULL,                   // Default attributes (joinable, default stack)
+        TaskTrampoline,         // Thread function
+        start                   // Argument to thread function
+    );
+
+    if (rc != 0) {
+        std::cerr << "Error creating thread. Error: " << strerror(rc) << std::endl;
+        delete start;
+        return false;
+    }
+
+    return true;
+}
+
+void Concurrency::WaitForAll(const std::vector<ThreadHandle>& threads) {
+    // pthread_join both waits and releases the thread, so there is no
+    // separate close step like CloseHandle on Windows.
+    for (pthread_t t : threads) {
+        int rc = pthread_join(t, NULL);
+        if (rc != 0) {
+            std::cerr << "pthread_join failed. Error: " << strerror(rc) << std::endl;
+        }
+    }
+}
+
+size_t Concurrency::GetCoreCount() {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? static_cast<size_t>(n) : 1;
+}
+
+Concurrency::Mutex::Mutex() {
+    pthread_mutex_init(&native, NULL);
+}
+
+Concurrency::Mutex::~Mutex() {
+    pthread_mutex_destroy(&native);
+}
+
+void Concurrency::Mutex::Lock() {
+    pthread_mutex_lock(&native);
+}
+
+void Concurrency::Mutex::Unlock() {
+    pthread_mutex_unlock(&native);
+}
+
+Concurrency::Condition::Condition() {
+    pthread_cond_init(&native, NULL);
+}
+
+Concurrency::Condition::~Condition() {
+    pthread_cond_destroy(&native);
+}
+
+void Concurrency::Condition::Wait(Mutex& mutex) {
+    pthread_cond_wait(&native, &mutex.native);
+}
+
+void Concurrency::Condition::Signal() {
+    pthread_cond_signal(&native);
+}
+
+void Concurrency::Condition::Broadcast() {
+    pthread_cond_broadcast(&native);
+}
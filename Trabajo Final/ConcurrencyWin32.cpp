@@ -0,0 +1,113 @@
+#include "Concurrency.h"
+#include <iostream>
+
+namespace {
+
+// CreateThread expects a WINAPI entry point, so the portable ThreadFunc
+// is carried through this small heap record and called from a trampoline.
+struct TaskStart {
+    Concurrency::ThreadFunc func;
+    void* param;
+};
+
+DWORD WINAPI TaskTrampoline(LPVOID lpParam) {
+    TaskStart* start = static_cast<TaskStart*>(lpParam);
+    Concurrency::ThreadFunc func = start->func;
+    void* param = start->param;
+    delete start;
+    return static_cast<DWORD>(func(param));
+}
+
+} // namespace
+
+bool Concurrency::RunTask(ThreadFunc func, void* param, ThreadHandle& handle) {
+    TaskStart* start = new TaskStart{func, param};
+    DWORD threadId;
+    HANDLE hThread = CreateThread(
+        NULL,                   // Default security attributes
+        0,                      // Default stack size
+        TaskTrampoline,         // Thread function
+        start,                  // Argument to thread function
+        0,                      // Default creation flags
+        &threadId               // Returns the thread identifier
+    );
+
+    if (hThread == NULL) {
+        std::cerr << "Error creating thread. Error: " << GetLastError() << std::endl;
+        delete start;
+        return false;
+    }
+
+    handle = hThread;
+    return true;
+}
+
+void Concurrency::WaitForAll(const std::vector<ThreadHandle>& threads) {
+    if (threads.empty()) return;
+
+    // WaitForMultipleObjects can wait for at most MAXIMUM_WAIT_OBJECTS (64)
+    // If we have more, we need to loop.
+    const DWORD maxWait = MAXIMUM_WAIT_OBJECTS;
+    size_t count = threads.size();
+    size_t processed = 0;
+
+    while (processed < count) {
+        DWORD batchSize = (count - processed > maxWait) ? maxWait : static_cast<DWORD>(count - processed);
+        const HANDLE* pHandles = &threads[processed];
+
+        DWORD result = WaitForMultipleObjects(batchSize, pHandles, TRUE, INFINITE);
+        if (result == WAIT_FAILED) {
+            std::cerr << "WaitForMultipleObjects failed. Error: " << GetLastError() << std::endl;
+            break;
+        }
+
+        processed += batchSize;
+    }
+
+    // Close handles
+    for (HANDLE h : threads) {
+        CloseHandle(h);
+    }
+}
+
+size_t Concurrency::GetCoreCount() {
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? info.dwNumberOfProcessors : 1;
+}
+
+Concurrency::Mutex::Mutex() {
+    InitializeCriticalSection(&native);
+}
+
+Concurrency::Mutex::~Mutex() {
+    DeleteCriticalSection(&native);
+}
+
+void Concurrency::Mutex::Lock() {
+    EnterCriticalSection(&native);
+}
+
+void Concurrency::Mutex::Unlock() {
+    LeaveCriticalSection(&native);
+}
+
+Concurrency::Condition::Condition() {
+    InitializeConditionVariable(&native);
+}
+
+Concurrency::Condition::~Condition() {
+    // CONDITION_VARIABLE holds no resources to release
+}
+
+void Concurrency::Condition::Wait(Mutex& mutex) {
+    SleepConditionVariableCS(&native, &mutex.native, INFINITE);
+}
+
+void Concurrency::Condition::Signal() {
+    WakeConditionVariable(&native);
+}
+
+void Concurrency::Condition::Broadcast() {
+    WakeAllConditionVariable(&native);
+}
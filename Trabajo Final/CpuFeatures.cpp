@@ -0,0 +1,45 @@
+#include "CpuFeatures.h"
+
+namespace {
+
+struct Features {
+    bool sse2 = false;
+    bool sse42 = false;
+    bool avx2 = false;
+    bool aesni = false;
+
+    Features() {
+#ifdef CPU_FEATURES_X86
+        // Also checks the OS saves the AVX registers on context switches
+        __builtin_cpu_init();
+        sse2 = __builtin_cpu_supports("sse2");
+        sse42 = __builtin_cpu_supports("sse4.2");
+        avx2 = __builtin_cpu_supports("avx2");
+        aesni = __builtin_cpu_supports("aes");
+#endif
+    }
+};
+
+// Function-local so kernels used by other static initializers still see it
+const Features& Detected() {
+    static const Features features;
+    return features;
+}
+
+} // namespace
+
+bool CpuFeatures::HasSSE2() {
+    return Detected().sse2;
+}
+
+bool CpuFeatures::HasSSE42() {
+    return Detected().sse42;
+}
+
+bool CpuFeatures::HasAVX2() {
+    return Detected().avx2;
+}
+
+bool CpuFeatures::HasAESNI() {
+    return Detected().aesni;
+}
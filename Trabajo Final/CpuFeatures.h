@@ -0,0 +1,20 @@
+#ifndef CPUFEATURES_H
+#define CPUFEATURES_H
+
+// x86 builds get SIMD kernels compiled with __attribute__((target(...)));
+// which one runs is decided at run time from the processor's features.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CPU_FEATURES_X86 1
+#endif
+
+// Instruction set extensions of the processor we are running on. Detected
+// once; every query after the first is a load. Always false off x86.
+class CpuFeatures {
+public:
+    static bool HasSSE2();
+    static bool HasSSE42();
+    static bool HasAVX2();
+    static bool HasAESNI();
+};
+
+#endif // CPUFEATURES_H
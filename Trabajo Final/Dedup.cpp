@@ -0,0 +1,445 @@
+#include "Dedup.h"
+#include "Endian.h"
+#include "Report.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <memory>
+
+const char* const Dedup::ChunksName = ".so_chunks";
+const char* const Dedup::IndexName = ".so_index";
+
+namespace {
+
+const char kIndexMagic[4] = {'S', 'O', 'D', 'I'};
+const char kRecipeMagic[4] = {'S', 'O', 'D', 'R'};
+const uint8_t kVersion = 1;
+const size_t kHeaderSize = 16;      // Magic, version, reserved, count or file size
+const size_t kIndexEntrySize = 48;  // Digest, offset, length, raw size
+const size_t kRecipeHeaderSize = 24; // Magic, version, reserved, file size, count
+
+// Chunks hashed and encoded by one pool task
+const size_t kJobBytes = 1 << 20;
+// Chunks decoded by one pool task (about kJobBytes at the average size)
+const size_t kJobChunks = kJobBytes / Dedup::AverageChunk;
+
+// Cut when the top bits of the hash are all zero: 16 bits before the
+// average size, 12 after (FastCDC normalization level 2). The top bits mix
+// the most bytes of the window.
+const uint64_t kStrictMask = 0xFFFFULL << 48;
+const uint64_t kLooseMask = 0xFFFULL << 52;
+
+// 256 random words, from a fixed seed: chunk boundaries, and with them
+// deduplication against older stores, depend on these never changing
+struct GearTable {
+    uint64_t value[256];
+    GearTable() {
+        uint64_t state = 0x536f4465647570ULL;
+        for (int i = 0; i < 256; ++i) {
+            // SplitMix64
+            uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            value[i] = z ^ (z >> 31);
+        }
+    }
+};
+
+const GearTable kGear;
+
+std::string StorePath(const std::string& directory, const char* name) {
+    return FileManager::CreateOutputPath(name, directory, "");
+}
+
+// The same options, turned around to read what they wrote
+BlockFormat::Options ForReading(BlockFormat::Options options) {
+    options.decompress = options.decompress || options.compress;
+    options.decrypt = options.decrypt || options.encrypt;
+    options.compress = false;
+    options.encrypt = false;
+    return options;
+}
+
+// Chunks on their own are encoded inline: the pool is already busy with
+// whole groups of them
+BlockFormat::Options ForChunks(BlockFormat::Options options) {
+    options.pool = nullptr;
+    return options;
+}
+
+// Runs of consecutive chunks handed to one pool task
+struct EncodeJob {
+    const char* data;
+    const std::vector<size_t>* offsets; // Chunk i spans offsets[i] to offsets[i + 1]
+    size_t first;
+    size_t last;
+    std::vector<Dedup::Digest>* digests;
+    Dedup::Store* store;
+    const BlockFormat::Options* options;
+    bool ok = true;
+};
+
+int EncodeChunksTask(void* param) {
+    EncodeJob* job = static_cast<EncodeJob*>(param);
+    const std::vector<size_t>& offsets = *job->offsets;
+    for (size_t i = job->first; i < job->last && job->ok; ++i) {
+        const char* chunk = job->data + offsets[i];
+        size_t size = offsets[i + 1] - offsets[i];
+        Dedup::Digest& digest = (*job->digests)[i];
+        {
+            Report::Timer timer(job->options->stats, Report::StageChecksum, size);
+            Checksum::Sha256(chunk, size, digest.bytes);
+        }
+        job->ok = job->store->Add(digest, chunk, size, *job->options);
+    }
+    return 0;
+}
+
+struct DecodeJob {
+    const Dedup::Digest* digests;
+    size_t count;
+    Dedup::Store* store;
+    const BlockFormat::Options* options;
+    std::vector<char> output;
+    bool ok = true;
+};
+
+int DecodeChunksTask(void* param) {
+    DecodeJob* job = static_cast<DecodeJob*>(param);
+    for (size_t i = 0; i < job->count && job->ok; ++i) {
+        job->ok = job->store->Read(job->digests[i], job->output, *job->options);
+    }
+    return 0;
+}
+
+// Run every job on the pool, or inline without one
+template <typename Job>
+void RunJobs(std::vector<Job>& jobs, Concurrency::ThreadFunc func, Concurrency::ThreadPool* pool) {
+    Concurrency::TaskGroup group;
+    for (Job& job : jobs) {
+        if (pool) pool->Submit(func, &job, &group);
+        else func(&job);
+    }
+    if (pool) pool->Wait(group);
+}
+
+} // namespace
+
+bool Dedup::IsStoreFile(const std::string& path) {
+    size_t lastSlash = path.find_last_of("/\\");
+    std::string name = lastSlash == std::string::npos ? path : path.substr(lastSlash + 1);
+    return name == ChunksName || name == IndexName || name == std::string(IndexName) + ".tmp";
+}
+
+size_t Dedup::NextChunk(const char* data, size_t size) {
+    if (size <= MinChunk) return size;
+    const unsigned char* in = reinterpret_cast<const unsigned char*>(data);
+    size_t normal = std::min(size, AverageChunk);
+    size_t end = std::min(size, MaxChunk);
+
+    uint64_t hash = 0;
+    size_t i = MinChunk;
+    for (; i < normal; ++i) {
+        hash = (hash << 1) + kGear.value[in[i]];
+        if (!(hash & kStrictMask)) return i + 1;
+    }
+    for (; i < end; ++i) {
+        hash = (hash << 1) + kGear.value[in[i]];
+        if (!(hash & kLooseMask)) return i + 1;
+    }
+    return end;
+}
+
+bool Dedup::Digest::operator==(const Digest& other) const {
+    return std::memcmp(bytes, other.bytes, sizeof(bytes)) == 0;
+}
+
+size_t Dedup::Store::DigestHash::operator()(const Digest& digest) const {
+    // Already uniformly distributed
+    size_t value;
+    std::memcpy(&value, digest.bytes, sizeof(value));
+    return value;
+}
+
+Dedup::Store::Store()
+    : writable(false), file(), fileOpen(false), end(0), chunks(0), chunkBytes(0), added(0), addedBytes(0),
+      storedBytes(0) {}
+
+Dedup::Store::~Store() {
+    if (fileOpen) FileManager::CloseFile(file);
+}
+
+bool Dedup::Store::Open(const std::string& directory, const BlockFormat::Options& options) {
+    this->directory = directory;
+    writable = options.compress || options.encrypt;
+    indexOptions = options;
+    indexOptions.pool = nullptr;
+    indexOptions.stats = nullptr;
+
+    std::string indexPath = StorePath(directory, IndexName);
+    std::string chunksPath = StorePath(directory, ChunksName);
+    unsigned long long size = 0;
+    if (FileManager::GetFileSize(indexPath, size)) {
+        std::vector<char> content;
+        std::vector<char> text;
+        if (!FileManager::ReadFileContent(indexPath, content) ||
+            !BlockFormat::DecodeBuffer(content.data(), content.size(), text, ForReading(indexOptions), indexPath)) {
+            std::cerr << "Error: cannot read the chunk index " << indexPath
+                      << " (written with another key or options, or damaged)" << std::endl;
+            return false;
+        }
+
+        uint64_t count = text.size() >= kHeaderSize ? Endian::GetU64(text.data() + 8) : 0;
+        if (text.size() < kHeaderSize || std::memcmp(text.data(), kIndexMagic, 4) != 0 ||
+            static_cast<uint8_t>(text[4]) != kVersion || (text.size() - kHeaderSize) / kIndexEntrySize != count ||
+            (text.size() - kHeaderSize) % kIndexEntrySize != 0) {
+            std::cerr << "Error: " << indexPath << " is not a chunk index this version can read" << std::endl;
+            return false;
+        }
+        index.reserve(static_cast<size_t>(count));
+        for (uint64_t i = 0; i < count; ++i) {
+            const char* entry = text.data() + kHeaderSize + i * kIndexEntrySize;
+            Digest digest;
+            std::memcpy(digest.bytes, entry, sizeof(digest.bytes));
+            Location location{Endian::GetU64(entry + 32), Endian::GetU32(entry + 40), Endian::GetU32(entry + 44)};
+            index[digest] = location;
+            end = std::max(end, location.offset + location.length);
+        }
+    } else if (!writable) {
+        std::cerr << "Error: no chunk store in " << directory << std::endl;
+        return false;
+    }
+
+    unsigned long long chunksSize = 0;
+    bool exists = FileManager::GetFileSize(chunksPath, chunksSize);
+    if (end > 0 && (!exists || chunksSize < end)) {
+        std::cerr << "Error: " << chunksPath << " is shorter than its index" << std::endl;
+        return false;
+    }
+
+    if (writable) {
+        // Anything past the indexed chunks was left by a run that never
+        // wrote its index, and nothing refers to it
+        fileOpen = exists ? FileManager::OpenForUpdate(chunksPath, file, end) : FileManager::OpenForWrite(chunksPath, file);
+        if (!fileOpen) std::cerr << "Error opening chunk store: " << chunksPath << std::endl;
+        return fileOpen;
+    }
+    if (end > 0 && !FileManager::OpenView(chunksPath, view, true)) {
+        std::cerr << "Error opening chunk store: " << chunksPath << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool Dedup::Store::Close() {
+    view.Close();
+    if (!writable) return true;
+
+    bool ok = !fileOpen || FileManager::CloseFile(file);
+    fileOpen = false;
+    if (!ok) {
+        std::cerr << "Error writing chunk store in " << directory << std::endl;
+        return false;
+    }
+
+    std::string indexPath = StorePath(directory, IndexName);
+    unsigned long long size = 0;
+    if (added == 0 && FileManager::GetFileSize(indexPath, size)) return true;
+
+    std::vector<char> text(kHeaderSize + index.size() * kIndexEntrySize, 0);
+    std::memcpy(text.data(), kIndexMagic, 4);
+    text[4] = static_cast<char>(kVersion);
+    Endian::PutU64(text.data() + 8, index.size());
+    char* entry = text.data() + kHeaderSize;
+    for (const auto& item : index) {
+        std::memcpy(entry, item.first.bytes, sizeof(item.first.bytes));
+        Endian::PutU64(entry + 32, item.second.offset);
+        Endian::PutU32(entry + 40, item.second.length);
+        Endian::PutU32(entry + 44, item.second.rawSize);
+        entry += kIndexEntrySize;
+    }
+
+    // Written aside and renamed over the old one: a run cut short leaves
+    // the previous index, never half of one
+    std::vector<char> content;
+    std::string temporary = indexPath + ".tmp";
+    if (!BlockFormat::EncodeBuffer(text.data(), text.size(), content, indexOptions) ||
+        !FileManager::WriteFileContent(temporary, content) || !FileManager::RenameFile(temporary, indexPath)) {
+        std::cerr << "Error writing chunk index: " << indexPath << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool Dedup::Store::Add(const Digest& digest, const char* data, size_t size, const BlockFormat::Options& options) {
+    {
+        Concurrency::ScopedLock lock(mutex);
+        chunks++;
+        chunkBytes += size;
+        if (index.count(digest)) return true;
+    }
+
+    // Encoded outside the lock; if another worker stores the same chunk
+    // meanwhile, this copy is dropped
+    std::vector<char> encoded;
+    if (!BlockFormat::EncodeBuffer(data, size, encoded, options)) return false;
+
+    Concurrency::ScopedLock lock(mutex);
+    if (index.count(digest)) return true;
+    if (!fileOpen) return false;
+    Report::Timer timer(options.stats, Report::StageWrite, encoded.size());
+    if (!FileManager::WriteChunk(file, encoded.data(), encoded.size())) {
+        // The file position is now unknown: no more chunks go in
+        std::cerr << "Error writing chunk store in " << directory << std::endl;
+        FileManager::CloseFile(file);
+        fileOpen = false;
+        return false;
+    }
+    index[digest] = Location{end, static_cast<uint32_t>(encoded.size()), static_cast<uint32_t>(size)};
+    end += encoded.size();
+    added++;
+    addedBytes += size;
+    storedBytes += encoded.size();
+    return true;
+}
+
+bool Dedup::Store::Read(const Digest& digest, std::vector<char>& output, const BlockFormat::Options& options) {
+    // Opened for reading, the index no longer changes: no lock needed
+    auto it = index.find(digest);
+    if (it == index.end()) {
+        std::cerr << "Error: chunk missing from the store in " << directory << std::endl;
+        return false;
+    }
+    const Location& location = it->second;
+    std::vector<char> chunk;
+    if (!BlockFormat::DecodeBuffer(view.Data() + location.offset, location.length, chunk, options, ChunksName)) {
+        return false;
+    }
+    if (chunk.size() != location.rawSize) {
+        std::cerr << "Error: damaged chunk in " << StorePath(directory, ChunksName) << std::endl;
+        return false;
+    }
+    output.insert(output.end(), chunk.begin(), chunk.end());
+    return true;
+}
+
+bool Dedup::EncodeFile(const std::string& inputPath, const std::string& recipePath, Store& store,
+                       const BlockFormat::Options& options) {
+    FileManager::FileView view;
+    {
+        Report::Timer timer(options.stats, Report::StageRead, 0);
+        if (!FileManager::OpenView(inputPath, view)) return false;
+        if (!view.IsMapped()) timer.SetBytes(view.Size());
+    }
+
+    // Cutting is sequential but cheap next to hashing and encoding the chunks
+    std::vector<size_t> offsets;
+    {
+        Report::Timer timer(options.stats, Report::StageChecksum, view.Size());
+        offsets.reserve(view.Size() / AverageChunk + 2);
+        for (size_t position = 0; position < view.Size();) {
+            offsets.push_back(position);
+            position += NextChunk(view.Data() + position, view.Size() - position);
+        }
+        offsets.push_back(view.Size());
+    }
+    size_t count = offsets.size() - 1;
+
+    BlockFormat::Options chunkOptions = ForChunks(options);
+    std::vector<Digest> digests(count);
+    std::vector<EncodeJob> jobs;
+    for (size_t first = 0; first < count;) {
+        size_t last = first + 1;
+        while (last < count && offsets[last] - offsets[first] < kJobBytes) last++;
+        jobs.push_back(EncodeJob{view.Data(), &offsets, first, last, &digests, &store, &chunkOptions});
+        first = last;
+    }
+    RunJobs(jobs, EncodeChunksTask, options.pool);
+    for (const EncodeJob& job : jobs) {
+        if (!job.ok) {
+            std::cerr << "Error storing the chunks of " << inputPath << std::endl;
+            return false;
+        }
+    }
+
+    std::vector<char> recipe(kRecipeHeaderSize + count * sizeof(Digest::bytes), 0);
+    std::memcpy(recipe.data(), kRecipeMagic, 4);
+    recipe[4] = static_cast<char>(kVersion);
+    Endian::PutU64(recipe.data() + 8, view.Size());
+    Endian::PutU64(recipe.data() + 16, count);
+    for (size_t i = 0; i < count; ++i) {
+        std::memcpy(recipe.data() + kRecipeHeaderSize + i * sizeof(Digest::bytes), digests[i].bytes,
+                    sizeof(Digest::bytes));
+    }
+
+    std::vector<char> content;
+    if (!BlockFormat::EncodeBuffer(recipe.data(), recipe.size(), content, chunkOptions)) return false;
+    Report::Timer timer(options.stats, Report::StageWrite, content.size());
+    return FileManager::WriteFileContent(recipePath, content);
+}
+
+bool Dedup::DecodeFile(const std::string& recipePath, const std::string& outputPath, Store& store,
+                       const BlockFormat::Options& options) {
+    std::vector<char> content;
+    {
+        Report::Timer timer(options.stats, Report::StageRead, 0);
+        if (!FileManager::ReadFileContent(recipePath, content)) return false;
+        timer.SetBytes(content.size());
+    }
+
+    BlockFormat::Options chunkOptions = ForChunks(options);
+    std::vector<char> recipe;
+    if (!BlockFormat::DecodeBuffer(content.data(), content.size(), recipe, chunkOptions, recipePath)) return false;
+    uint64_t count = recipe.size() >= kRecipeHeaderSize ? Endian::GetU64(recipe.data() + 16) : 0;
+    if (recipe.size() < kRecipeHeaderSize || std::memcmp(recipe.data(), kRecipeMagic, 4) != 0 ||
+        static_cast<uint8_t>(recipe[4]) != kVersion ||
+        (recipe.size() - kRecipeHeaderSize) / sizeof(Digest::bytes) != count ||
+        (recipe.size() - kRecipeHeaderSize) % sizeof(Digest::bytes) != 0) {
+        std::cerr << "Error: " << recipePath << " is not a dedup recipe" << std::endl;
+        return false;
+    }
+    unsigned long long fileSize = Endian::GetU64(recipe.data() + 8);
+
+    std::vector<Digest> digests(static_cast<size_t>(count));
+    for (size_t i = 0; i < digests.size(); ++i) {
+        std::memcpy(digests[i].bytes, recipe.data() + kRecipeHeaderSize + i * sizeof(Digest::bytes),
+                    sizeof(Digest::bytes));
+    }
+
+    FileManager::FileWriter writer;
+    if (!writer.Open(outputPath, fileSize)) return false;
+
+    // Decoded a round of jobs at a time and written in order, so memory
+    // stays at a few jobs' worth whatever the file size
+    size_t perRound = options.pool ? options.pool->WorkerCount() + 1 : 1;
+    unsigned long long written = 0;
+    bool ok = true;
+    for (size_t first = 0; ok && first < digests.size();) {
+        std::vector<DecodeJob> jobs;
+        for (size_t j = 0; j < perRound && first < digests.size(); ++j) {
+            size_t chunksInJob = std::min(kJobChunks, digests.size() - first);
+            jobs.push_back(DecodeJob{&digests[first], chunksInJob, &store, &chunkOptions, {}, true});
+            first += chunksInJob;
+        }
+        RunJobs(jobs, DecodeChunksTask, options.pool);
+        for (const DecodeJob& job : jobs) {
+            Report::Timer timer(options.stats, Report::StageWrite, job.output.size());
+            if (!job.ok || !writer.Write(job.output.data(), job.output.size())) {
+                ok = false;
+                break;
+            }
+            written += job.output.size();
+        }
+    }
+    if (ok && written != fileSize) {
+        std::cerr << "Error: " << recipePath << " does not add up to its file size" << std::endl;
+        ok = false;
+    }
+
+    {
+        Report::Timer timer(options.stats, Report::StageWrite, 0);
+        if (!writer.Finish()) ok = false;
+    }
+    if (!ok) FileManager::RemoveFile(outputPath);
+    return ok;
+}
@@ -0,0 +1,132 @@
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "BlockFormat.h"
+#include "Checksum.h"
+#include "Concurrency.h"
+#include "FileManager.h"
+
+// Deduplicated output (--dedup). Inputs are cut into content-defined chunks
+// and each distinct chunk is compressed, encrypted and stored once in a
+// chunk store shared by every file of the output directory; each input
+// becomes a recipe listing its chunks in order. Rotated copies of a log, or
+// the same file on several nodes, cost little more than their recipes.
+//
+// Chunk boundaries come from a Gear rolling hash with FastCDC's normalized
+// chunking: no cut in the first MinChunk bytes, a strict mask up to
+// AverageChunk, a loose one after it, and a forced cut at MaxChunk. A cut
+// depends only on the 64 bytes before it, so an insertion shifts the
+// boundaries near it and the chunks after it are found again unchanged.
+// Chunks are named by their SHA-256.
+//
+// Store, in the output directory:
+//   .so_chunks  every stored chunk, each a block container of its own
+//               (BlockFormat::EncodeBuffer, so a fresh nonce per chunk);
+//               new chunks are appended, nothing is rewritten
+//   .so_index   block container holding "SODI", version, count and, per
+//               chunk, SHA-256, offset and length in .so_chunks and raw size
+//
+// A recipe is a block container named like the output of the input
+// (BuildOutputPath) holding "SODR", version, file size, chunk count and the
+// chunks' SHA-256 in order. The index and the recipes are encrypted like
+// the chunks, so the store does not show which chunks a file contains
+// without the key. All integers are little-endian.
+class Dedup {
+public:
+    static constexpr size_t MinChunk = 4 << 10;
+    static constexpr size_t AverageChunk = 16 << 10;
+    static constexpr size_t MaxChunk = 64 << 10;
+
+    static const char* const ChunksName;
+    static const char* const IndexName;
+
+    // True for the store's own files, which a directory walk must skip
+    static bool IsStoreFile(const std::string& path);
+
+    // Length of the chunk starting at data (at most size bytes)
+    static size_t NextChunk(const char* data, size_t size);
+
+    struct Digest {
+        unsigned char bytes[Checksum::Sha256Size];
+        bool operator==(const Digest& other) const;
+    };
+
+    // The chunk store of one directory. Open it before any file is encoded
+    // or decoded and Close it once they are all done; in between it is
+    // shared by every worker.
+    class Store {
+    public:
+        Store();
+        ~Store();
+
+        // Load the index. With options.compress or options.encrypt the store
+        // is opened for adding chunks (and created if missing); otherwise
+        // the chunks are mapped for reading. False if the index cannot be
+        // decoded (another key, or damage) or the chunks file is shorter
+        // than the index says.
+        bool Open(const std::string& directory, const BlockFormat::Options& options);
+
+        // Write the index for the chunks added since Open; a store opened
+        // for reading just closes
+        bool Close();
+
+        // Make sure the chunk is stored: encode and append it unless a chunk
+        // with the same digest is already there
+        bool Add(const Digest& digest, const char* data, size_t size, const BlockFormat::Options& options);
+
+        // Decode a stored chunk, appending it to output
+        bool Read(const Digest& digest, std::vector<char>& output, const BlockFormat::Options& options);
+
+        // Run totals, for the summary line
+        unsigned long long ChunkCount() const { return chunks; }
+        unsigned long long ChunkBytes() const { return chunkBytes; }
+        unsigned long long NewCount() const { return added; }
+        unsigned long long NewBytes() const { return addedBytes; }
+        unsigned long long StoredBytes() const { return storedBytes; }
+
+    private:
+        Store(const Store&) = delete;
+        Store& operator=(const Store&) = delete;
+
+        struct Location {
+            unsigned long long offset;
+            uint32_t length;  // Of the chunk's container in .so_chunks
+            uint32_t rawSize;
+        };
+
+        struct DigestHash {
+            size_t operator()(const Digest& digest) const;
+        };
+
+        std::string directory;
+        BlockFormat::Options indexOptions; // How the index is written and read
+        bool writable;
+        Concurrency::Mutex mutex; // Guards everything below once workers run
+        std::unordered_map<Digest, Location, DigestHash> index;
+        FileManager::NativeFile file;  // .so_chunks, open for appending
+        bool fileOpen;
+        unsigned long long end;        // Where the next chunk goes
+        FileManager::FileView view;    // .so_chunks, when reading
+        unsigned long long chunks;
+        unsigned long long chunkBytes;
+        unsigned long long added;
+        unsigned long long addedBytes;
+        unsigned long long storedBytes;
+    };
+
+    // Chunk an input into the store and write its recipe. The chunks of a
+    // large file are hashed and encoded across options.pool.
+    static bool EncodeFile(const std::string& inputPath, const std::string& recipePath, Store& store,
+                           const BlockFormat::Options& options);
+
+    // Rebuild a file from its recipe
+    static bool DecodeFile(const std::string& recipePath, const std::string& outputPath, Store& store,
+                           const BlockFormat::Options& options);
+};
+
+#endif // DEDUP_H
@@ -1,25 +1,260 @@
 #include "Encryption.h"
+#include "Checksum.h"
+#include "Concurrency.h"
+#include "CpuFeatures.h"
+#include "Endian.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <random>
 
-std::vector<char> Encryption::EncryptVigenere(const std::vector<char>& data, const std::string& key) {
-    if (key.empty()) return data;
-    std::vector<char> encrypted = data;
-    size_t keyLen = key.length();
-    
-    for (size_t i = 0; i < data.size(); ++i) {
-        // Simple addition modulo 256
-        encrypted[i] = static_cast<char>(data[i] + key[i % keyLen]);
+#ifdef CPU_FEATURES_X86
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// Widest step a kernel takes; the key pattern is this much longer than the key
+const size_t kMaxStep = 64;
+
+// The key written out as many times as needed so that any kMaxStep-byte
+// window starting inside the first copy can be loaded in one go. The key
+// byte for stream position p is then pattern[p % keyLen], and a whole
+// vector of key bytes is a single unaligned load at that phase.
+std::vector<char> ExpandKey(const std::string& key) {
+    std::vector<char> pattern(key.size() + kMaxStep);
+    for (size_t i = 0; i < pattern.size(); ++i) {
+        pattern[i] = key[i % key.size()];
     }
-    return encrypted;
+    return pattern;
+}
+
+// out[i] = in[i] +/- key byte; in and out may be the same buffer
+typedef void (*Kernel)(const char* in, char* out, size_t size, const char* pattern, size_t keyLen, size_t phase);
+
+template <bool Subtract>
+void VigenereScalar(const char* in, char* out, size_t size, const char* pattern, size_t keyLen, size_t phase) {
+    for (size_t i = 0; i < size; ++i) {
+        // Simple addition/subtraction modulo 256
+        out[i] = static_cast<char>(Subtract ? in[i] - pattern[phase] : in[i] + pattern[phase]);
+        if (++phase == keyLen) phase = 0;
+    }
+}
+
+#ifdef CPU_FEATURES_X86
+template <bool Subtract>
+__attribute__((target("sse2")))
+void VigenereSSE2(const char* in, char* out, size_t size, const char* pattern, size_t keyLen, size_t phase) {
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        __m128i k = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pattern + phase));
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        v = Subtract ? _mm_sub_epi8(v, k) : _mm_add_epi8(v, k);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), v);
+        phase = (phase + 16) % keyLen;
+    }
+    VigenereScalar<Subtract>(in + i, out + i, size - i, pattern, keyLen, phase);
+}
+
+template <bool Subtract>
+__attribute__((target("avx2")))
+void VigenereAVX2(const char* in, char* out, size_t size, const char* pattern, size_t keyLen, size_t phase) {
+    size_t i = 0;
+    // 64 bytes per step: two independent vectors keep both ports busy
+    for (; i + 64 <= size; i += 64) {
+        __m256i k0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pattern + phase));
+        __m256i k1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pattern + phase + 32));
+        __m256i v0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+        __m256i v1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i + 32));
+        v0 = Subtract ? _mm256_sub_epi8(v0, k0) : _mm256_add_epi8(v0, k0);
+        v1 = Subtract ? _mm256_sub_epi8(v1, k1) : _mm256_add_epi8(v1, k1);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), v0);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i + 32), v1);
+        phase = (phase + 64) % keyLen;
+    }
+    VigenereSSE2<Subtract>(in + i, out + i, size - i, pattern, keyLen, phase);
+}
+#endif
+
+// Best kernel for this processor, picked on first use
+template <bool Subtract>
+Kernel SelectKernel() {
+#ifdef CPU_FEATURES_X86
+    if (CpuFeatures::HasAVX2()) return VigenereAVX2<Subtract>;
+    if (CpuFeatures::HasSSE2()) return VigenereSSE2<Subtract>;
+#endif
+    return VigenereScalar<Subtract>;
+}
+
+template <bool Subtract>
+void Apply(const char* in, char* out, size_t size, const std::string& key, unsigned long long offset) {
+    static const Kernel kernel = SelectKernel<Subtract>();
+    if (size == 0) return;
+    if (key.empty()) {
+        if (in != out) std::copy(in, in + size, out);
+        return;
+    }
+    std::vector<char> pattern = ExpandKey(key);
+    kernel(in, out, size, pattern.data(), key.size(), static_cast<size_t>(offset % key.size()));
+}
+
+// Salt of the stretched passphrase. Fixed, so it is stretched once per run
+// rather than once per container; each container's key is then salted
+// with its nonce (see FileKey).
+const char kKdfSalt[] = "so_final container key";
+
+// HMAC-SHA256 (RFC 2104) under one key. The padded key blocks are hashed
+// once, so each message costs only its own compressions plus two.
+class HmacSha256 {
+public:
+    HmacSha256(const char* key, size_t size) {
+        unsigned char block[64] = {0};
+        if (size > sizeof(block)) Checksum::Sha256(key, size, block);
+        else if (size > 0) std::memcpy(block, key, size);
+
+        char pad[64];
+        for (size_t i = 0; i < sizeof(pad); ++i) pad[i] = static_cast<char>(block[i] ^ 0x36);
+        inner.Update(pad, sizeof(pad));
+        for (size_t i = 0; i < sizeof(pad); ++i) pad[i] = static_cast<char>(block[i] ^ 0x5c);
+        outer.Update(pad, sizeof(pad));
+    }
+
+    // mac may be the same buffer as message
+    void Mac(const unsigned char* message, size_t size, unsigned char mac[Checksum::Sha256Size]) const {
+        Checksum::Sha256Hasher hasher = inner;
+        hasher.Update(reinterpret_cast<const char*>(message), size);
+        unsigned char digest[Checksum::Sha256Size];
+        hasher.Digest(digest);
+        hasher = outer;
+        hasher.Update(reinterpret_cast<const char*>(digest), sizeof(digest));
+        hasher.Digest(mac);
+    }
+
+private:
+    Checksum::Sha256Hasher inner;
+    Checksum::Sha256Hasher outer;
+};
+
+} // namespace
+
+bool Encryption::ParseCipher(const std::string& name, Cipher& cipher) {
+    if (name == "vigenere") cipher = CipherVigenere;
+    else if (name == "aes128") cipher = CipherAES128;
+    else if (name == "aes256") cipher = CipherAES256;
+    else if (name == "chacha20") cipher = CipherChaCha20;
+    else return false;
+    return true;
 }
 
-std::vector<char> Encryption::DecryptVigenere(const std::vector<char>& data, const std::string& key) {
-    if (key.empty()) return data;
-    std::vector<char> decrypted = data;
-    size_t keyLen = key.length();
+const char* Encryption::CipherName(Cipher cipher) {
+    switch (cipher) {
+    case CipherAES128: return "aes128";
+    case CipherAES256: return "aes256";
+    case CipherChaCha20: return "chacha20";
+    case CipherVigenere:
+    default: return "vigenere";
+    }
+}
+
+bool Encryption::UsesNonce(Cipher cipher) {
+    return cipher == CipherAES128 || cipher == CipherAES256 || cipher == CipherChaCha20;
+}
 
-    for (size_t i = 0; i < data.size(); ++i) {
-        // Simple subtraction modulo 256
-        decrypted[i] = static_cast<char>(data[i] - key[i % keyLen]);
+uint64_t Encryption::NewNonce() {
+    // Some random_device implementations are deterministic (older MinGW),
+    // so the clock is mixed in as well
+    std::random_device device;
+    uint64_t nonce = (static_cast<uint64_t>(device()) << 32) ^ device();
+    uint64_t now = static_cast<uint64_t>(std::chrono::high_resolution_clock::now().time_since_epoch().count());
+    return nonce ^ (now * 0x9E3779B97F4A7C15ull);
+}
+
+void Encryption::Pbkdf2Sha256(const std::string& passphrase, const char* salt, size_t saltSize,
+                              unsigned iterations, unsigned char key[KeySize]) {
+    // A single output block (i = 1): the key is exactly one digest long
+    HmacSha256 hmac(passphrase.data(), passphrase.size());
+    std::vector<unsigned char> first(salt, salt + saltSize);
+    first.insert(first.end(), {0, 0, 0, 1});
+    unsigned char u[KeySize];
+    hmac.Mac(first.data(), first.size(), u);
+    std::memcpy(key, u, sizeof(u));
+    for (unsigned i = 1; i < iterations; ++i) {
+        hmac.Mac(u, sizeof(u), u);
+        for (size_t j = 0; j < sizeof(u); ++j) key[j] ^= u[j];
     }
+}
+
+std::string Encryption::FileKey(const std::string& passphrase, uint64_t nonce) {
+    // Every container of a run shares the stretched passphrase: computed by
+    // the first worker that asks, the others wait for it
+    static Concurrency::Mutex mutex;
+    static std::map<std::string, std::string> stretched;
+    std::string master;
+    {
+        Concurrency::ScopedLock lock(mutex);
+        auto it = stretched.find(passphrase);
+        if (it == stretched.end()) {
+            unsigned char key[KeySize];
+            Pbkdf2Sha256(passphrase, kKdfSalt, sizeof(kKdfSalt) - 1, KdfIterations, key);
+            it = stretched.emplace(passphrase, std::string(reinterpret_cast<char*>(key), sizeof(key))).first;
+        }
+        master = it->second;
+    }
+
+    char salt[8];
+    Endian::PutU64(salt, nonce);
+    unsigned char key[KeySize];
+    HmacSha256(master.data(), master.size()).Mac(reinterpret_cast<unsigned char*>(salt), sizeof(salt), key);
+    return std::string(reinterpret_cast<char*>(key), sizeof(key));
+}
+
+void Encryption::Encrypt(Cipher cipher, const char* in, char* out, size_t size, const std::string& key,
+                         uint64_t nonce, unsigned long long offset) {
+    switch (cipher) {
+    case CipherAES128: AesCtr(in, out, size, key, 128, nonce, offset); break;
+    case CipherAES256: AesCtr(in, out, size, key, 256, nonce, offset); break;
+    case CipherChaCha20: ChaCha20(in, out, size, key, nonce, offset); break;
+    case CipherVigenere:
+    default: Apply<false>(in, out, size, key, offset); break;
+    }
+}
+
+void Encryption::Decrypt(Cipher cipher, const char* in, char* out, size_t size, const std::string& key,
+                         uint64_t nonce, unsigned long long offset) {
+    switch (cipher) {
+    case CipherAES128: AesCtr(in, out, size, key, 128, nonce, offset); break;
+    case CipherAES256: AesCtr(in, out, size, key, 256, nonce, offset); break;
+    case CipherChaCha20: ChaCha20(in, out, size, key, nonce, offset); break;
+    case CipherVigenere:
+    default: Apply<true>(in, out, size, key, offset); break;
+    }
+}
+
+std::vector<char> Encryption::EncryptVigenere(const std::vector<char>& data, const std::string& key, unsigned long long offset) {
+    return EncryptVigenere(data.data(), data.size(), key, offset);
+}
+
+std::vector<char> Encryption::DecryptVigenere(const std::vector<char>& data, const std::string& key, unsigned long long offset) {
+    return DecryptVigenere(data.data(), data.size(), key, offset);
+}
+
+std::vector<char> Encryption::EncryptVigenere(const char* data, size_t size, const std::string& key, unsigned long long offset) {
+    std::vector<char> encrypted(size);
+    Apply<false>(data, encrypted.data(), size, key, offset);
+    return encrypted;
+}
+
+std::vector<char> Encryption::DecryptVigenere(const char* data, size_t size, const std::string& key, unsigned long long offset) {
+    std::vector<char> decrypted(size);
+    Apply<true>(data, decrypted.data(), size, key, offset);
     return decrypted;
 }
+
+void Encryption::EncryptVigenereInPlace(char* data, size_t size, const std::string& key, unsigned long long offset) {
+    Apply<false>(data, data, size, key, offset);
+}
+
+void Encryption::DecryptVigenereInPlace(char* data, size_t size, const std::string& key, unsigned long long offset) {
+    Apply<true>(data, data, size, key, offset);
+}
@@ -3,12 +3,87 @@
 
 #include <vector>
 #include <string>
+#include <cstddef>
+#include <cstdint>
 
 class Encryption {
 public:
-    // Vigenère Cipher
-    static std::vector<char> EncryptVigenere(const std::vector<char>& data, const std::string& key);
-    static std::vector<char> DecryptVigenere(const std::vector<char>& data, const std::string& key);
+    // Ciphers selectable with --enc-alg
+    enum Cipher {
+        CipherVigenere, // "vigenere": byte-wise addition of the key, the original cipher
+        CipherAES128,   // "aes128": AES-128 in counter mode
+        CipherAES256,   // "aes256": AES-256 in counter mode
+        CipherChaCha20  // "chacha20": the ChaCha20 stream cipher
+    };
+
+    // Map an --enc-alg name to its cipher; false if unknown
+    static bool ParseCipher(const std::string& name, Cipher& cipher);
+    static const char* CipherName(Cipher cipher);
+
+    // Whether the cipher needs a per-file nonce (see NewNonce)
+    static bool UsesNonce(Cipher cipher);
+
+    // A fresh random nonce for one file
+    static uint64_t NewNonce();
+
+    // Key derivation for AES and ChaCha20 in block containers. One SHA-256
+    // of the passphrase would let an attacker try passphrases at hash speed;
+    // instead the passphrase is stretched with PBKDF2-HMAC-SHA256
+    // (KdfIterations rounds, a fixed salt) once per run, and each
+    // container's key is the HMAC-SHA256 of its nonce under the stretched
+    // key. The stretch is not salted per container: with one container
+    // per file, it would run thousands of times per directory.
+    static constexpr size_t KeySize = 32;
+    static constexpr unsigned KdfIterations = 100000;
+    static std::string FileKey(const std::string& passphrase, uint64_t nonce);
+
+    // PBKDF2 (RFC 8018) with HMAC-SHA256, one 32-byte output block
+    static void Pbkdf2Sha256(const std::string& passphrase, const char* salt, size_t saltSize, unsigned iterations,
+                             unsigned char key[KeySize]);
+
+    // Run the selected cipher from in to out (which may be the same
+    // buffer). offset is the position of in[0] in the whole stream, and
+    // nonce is ignored by ciphers that do not use one.
+    static void Encrypt(Cipher cipher, const char* in, char* out, size_t size, const std::string& key,
+                        uint64_t nonce, unsigned long long offset);
+    static void Decrypt(Cipher cipher, const char* in, char* out, size_t size, const std::string& key,
+                        uint64_t nonce, unsigned long long offset);
+
+    // Vigenère Cipher. The key is expanded into a repeating pattern and
+    // applied 16 or 64 bytes per step (SSE2/AVX2, chosen at run time via
+    // CpuFeatures), with a byte loop for other processors and the tail.
+    // offset is the position of data[0] in the whole stream, so a file can be
+    // processed in chunks and still use the same key byte for every position.
+    static std::vector<char> EncryptVigenere(const std::vector<char>& data, const std::string& key, unsigned long long offset = 0);
+    static std::vector<char> DecryptVigenere(const std::vector<char>& data, const std::string& key, unsigned long long offset = 0);
+
+    // Same, reading straight from memory the caller owns (e.g. a mapped file)
+    static std::vector<char> EncryptVigenere(const char* data, size_t size, const std::string& key, unsigned long long offset = 0);
+    static std::vector<char> DecryptVigenere(const char* data, size_t size, const std::string& key, unsigned long long offset = 0);
+
+    // Same, overwriting a buffer the caller already owns instead of copying it
+    static void EncryptVigenereInPlace(char* data, size_t size, const std::string& key, unsigned long long offset = 0);
+    static void DecryptVigenereInPlace(char* data, size_t size, const std::string& key, unsigned long long offset = 0);
+
+    // AES in counter mode (EncryptionAES.cpp), so encrypting and decrypting
+    // are the same operation. The AES key is the SHA-256 of `key` (its
+    // first 16 bytes for AES-128); containers pass FileKey's result.
+    // Counter block n of the stream is the nonce in its first 8 bytes
+    // (little-endian) and n in the last 8 (big-endian); n is offset / 16,
+    // so any position can be processed on its own. Uses AES-NI, eight
+    // blocks at a time, when the processor has it, and lookup tables
+    // otherwise.
+    static void AesCtr(const char* in, char* out, size_t size, const std::string& key, unsigned keyBits,
+                       uint64_t nonce, unsigned long long offset);
+
+    // ChaCha20 (EncryptionChaCha.cpp) in Bernstein's original layout, with
+    // a 64-bit block counter and a 64-bit nonce; like AesCtr it is its own
+    // inverse. The 256-bit key is the SHA-256 of `key`, as for AesCtr, and the
+    // counter of the 64-byte block holding a position is offset / 64.
+    // Computes eight blocks at a time with AVX2 or four with SSE2, so it
+    // stays fast on processors without AES-NI.
+    static void ChaCha20(const char* in, char* out, size_t size, const std::string& key, uint64_t nonce,
+                         unsigned long long offset);
 };
 
 #endif // ENCRYPTION_H
@@ -0,0 +1,247 @@
+#include "Encryption.h"
+#include "Checksum.h"
+#include "CpuFeatures.h"
+#include <cstring>
+
+#ifdef CPU_FEATURES_X86
+#include <immintrin.h>
+#endif
+
+// AES-128/256 in counter mode (FIPS 197, SP 800-38A). See Encryption.h for
+// the counter block layout.
+
+namespace {
+
+const size_t kBlockSize = 16;
+const unsigned kMaxRounds = 14;
+
+// Round keys in FIPS 197 byte order, which is also what AES-NI expects
+struct KeySchedule {
+    unsigned rounds;
+    unsigned char bytes[(kMaxRounds + 1) * kBlockSize];
+};
+
+uint8_t Mul2(uint8_t x) {
+    return static_cast<uint8_t>((x << 1) ^ ((x & 0x80) ? 0x1B : 0));
+}
+
+uint32_t Rotr8(uint32_t x) {
+    return (x >> 8) | (x << 24);
+}
+
+// S-box and the four encryption T-tables, computed once: each T-table
+// entry is a column of SubBytes + MixColumns for one input byte
+struct Tables {
+    uint8_t sbox[256];
+    uint32_t te[4][256];
+
+    Tables() {
+        // Walk the multiplicative group with generator 3 to get inverses
+        uint8_t p = 1, q = 1;
+        sbox[0] = 0x63;
+        do {
+            p = static_cast<uint8_t>(p ^ Mul2(p));  // p *= 3
+            q ^= static_cast<uint8_t>(q << 1);      // q /= 3
+            q ^= static_cast<uint8_t>(q << 2);
+            q ^= static_cast<uint8_t>(q << 4);
+            if (q & 0x80) q ^= 0x09;
+            uint8_t x = static_cast<uint8_t>(q ^ Rotl8(q, 1) ^ Rotl8(q, 2) ^ Rotl8(q, 3) ^ Rotl8(q, 4));
+            sbox[p] = static_cast<uint8_t>(x ^ 0x63);
+        } while (p != 1);
+
+        for (unsigned i = 0; i < 256; ++i) {
+            uint8_t s = sbox[i];
+            uint8_t s2 = Mul2(s);
+            uint8_t s3 = static_cast<uint8_t>(s2 ^ s);
+            te[0][i] = (uint32_t(s2) << 24) | (uint32_t(s) << 16) | (uint32_t(s) << 8) | s3;
+            te[1][i] = Rotr8(te[0][i]);
+            te[2][i] = Rotr8(te[1][i]);
+            te[3][i] = Rotr8(te[2][i]);
+        }
+    }
+
+    static uint8_t Rotl8(uint8_t x, unsigned n) {
+        return static_cast<uint8_t>((x << n) | (x >> (8 - n)));
+    }
+};
+
+const Tables& GetTables() {
+    static const Tables tables;
+    return tables;
+}
+
+uint32_t LoadBE32(const unsigned char* p) {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+}
+
+void StoreBE32(unsigned char* p, uint32_t v) {
+    p[0] = static_cast<unsigned char>(v >> 24);
+    p[1] = static_cast<unsigned char>(v >> 16);
+    p[2] = static_cast<unsigned char>(v >> 8);
+    p[3] = static_cast<unsigned char>(v);
+}
+
+// FIPS 197 key expansion for 16- or 32-byte keys
+void ExpandKey(const unsigned char* key, unsigned keyBytes, KeySchedule& schedule) {
+    const Tables& t = GetTables();
+    const unsigned nk = keyBytes / 4;
+    schedule.rounds = nk + 6;
+    const unsigned words = 4 * (schedule.rounds + 1);
+
+    uint32_t w[4 * (kMaxRounds + 1)];
+    for (unsigned i = 0; i < nk; ++i) w[i] = LoadBE32(key + 4 * i);
+    uint32_t rcon = 1;
+    for (unsigned i = nk; i < words; ++i) {
+        uint32_t temp = w[i - 1];
+        if (i % nk == 0) {
+            temp = (temp << 8) | (temp >> 24); // RotWord
+            temp = (uint32_t(t.sbox[temp >> 24]) << 24) | (uint32_t(t.sbox[(temp >> 16) & 255]) << 16) |
+                   (uint32_t(t.sbox[(temp >> 8) & 255]) << 8) | t.sbox[temp & 255];
+            temp ^= rcon << 24;
+            rcon = Mul2(static_cast<uint8_t>(rcon));
+        } else if (nk > 6 && i % nk == 4) {
+            temp = (uint32_t(t.sbox[temp >> 24]) << 24) | (uint32_t(t.sbox[(temp >> 16) & 255]) << 16) |
+                   (uint32_t(t.sbox[(temp >> 8) & 255]) << 8) | t.sbox[temp & 255];
+        }
+        w[i] = w[i - nk] ^ temp;
+    }
+    for (unsigned i = 0; i < words; ++i) StoreBE32(schedule.bytes + 4 * i, w[i]);
+}
+
+// Counter block n: the nonce's 8 bytes, then n big-endian
+void CounterBlock(uint64_t nonce, uint64_t n, unsigned char* block) {
+    for (int i = 0; i < 8; ++i) {
+        block[i] = static_cast<unsigned char>(nonce >> (8 * i));
+        block[8 + i] = static_cast<unsigned char>(n >> (56 - 8 * i));
+    }
+}
+
+// One block through the T-tables
+void EncryptBlockTables(const KeySchedule& schedule, const unsigned char* in, unsigned char* out) {
+    const Tables& t = GetTables();
+    const unsigned char* rk = schedule.bytes;
+    uint32_t s0 = LoadBE32(in) ^ LoadBE32(rk);
+    uint32_t s1 = LoadBE32(in + 4) ^ LoadBE32(rk + 4);
+    uint32_t s2 = LoadBE32(in + 8) ^ LoadBE32(rk + 8);
+    uint32_t s3 = LoadBE32(in + 12) ^ LoadBE32(rk + 12);
+
+    for (unsigned round = 1; round < schedule.rounds; ++round) {
+        rk += kBlockSize;
+        uint32_t t0 = t.te[0][s0 >> 24] ^ t.te[1][(s1 >> 16) & 255] ^ t.te[2][(s2 >> 8) & 255] ^ t.te[3][s3 & 255];
+        uint32_t t1 = t.te[0][s1 >> 24] ^ t.te[1][(s2 >> 16) & 255] ^ t.te[2][(s3 >> 8) & 255] ^ t.te[3][s0 & 255];
+        uint32_t t2 = t.te[0][s2 >> 24] ^ t.te[1][(s3 >> 16) & 255] ^ t.te[2][(s0 >> 8) & 255] ^ t.te[3][s1 & 255];
+        uint32_t t3 = t.te[0][s3 >> 24] ^ t.te[1][(s0 >> 16) & 255] ^ t.te[2][(s1 >> 8) & 255] ^ t.te[3][s2 & 255];
+        s0 = t0 ^ LoadBE32(rk);
+        s1 = t1 ^ LoadBE32(rk + 4);
+        s2 = t2 ^ LoadBE32(rk + 8);
+        s3 = t3 ^ LoadBE32(rk + 12);
+    }
+
+    // Last round: no MixColumns
+    rk += kBlockSize;
+    const uint8_t* sb = t.sbox;
+    uint32_t states[4] = {s0, s1, s2, s3};
+    for (int c = 0; c < 4; ++c) {
+        uint32_t v = (uint32_t(sb[states[c] >> 24]) << 24) | (uint32_t(sb[(states[(c + 1) & 3] >> 16) & 255]) << 16) |
+                     (uint32_t(sb[(states[(c + 2) & 3] >> 8) & 255]) << 8) | sb[states[(c + 3) & 3] & 255];
+        StoreBE32(out + 4 * c, v ^ LoadBE32(rk + 4 * c));
+    }
+}
+
+// out = in ^ keystream for `blocks` whole blocks starting at counter n
+typedef void (*Kernel)(const KeySchedule& schedule, uint64_t nonce, uint64_t n, const char* in, char* out,
+                       size_t blocks);
+
+void CtrTables(const KeySchedule& schedule, uint64_t nonce, uint64_t n, const char* in, char* out, size_t blocks) {
+    unsigned char counter[kBlockSize];
+    unsigned char stream[kBlockSize];
+    for (size_t b = 0; b < blocks; ++b) {
+        CounterBlock(nonce, n + b, counter);
+        EncryptBlockTables(schedule, counter, stream);
+        for (size_t i = 0; i < kBlockSize; ++i) {
+            out[b * kBlockSize + i] = static_cast<char>(in[b * kBlockSize + i] ^ stream[i]);
+        }
+    }
+}
+
+#ifdef CPU_FEATURES_X86
+// Eight independent counter blocks per step keep the AES unit's pipeline
+// full; a single block would wait on each round's latency
+__attribute__((target("aes,sse2")))
+void CtrAESNI(const KeySchedule& schedule, uint64_t nonce, uint64_t n, const char* in, char* out, size_t blocks) {
+    const unsigned rounds = schedule.rounds;
+    __m128i rk[kMaxRounds + 1];
+    for (unsigned r = 0; r <= rounds; ++r) {
+        rk[r] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(schedule.bytes + r * kBlockSize));
+    }
+    const long long low = static_cast<long long>(nonce);
+
+    size_t b = 0;
+    for (; b + 8 <= blocks; b += 8) {
+        __m128i x[8];
+        for (int j = 0; j < 8; ++j) {
+            x[j] = _mm_set_epi64x(static_cast<long long>(__builtin_bswap64(n + b + j)), low);
+            x[j] = _mm_xor_si128(x[j], rk[0]);
+        }
+        for (unsigned r = 1; r < rounds; ++r) {
+            for (int j = 0; j < 8; ++j) x[j] = _mm_aesenc_si128(x[j], rk[r]);
+        }
+        for (int j = 0; j < 8; ++j) {
+            x[j] = _mm_aesenclast_si128(x[j], rk[rounds]);
+            const __m128i* src = reinterpret_cast<const __m128i*>(in + (b + j) * kBlockSize);
+            __m128i* dst = reinterpret_cast<__m128i*>(out + (b + j) * kBlockSize);
+            _mm_storeu_si128(dst, _mm_xor_si128(x[j], _mm_loadu_si128(src)));
+        }
+    }
+    for (; b < blocks; ++b) {
+        __m128i x = _mm_set_epi64x(static_cast<long long>(__builtin_bswap64(n + b)), low);
+        x = _mm_xor_si128(x, rk[0]);
+        for (unsigned r = 1; r < rounds; ++r) x = _mm_aesenc_si128(x, rk[r]);
+        x = _mm_aesenclast_si128(x, rk[rounds]);
+        const __m128i* src = reinterpret_cast<const __m128i*>(in + b * kBlockSize);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + b * kBlockSize), _mm_xor_si128(x, _mm_loadu_si128(src)));
+    }
+}
+#endif
+
+Kernel SelectKernel() {
+#ifdef CPU_FEATURES_X86
+    if (CpuFeatures::HasAESNI()) return CtrAESNI;
+#endif
+    return CtrTables;
+}
+
+} // namespace
+
+void Encryption::AesCtr(const char* in, char* out, size_t size, const std::string& key, unsigned keyBits,
+                        uint64_t nonce, unsigned long long offset) {
+    static const Kernel kernel = SelectKernel();
+    if (size == 0) return;
+
+    unsigned char digest[Checksum::Sha256Size];
+    Checksum::Sha256(key.data(), key.size(), digest);
+    KeySchedule schedule;
+    ExpandKey(digest, keyBits == 256 ? 32 : 16, schedule);
+
+    uint64_t n = offset / kBlockSize;
+    size_t skip = static_cast<size_t>(offset % kBlockSize);
+    size_t done = 0;
+
+    // Leading partial block, when offset is not block-aligned
+    if (skip) {
+        char stream[kBlockSize] = {0};
+        kernel(schedule, nonce, n++, stream, stream, 1);
+        for (; skip < kBlockSize && done < size; ++skip, ++done) out[done] = static_cast<char>(in[done] ^ stream[skip]);
+    }
+
+    size_t blocks = (size - done) / kBlockSize;
+    kernel(schedule, nonce, n, in + done, out + done, blocks);
+    n += blocks;
+    done += blocks * kBlockSize;
+
+    if (done < size) {
+        char stream[kBlockSize] = {0};
+        kernel(schedule, nonce, n, stream, stream, 1);
+        for (size_t i = 0; done < size; ++i, ++done) out[done] = static_cast<char>(in[done] ^ stream[i]);
+    }
+}
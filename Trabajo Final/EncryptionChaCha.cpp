@@ -0,0 +1,261 @@
+#include "Encryption.h"
+#include "Checksum.h"
+#include "CpuFeatures.h"
+#include <cstring>
+
+#ifdef CPU_FEATURES_X86
+#include <immintrin.h>
+#endif
+
+// ChaCha20 (Bernstein's original layout: 64-bit block counter, 64-bit
+// nonce). See Encryption.h for how the stream is positioned.
+
+namespace {
+
+const size_t kBlockSize = 64;
+
+// Initial state of every block: constants, key, counter and nonce words
+struct State {
+    uint32_t words[16];
+
+    State(const unsigned char* key, uint64_t nonce) {
+        words[0] = 0x61707865; // "expand 32-byte k"
+        words[1] = 0x3320646e;
+        words[2] = 0x79622d32;
+        words[3] = 0x6b206574;
+        for (int i = 0; i < 8; ++i) {
+            words[4 + i] = uint32_t(key[4 * i]) | (uint32_t(key[4 * i + 1]) << 8) |
+                           (uint32_t(key[4 * i + 2]) << 16) | (uint32_t(key[4 * i + 3]) << 24);
+        }
+        words[12] = 0;
+        words[13] = 0;
+        words[14] = static_cast<uint32_t>(nonce);
+        words[15] = static_cast<uint32_t>(nonce >> 32);
+    }
+};
+
+uint32_t Rotl(uint32_t x, unsigned n) {
+    return (x << n) | (x >> (32 - n));
+}
+
+#define CHACHA_QUARTER(a, b, c, d)          \
+    a += b; d ^= a; d = Rotl(d, 16);        \
+    c += d; b ^= c; b = Rotl(b, 12);        \
+    a += b; d ^= a; d = Rotl(d, 8);         \
+    c += d; b ^= c; b = Rotl(b, 7);
+
+// Keystream block n, serialized little-endian
+void Block(const State& state, uint64_t n, unsigned char* out) {
+    uint32_t x[16];
+    std::memcpy(x, state.words, sizeof(x));
+    x[12] = static_cast<uint32_t>(n);
+    x[13] = static_cast<uint32_t>(n >> 32);
+    uint32_t initial12 = x[12], initial13 = x[13];
+
+    for (int round = 0; round < 10; ++round) {
+        CHACHA_QUARTER(x[0], x[4], x[8], x[12]);
+        CHACHA_QUARTER(x[1], x[5], x[9], x[13]);
+        CHACHA_QUARTER(x[2], x[6], x[10], x[14]);
+        CHACHA_QUARTER(x[3], x[7], x[11], x[15]);
+        CHACHA_QUARTER(x[0], x[5], x[10], x[15]);
+        CHACHA_QUARTER(x[1], x[6], x[11], x[12]);
+        CHACHA_QUARTER(x[2], x[7], x[8], x[13]);
+        CHACHA_QUARTER(x[3], x[4], x[9], x[14]);
+    }
+    for (int i = 0; i < 16; ++i) {
+        uint32_t initial = i == 12 ? initial12 : i == 13 ? initial13 : state.words[i];
+        uint32_t v = x[i] + initial;
+        out[4 * i] = static_cast<unsigned char>(v);
+        out[4 * i + 1] = static_cast<unsigned char>(v >> 8);
+        out[4 * i + 2] = static_cast<unsigned char>(v >> 16);
+        out[4 * i + 3] = static_cast<unsigned char>(v >> 24);
+    }
+}
+
+// out = in ^ keystream for `blocks` whole blocks starting at block n
+typedef void (*Kernel)(const State& state, uint64_t n, const char* in, char* out, size_t blocks);
+
+void CtrScalar(const State& state, uint64_t n, const char* in, char* out, size_t blocks) {
+    unsigned char stream[kBlockSize];
+    for (size_t b = 0; b < blocks; ++b) {
+        Block(state, n + b, stream);
+        for (size_t i = 0; i < kBlockSize; ++i) {
+            out[b * kBlockSize + i] = static_cast<char>(in[b * kBlockSize + i] ^ stream[i]);
+        }
+    }
+}
+
+#ifdef CPU_FEATURES_X86
+// The SIMD kernels keep one state word per register, with one block per
+// lane, so every quarter round runs on several blocks at once; the words
+// are transposed back into whole blocks at the end.
+
+#define CHACHA_QUARTER_V(add, xor_, rot16, rot12, rot8, rot7, a, b, c, d) \
+    a = add(a, b); d = xor_(d, a); d = rot16(d);                          \
+    c = add(c, d); b = xor_(b, c); b = rot12(b);                          \
+    a = add(a, b); d = xor_(d, a); d = rot8(d);                           \
+    c = add(c, d); b = xor_(b, c); b = rot7(b);
+
+#define CHACHA_DOUBLE_ROUND_V(add, xor_, rot16, rot12, rot8, rot7, x)                 \
+    CHACHA_QUARTER_V(add, xor_, rot16, rot12, rot8, rot7, x[0], x[4], x[8], x[12])  \
+    CHACHA_QUARTER_V(add, xor_, rot16, rot12, rot8, rot7, x[1], x[5], x[9], x[13])  \
+    CHACHA_QUARTER_V(add, xor_, rot16, rot12, rot8, rot7, x[2], x[6], x[10], x[14]) \
+    CHACHA_QUARTER_V(add, xor_, rot16, rot12, rot8, rot7, x[3], x[7], x[11], x[15]) \
+    CHACHA_QUARTER_V(add, xor_, rot16, rot12, rot8, rot7, x[0], x[5], x[10], x[15]) \
+    CHACHA_QUARTER_V(add, xor_, rot16, rot12, rot8, rot7, x[1], x[6], x[11], x[12]) \
+    CHACHA_QUARTER_V(add, xor_, rot16, rot12, rot8, rot7, x[2], x[7], x[8], x[13])  \
+    CHACHA_QUARTER_V(add, xor_, rot16, rot12, rot8, rot7, x[3], x[4], x[9], x[14])
+
+#define SSE_ADD(a, b) _mm_add_epi32(a, b)
+#define SSE_XOR(a, b) _mm_xor_si128(a, b)
+#define SSE_ROT(v, n) _mm_or_si128(_mm_slli_epi32(v, n), _mm_srli_epi32(v, 32 - n))
+#define SSE_ROT16(v) SSE_ROT(v, 16)
+#define SSE_ROT12(v) SSE_ROT(v, 12)
+#define SSE_ROT8(v) SSE_ROT(v, 8)
+#define SSE_ROT7(v) SSE_ROT(v, 7)
+
+// Four blocks per step
+__attribute__((target("sse2")))
+void CtrSSE2(const State& state, uint64_t n, const char* in, char* out, size_t blocks) {
+    size_t b = 0;
+    for (; b + 4 <= blocks; b += 4) {
+        __m128i initial[16];
+        for (int i = 0; i < 16; ++i) initial[i] = _mm_set1_epi32(static_cast<int>(state.words[i]));
+        uint64_t c0 = n + b, c1 = c0 + 1, c2 = c0 + 2, c3 = c0 + 3;
+        initial[12] = _mm_set_epi32(static_cast<int>(c3), static_cast<int>(c2), static_cast<int>(c1),
+                                    static_cast<int>(c0));
+        initial[13] = _mm_set_epi32(static_cast<int>(c3 >> 32), static_cast<int>(c2 >> 32),
+                                    static_cast<int>(c1 >> 32), static_cast<int>(c0 >> 32));
+
+        __m128i x[16];
+        for (int i = 0; i < 16; ++i) x[i] = initial[i];
+        for (int round = 0; round < 10; ++round) {
+            CHACHA_DOUBLE_ROUND_V(SSE_ADD, SSE_XOR, SSE_ROT16, SSE_ROT12, SSE_ROT8, SSE_ROT7, x)
+        }
+        for (int i = 0; i < 16; ++i) x[i] = _mm_add_epi32(x[i], initial[i]);
+
+        // Words 4g..4g+3 of the four blocks become one 16-byte row per block
+        for (int g = 0; g < 4; ++g) {
+            __m128i t0 = _mm_unpacklo_epi32(x[4 * g], x[4 * g + 1]);
+            __m128i t1 = _mm_unpacklo_epi32(x[4 * g + 2], x[4 * g + 3]);
+            __m128i t2 = _mm_unpackhi_epi32(x[4 * g], x[4 * g + 1]);
+            __m128i t3 = _mm_unpackhi_epi32(x[4 * g + 2], x[4 * g + 3]);
+            __m128i rows[4] = {_mm_unpacklo_epi64(t0, t1), _mm_unpackhi_epi64(t0, t1),
+                               _mm_unpacklo_epi64(t2, t3), _mm_unpackhi_epi64(t2, t3)};
+            for (int k = 0; k < 4; ++k) {
+                size_t at = (b + k) * kBlockSize + 16 * g;
+                __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + at));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + at), _mm_xor_si128(v, rows[k]));
+            }
+        }
+    }
+    CtrScalar(state, n + b, in + b * kBlockSize, out + b * kBlockSize, blocks - b);
+}
+
+#define AVX_ADD(a, b) _mm256_add_epi32(a, b)
+#define AVX_XOR(a, b) _mm256_xor_si256(a, b)
+#define AVX_ROT(v, n) _mm256_or_si256(_mm256_slli_epi32(v, n), _mm256_srli_epi32(v, 32 - n))
+#define AVX_ROT16(v) _mm256_shuffle_epi8(v, rot16)
+#define AVX_ROT12(v) AVX_ROT(v, 12)
+#define AVX_ROT8(v) _mm256_shuffle_epi8(v, rot8)
+#define AVX_ROT7(v) AVX_ROT(v, 7)
+
+// Eight blocks per step; rotations by whole bytes are byte shuffles
+__attribute__((target("avx2")))
+void CtrAVX2(const State& state, uint64_t n, const char* in, char* out, size_t blocks) {
+    const __m256i rot16 = _mm256_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13,
+                                           2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+    const __m256i rot8 = _mm256_setr_epi8(3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14,
+                                          3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14);
+    size_t b = 0;
+    for (; b + 8 <= blocks; b += 8) {
+        __m256i initial[16];
+        for (int i = 0; i < 16; ++i) initial[i] = _mm256_set1_epi32(static_cast<int>(state.words[i]));
+        int low[8], high[8];
+        for (int k = 0; k < 8; ++k) {
+            uint64_t counter = n + b + k;
+            low[k] = static_cast<int>(counter);
+            high[k] = static_cast<int>(counter >> 32);
+        }
+        initial[12] = _mm256_setr_epi32(low[0], low[1], low[2], low[3], low[4], low[5], low[6], low[7]);
+        initial[13] = _mm256_setr_epi32(high[0], high[1], high[2], high[3], high[4], high[5], high[6], high[7]);
+
+        __m256i x[16];
+        for (int i = 0; i < 16; ++i) x[i] = initial[i];
+        for (int round = 0; round < 10; ++round) {
+            CHACHA_DOUBLE_ROUND_V(AVX_ADD, AVX_XOR, AVX_ROT16, AVX_ROT12, AVX_ROT8, AVX_ROT7, x)
+        }
+        for (int i = 0; i < 16; ++i) x[i] = _mm256_add_epi32(x[i], initial[i]);
+
+        // Transpose within each 128-bit lane as in CtrSSE2: rows[g][k] then
+        // holds words 4g..4g+3 of block k (low lane) and block k + 4 (high)
+        __m256i rows[4][4];
+        for (int g = 0; g < 4; ++g) {
+            __m256i t0 = _mm256_unpacklo_epi32(x[4 * g], x[4 * g + 1]);
+            __m256i t1 = _mm256_unpacklo_epi32(x[4 * g + 2], x[4 * g + 3]);
+            __m256i t2 = _mm256_unpackhi_epi32(x[4 * g], x[4 * g + 1]);
+            __m256i t3 = _mm256_unpackhi_epi32(x[4 * g + 2], x[4 * g + 3]);
+            rows[g][0] = _mm256_unpacklo_epi64(t0, t1);
+            rows[g][1] = _mm256_unpackhi_epi64(t0, t1);
+            rows[g][2] = _mm256_unpacklo_epi64(t2, t3);
+            rows[g][3] = _mm256_unpackhi_epi64(t2, t3);
+        }
+        for (int k = 0; k < 4; ++k) {
+            // Pair up the lanes into the two halves of blocks k and k + 4
+            __m256i halves[4] = {_mm256_permute2x128_si256(rows[0][k], rows[1][k], 0x20),
+                                 _mm256_permute2x128_si256(rows[2][k], rows[3][k], 0x20),
+                                 _mm256_permute2x128_si256(rows[0][k], rows[1][k], 0x31),
+                                 _mm256_permute2x128_si256(rows[2][k], rows[3][k], 0x31)};
+            size_t at[4] = {(b + k) * kBlockSize, (b + k) * kBlockSize + 32, (b + k + 4) * kBlockSize,
+                            (b + k + 4) * kBlockSize + 32};
+            for (int h = 0; h < 4; ++h) {
+                __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + at[h]));
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + at[h]), _mm256_xor_si256(v, halves[h]));
+            }
+        }
+    }
+    CtrSSE2(state, n + b, in + b * kBlockSize, out + b * kBlockSize, blocks - b);
+}
+#endif
+
+Kernel SelectKernel() {
+#ifdef CPU_FEATURES_X86
+    if (CpuFeatures::HasAVX2()) return CtrAVX2;
+    if (CpuFeatures::HasSSE2()) return CtrSSE2;
+#endif
+    return CtrScalar;
+}
+
+} // namespace
+
+void Encryption::ChaCha20(const char* in, char* out, size_t size, const std::string& key, uint64_t nonce,
+                          unsigned long long offset) {
+    static const Kernel kernel = SelectKernel();
+    if (size == 0) return;
+
+    unsigned char digest[Checksum::Sha256Size];
+    Checksum::Sha256(key.data(), key.size(), digest);
+    State state(digest, nonce);
+
+    uint64_t n = offset / kBlockSize;
+    size_t skip = static_cast<size_t>(offset % kBlockSize);
+    size_t done = 0;
+
+    // Leading partial block, when offset is not block-aligned
+    if (skip) {
+        unsigned char stream[kBlockSize];
+        Block(state, n++, stream);
+        for (; skip < kBlockSize && done < size; ++skip, ++done) out[done] = static_cast<char>(in[done] ^ stream[skip]);
+    }
+
+    size_t blocks = (size - done) / kBlockSize;
+    kernel(state, n, in + done, out + done, blocks);
+    n += blocks;
+    done += blocks * kBlockSize;
+
+    if (done < size) {
+        unsigned char stream[kBlockSize];
+        Block(state, n, stream);
+        for (size_t i = 0; done < size; ++i, ++done) out[done] = static_cast<char>(in[done] ^ stream[i]);
+    }
+}
@@ -0,0 +1,41 @@
+#ifndef ENDIAN_H
+#define ENDIAN_H
+
+#include <cstdint>
+
+// Little-endian integers in byte buffers, for the on-disk formats (block
+// containers, the dedup store, archives). Byte by byte, so neither the
+// host's byte order nor the buffer's alignment matters.
+class Endian {
+public:
+    static void PutU16(char* p, uint16_t v) {
+        p[0] = static_cast<char>(v);
+        p[1] = static_cast<char>(v >> 8);
+    }
+
+    static void PutU32(char* p, uint32_t v) {
+        for (int i = 0; i < 4; ++i) p[i] = static_cast<char>(v >> (8 * i));
+    }
+
+    static void PutU64(char* p, uint64_t v) {
+        for (int i = 0; i < 8; ++i) p[i] = static_cast<char>(v >> (8 * i));
+    }
+
+    static uint16_t GetU16(const char* p) {
+        return static_cast<uint16_t>(static_cast<unsigned char>(p[0]) | (static_cast<unsigned char>(p[1]) << 8));
+    }
+
+    static uint32_t GetU32(const char* p) {
+        uint32_t v = 0;
+        for (int i = 0; i < 4; ++i) v |= static_cast<uint32_t>(static_cast<unsigned char>(p[i])) << (8 * i);
+        return v;
+    }
+
+    static uint64_t GetU64(const char* p) {
+        uint64_t v = 0;
+        for (int i = 0; i < 8; ++i) v |= static_cast<uint64_t>(static_cast<unsigned char>(p[i])) << (8 * i);
+        return v;
+    }
+};
+
+#endif // ENDIAN_H
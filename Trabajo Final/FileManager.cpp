@@ -1,123 +1,177 @@
 #include "FileManager.h"
-#include <stdexcept>
+#include <cstdint>
+#include <cstring>
 
-bool FileManager::IsDirectory(const std::string& path) {
-    DWORD attributes = GetFileAttributesA(path.c_str());
-    if (attributes == INVALID_FILE_ATTRIBUTES) {
-        return false; // Or throw error
-    }
-    return (attributes & FILE_ATTRIBUTE_DIRECTORY);
+#ifdef _WIN32
+const char FileManager::PathSeparator = '\\';
+#else
+const char FileManager::PathSeparator = '/';
+#endif
+
+bool FileManager::WriteFileContent(const std::string& path, const std::vector<char>& buffer) {
+    return WriteFileContent(path, buffer.data(), buffer.size());
 }
 
-std::vector<std::string> FileManager::GetFiles(const std::string& directory) {
-    std::vector<std::string> files;
-    std::string searchPath = directory + "\\*";
-    WIN32_FIND_DATAA findData;
-    HANDLE hFind = FindFirstFileA(searchPath.c_str(), &findData);
+bool FileManager::WriteFileContent(const std::string& path, const char* data, size_t size) {
+    // The size is known exactly, so the space is reserved in one go
+    NativeFile file;
+    bool direct = false;
+    if (!OpenOutput(path, file, size, direct)) {
+        return false;
+    }
 
-    if (hFind == INVALID_HANDLE_VALUE) {
-        return files;
+    bool ok = WriteChunk(file, data, size);
+    if (!CloseFile(file)) ok = false;
+    if (!ok) {
+        std::cerr << "Error writing to file: " << path << std::endl;
     }
+    return ok;
+}
 
-    do {
-        const std::string fileName = findData.cFileName;
-        if (fileName != "." && fileName != "..") {
-            std::string fullPath = directory + "\\" + fileName;
-            if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
-                // Recursively get files if needed, or just list current level
-                // For this project, let's recurse to handle full directories
-                std::vector<std::string> subFiles = GetFiles(fullPath);
-                files.insert(files.end(), subFiles.begin(), subFiles.end());
-            } else {
-                files.push_back(fullPath);
-            }
-        }
-    } while (FindNextFileA(hFind, &findData) != 0);
+bool FileManager::OpenForWrite(const std::string& path, NativeFile& file) {
+    bool direct = false;
+    return OpenOutput(path, file, 0, direct);
+}
 
-    FindClose(hFind);
-    return files;
+FileManager::FileWriter::FileWriter()
+    : file(), open(false), direct(false), staging(nullptr), staged(0), written(0) {}
+
+FileManager::FileWriter::~FileWriter() {
+    if (open) CloseFile(file);
 }
 
-bool FileManager::ReadFileContent(const std::string& path, std::vector<char>& buffer) {
-    HANDLE hFile = CreateFileA(
-        path.c_str(),           // FileName
-        GENERIC_READ,           // DesiredAccess
-        FILE_SHARE_READ,        // ShareMode
-        NULL,                   // SecurityAttributes
-        OPEN_EXISTING,          // CreationDisposition
-        FILE_ATTRIBUTE_NORMAL,  // FlagsAndAttributes
-        NULL                    // TemplateFile
-    );
-
-    if (hFile == INVALID_HANDLE_VALUE) {
-        std::cerr << "Error opening file for reading: " << path << " Error: " << GetLastError() << std::endl;
+bool FileManager::FileWriter::Open(const std::string& path, unsigned long long expectedSize) {
+    direct = expectedSize >= DirectWriteThreshold;
+    if (!OpenOutput(path, file, expectedSize, direct)) {
         return false;
     }
+    open = true;
 
-    DWORD fileSize = GetFileSize(hFile, NULL);
-    if (fileSize == INVALID_FILE_SIZE) {
-        std::cerr << "Error getting file size: " << path << std::endl;
-        CloseHandle(hFile);
-        return false;
-    }
+    storage.resize(WriteChunkSize + WriteAlignment);
+    uintptr_t address = reinterpret_cast<uintptr_t>(storage.data());
+    staging = storage.data() + (WriteAlignment - address % WriteAlignment) % WriteAlignment;
+    staged = 0;
+    written = 0;
+    return true;
+}
 
-    buffer.resize(fileSize);
-    DWORD bytesRead;
-    if (!ReadFile(hFile, buffer.data(), fileSize, &bytesRead, NULL)) {
-        std::cerr << "Error reading file: " << path << std::endl;
-        CloseHandle(hFile);
+bool FileManager::FileWriter::OpenAt(const std::string& path, unsigned long long offset) {
+    direct = false;
+    if (!OpenForUpdate(path, file, offset)) {
         return false;
     }
+    open = true;
 
-    CloseHandle(hFile);
+    storage.resize(WriteChunkSize + WriteAlignment);
+    uintptr_t address = reinterpret_cast<uintptr_t>(storage.data());
+    staging = storage.data() + (WriteAlignment - address % WriteAlignment) % WriteAlignment;
+    staged = 0;
+    written = offset;
     return true;
 }
 
-bool FileManager::WriteFileContent(const std::string& path, const std::vector<char>& buffer) {
-    // Ensure directory exists (simple check, assuming output dir exists or is created)
-    // For robust implementation, we might need to create parent directories.
-    
-    HANDLE hFile = CreateFileA(
-        path.c_str(),
-        GENERIC_WRITE,
-        0,                      // No sharing
-        NULL,
-        CREATE_ALWAYS,          // Overwrite if exists
-        FILE_ATTRIBUTE_NORMAL,
-        NULL
-    );
-
-    if (hFile == INVALID_HANDLE_VALUE) {
-        std::cerr << "Error creating file for writing: " << path << " Error: " << GetLastError() << std::endl;
-        return false;
-    }
+bool FileManager::FileWriter::Write(const char* data, size_t size) {
+    while (size > 0) {
+        if (!direct && staged == 0 && size >= WriteChunkSize) {
+            // Already a whole chunk: no need to copy it through the stage
+            if (!WriteChunk(file, data, size)) return false;
+            written += size;
+            return true;
+        }
 
-    DWORD bytesWritten;
-    if (!WriteFile(hFile, buffer.data(), static_cast<DWORD>(buffer.size()), &bytesWritten, NULL)) {
-        std::cerr << "Error writing to file: " << path << std::endl;
-        CloseHandle(hFile);
-        return false;
+        size_t take = WriteChunkSize - staged;
+        if (take > size) take = size;
+        std::memcpy(staging + staged, data, take);
+        staged += take;
+        data += take;
+        size -= take;
+
+        if (staged == WriteChunkSize && !FlushStaged()) return false;
     }
+    return true;
+}
 
-    CloseHandle(hFile);
+bool FileManager::FileWriter::FlushStaged() {
+    size_t length = staged;
+    if (direct && length % WriteAlignment != 0) {
+        // Only the last chunk can be partial; pad it, Finish trims the padding
+        size_t padded = length + WriteAlignment - length % WriteAlignment;
+        std::memset(staging + length, 0, padded - length);
+        length = padded;
+    }
+    if (!WriteChunk(file, staging, length)) return false;
+    written += staged;
+    staged = 0;
     return true;
 }
 
+bool FileManager::FileWriter::Finish() {
+    if (!open) return false;
+    bool ok = staged == 0 || FlushStaged();
+    // Drops the unused part of the reservation and any direct I/O padding
+    if (ok) ok = SetFileEnd(file, written);
+    if (!CloseFile(file)) ok = false;
+    open = false;
+    return ok;
+}
+
+#ifndef __linux__
+// No asynchronous engine on this platform: batches are plain loops
+bool FileManager::AsyncIOAvailable() {
+    return false;
+}
+
+void FileManager::ReadBatch(std::vector<BatchFile>& files) {
+    for (auto& file : files) file.ok = ReadFileContent(file.path, file.data);
+}
+
+void FileManager::WriteBatch(std::vector<BatchFile>& files) {
+    for (auto& file : files) file.ok = WriteFileContent(file.path, file.data);
+}
+#endif
+
+// Buffered fallback for OpenView: read until end of file, size unknown up front
+bool FileManager::ReadAll(NativeFile file, std::vector<char>& buffer) {
+    const size_t chunk = 1 << 16;
+    buffer.clear();
+    for (;;) {
+        size_t used = buffer.size();
+        buffer.resize(used + chunk);
+        size_t got = 0;
+        if (!ReadChunk(file, buffer.data() + used, chunk, got)) {
+            buffer.clear();
+            return false;
+        }
+        buffer.resize(used + got);
+        if (got < chunk) return true;
+    }
+}
+
+bool FileManager::MakeDirectories(const std::string& path) {
+    // Each prefix ending before a separator, then the whole path
+    for (size_t position = path.find_first_of("/\\", 1); position != std::string::npos;
+         position = path.find_first_of("/\\", position + 1)) {
+        std::string parent = path.substr(0, position);
+        if (!parent.empty() && parent.back() != ':' && !MakeDirectory(parent)) return false;
+    }
+    return MakeDirectory(path);
+}
+
 std::string FileManager::CreateOutputPath(const std::string& inputPath, const std::string& outputDir, const std::string& suffix) {
     // Simple implementation: extract filename and append to outputDir with suffix
     size_t lastSlash = inputPath.find_last_of("/\\");
     std::string fileName = (lastSlash == std::string::npos) ? inputPath : inputPath.substr(lastSlash + 1);
-    
+
     // If outputDir is a directory, append filename. If it looks like a file path (ends in extension), use it directly?
     // Requirement says -o [ruta_archivo_o_directorio_salida]
     // We'll assume outputDir is a directory for batch processing, or a full path for single file.
     // For simplicity in this helper, let's assume we are constructing a path inside an output directory.
-    
+
     // Check if outputDir has a trailing slash
     std::string out = outputDir;
     if (!out.empty() && out.back() != '\\' && out.back() != '/') {
-        out += "\\";
+        out += PathSeparator;
     }
-    
+
     return out + fileName + suffix;
 }
@@ -1,27 +1,213 @@
 #ifndef FILEMANAGER_H
 #define FILEMANAGER_H
 
-#include <windows.h>
 #include <string>
 #include <vector>
 #include <iostream>
+#include <cstddef>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
 
+// FileManager is implemented once per platform backend:
+//   FileManagerWin32.cpp - Windows API (CreateFile, ReadFile, FindFirstFile)
+//   FileManagerPosix.cpp - POSIX (open, read, write, opendir/readdir)
+//   FileManagerUring.cpp - Linux io_uring engine for batched small files
+// The Makefile picks the backend at compile time; FileManager.cpp holds
+// the parts that do not touch the operating system.
 class FileManager {
 public:
+    // A file found while walking a directory
+    struct FileEntry {
+        std::string path;
+        unsigned long long size; // Bytes, as reported by the directory walk
+        // Last write time in the backend's own units (ns since 1970 on POSIX,
+        // 100 ns ticks since 1601 on Windows); only compared, never converted
+        unsigned long long modified = 0;
+    };
+
+    // One file of a batched read or write
+    struct BatchFile {
+        std::string path;
+        unsigned long long size = 0; // Expected size for reads, e.g. FileEntry::size
+        std::vector<char> data;      // Contents read, or bytes to write
+        bool ok = false;             // Set by ReadBatch/WriteBatch
+    };
+
+    // Open file handle of the selected backend
+#ifdef _WIN32
+    typedef HANDLE NativeFile;
+#else
+    typedef int NativeFile;
+#endif
+
+    // Read-only view of a whole file. Regular files are memory-mapped with
+    // sequential read-ahead, so the bytes are consumed straight from the page
+    // cache; pipes and special files fall back to a buffered read.
+    class FileView {
+    public:
+        FileView() : data(nullptr), size(0), mapped(false) {}
+        ~FileView() { Close(); }
+
+        const char* Data() const { return data; }
+        size_t Size() const { return size; }
+        bool IsMapped() const { return mapped; }
+
+        // Unmap or free the contents; the view is empty afterwards
+        void Close();
+
+    private:
+        FileView(const FileView&) = delete;
+        FileView& operator=(const FileView&) = delete;
+        friend class FileManager;
+
+        const char* data;
+        size_t size;
+        bool mapped;
+        std::vector<char> buffer; // Contents when not mapped
+    };
+
+    // Sequential writer for large outputs. Space for the expected size is
+    // reserved up front so the file is laid out in one piece instead of
+    // growing write by write. Bytes are staged in an aligned buffer and
+    // written in whole chunks; outputs of DirectWriteThreshold bytes or more
+    // use direct I/O (O_DIRECT / FILE_FLAG_NO_BUFFERING) so they stream to
+    // disk without filling the page cache. Finish trims the file to the bytes
+    // actually written.
+    class FileWriter {
+    public:
+        FileWriter();
+        ~FileWriter();
+
+        bool Open(const std::string& path, unsigned long long expectedSize);
+
+        // Continue an existing file from offset, replacing what follows.
+        // Never direct: the offset need not be aligned.
+        bool OpenAt(const std::string& path, unsigned long long offset);
+
+        bool Write(const char* data, size_t size);
+
+        // Bytes written so far, counting those still staged
+        unsigned long long Position() const { return written + staged; }
+
+        // Write what is left, trim and close. Returns false on any error;
+        // a writer dropped without Finish just closes the file.
+        bool Finish();
+
+    private:
+        FileWriter(const FileWriter&) = delete;
+        FileWriter& operator=(const FileWriter&) = delete;
+
+        bool FlushStaged();
+
+        NativeFile file;
+        bool open;
+        bool direct;
+        std::vector<char> storage; // Holds the aligned staging buffer
+        char* staging;
+        size_t staged;
+        unsigned long long written;
+    };
+
+    // Direct I/O wants buffers, offsets and lengths on this boundary
+    static constexpr size_t WriteAlignment = 4096;
+    // Bytes a FileWriter stages before writing
+    static constexpr size_t WriteChunkSize = 1 << 20;
+    // Outputs expected to reach this size bypass the page cache
+    static constexpr unsigned long long DirectWriteThreshold = 64ULL << 20;
+
+    // Separator used when building paths on this platform
+    static const char PathSeparator;
+
     // Check if path is a directory
     static bool IsDirectory(const std::string& path);
 
-    // Get all files in a directory (recursively or flat)
-    static std::vector<std::string> GetFiles(const std::string& directory);
+    // Create a directory and any missing parents; true if it exists afterwards
+    static bool MakeDirectories(const std::string& path);
+
+    // Get all files in a directory (recursively), with their sizes
+    static std::vector<FileEntry> GetFiles(const std::string& directory);
+
+    // Size of a single file in bytes
+    static bool GetFileSize(const std::string& path, unsigned long long& size);
+
+    // Size and last write time of a single file, as GetFiles reports them
+    static bool GetFileEntry(const std::string& path, FileEntry& entry);
 
     // Read entire file content
     static bool ReadFileContent(const std::string& path, std::vector<char>& buffer);
 
     // Write content to file
     static bool WriteFileContent(const std::string& path, const std::vector<char>& buffer);
+    static bool WriteFileContent(const std::string& path, const char* data, size_t size);
+
+    // Move a file over another in one step, replacing it: readers see the
+    // old file or the new one, never a mix
+    static bool RenameFile(const std::string& from, const std::string& to);
+
+    // Delete a file, e.g. an output that failed part way
+    static bool RemoveFile(const std::string& path);
+
+    // Open a file for sequential reading. size is 0 for pipes and devices.
+    static bool OpenForRead(const std::string& path, NativeFile& file, unsigned long long& size);
+
+    // Create (or truncate) a file for sequential writing
+    static bool OpenForWrite(const std::string& path, NativeFile& file);
+
+    // Open an existing file for writing at offset; anything past offset is
+    // dropped
+    static bool OpenForUpdate(const std::string& path, NativeFile& file, unsigned long long offset);
+
+    // Set the end of file, dropping anything past `size`
+    static bool SetFileEnd(NativeFile file, unsigned long long size);
+
+    // Copy a file that needs no transform. The kernel moves the bytes
+    // (copy_file_range, or splice from a pipe; CopyFile on Windows) so they
+    // never pass through this process; a read/write loop covers the rest.
+    static bool CopyContent(const std::string& inputPath, const std::string& outputPath);
+
+    // Read up to `size` bytes, retrying short reads until the buffer is full.
+    // bytesRead < size only at end of file.
+    static bool ReadChunk(NativeFile file, char* data, size_t size, size_t& bytesRead);
+
+    // Write the whole buffer, retrying short writes
+    static bool WriteChunk(NativeFile file, const char* data, size_t size);
+
+    // Open a read-only view of the whole file. With mapOnly, files that cannot
+    // be mapped (pipes, devices) are left untouched and false is returned, so
+    // the caller can stream them instead of buffering them whole.
+    static bool OpenView(const std::string& path, FileView& view, bool mapOnly = false);
+
+    // True if batches go through an asynchronous engine (io_uring on Linux).
+    // Without one, ReadBatch/WriteBatch still work, one file at a time.
+    static bool AsyncIOAvailable();
+
+    // Read or write many small files at once. The engine queues the opens,
+    // reads/writes and closes of the whole batch and waits for them together,
+    // instead of paying several system calls per file. Each file's result is
+    // left in its ok flag; files the engine cannot handle are done the
+    // ordinary way.
+    static void ReadBatch(std::vector<BatchFile>& files);
+    static void WriteBatch(std::vector<BatchFile>& files);
+
+    // Close a handle from OpenForRead/OpenForWrite. Returns false if the
+    // close reported a deferred write error.
+    static bool CloseFile(NativeFile file);
 
     // Helper to construct output path based on input path and operation
     static std::string CreateOutputPath(const std::string& inputPath, const std::string& outputDir, const std::string& suffix);
+
+private:
+    // Create one directory whose parent exists; true if it already exists
+    static bool MakeDirectory(const std::string& path);
+
+    static bool ReadAll(NativeFile file, std::vector<char>& buffer);
+
+    // Create/truncate an output and reserve expectedSize bytes for it (the
+    // file may read as that size until SetFileEnd). direct asks for direct
+    // I/O and is cleared if the file system refuses it.
+    static bool OpenOutput(const std::string& path, NativeFile& file, unsigned long long expectedSize, bool& direct);
 };
 
 #endif // FILEMANAGER_H
@@ -0,0 +1,351 @@
+#include "FileManager.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+unsigned long long ModifiedTime(const struct stat& st) {
+#ifdef __APPLE__
+    const struct timespec& time = st.st_mtimespec;
+#else
+    const struct timespec& time = st.st_mtim;
+#endif
+    return static_cast<unsigned long long>(time.tv_sec) * 1000000000ULL + static_cast<unsigned long long>(time.tv_nsec);
+}
+
+} // namespace
+
+bool FileManager::IsDirectory(const std::string& path) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        return false; // Or throw error
+    }
+    return S_ISDIR(st.st_mode);
+}
+
+std::vector<FileManager::FileEntry> FileManager::GetFiles(const std::string& directory) {
+    std::vector<FileEntry> files;
+    DIR* dir = opendir(directory.c_str());
+
+    if (dir == NULL) {
+        return files;
+    }
+
+    int dirFd = dirfd(dir);
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        const std::string fileName = entry->d_name;
+        if (fileName == "." || fileName == "..") {
+            continue;
+        }
+
+        std::string fullPath = directory + PathSeparator + fileName;
+        if (entry->d_type == DT_DIR) {
+            // Recurse to handle full directories, same as the Windows backend
+            std::vector<FileEntry> subFiles = GetFiles(fullPath);
+            files.insert(files.end(), subFiles.begin(), subFiles.end());
+            continue;
+        }
+
+        // The size is needed for every file anyway, so one fstatat relative
+        // to the open directory covers both the size and filesystems that
+        // leave d_type as DT_UNKNOWN.
+        struct stat st;
+        if (fstatat(dirFd, entry->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) continue;
+        if (S_ISLNK(st.st_mode)) {
+            // Symlinks are followed for files but never descended into,
+            // so a link loop cannot recurse forever.
+            if (fstatat(dirFd, entry->d_name, &st, 0) != 0 || !S_ISREG(st.st_mode)) continue;
+        }
+
+        if (S_ISDIR(st.st_mode)) {
+            std::vector<FileEntry> subFiles = GetFiles(fullPath);
+            files.insert(files.end(), subFiles.begin(), subFiles.end());
+        } else if (S_ISREG(st.st_mode)) {
+            files.push_back(FileEntry{fullPath, static_cast<unsigned long long>(st.st_size), ModifiedTime(st)});
+        }
+    }
+
+    closedir(dir);
+    return files;
+}
+
+bool FileManager::GetFileSize(const std::string& path, unsigned long long& size) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        return false;
+    }
+    size = static_cast<unsigned long long>(st.st_size);
+    return true;
+}
+
+bool FileManager::MakeDirectory(const std::string& path) {
+    if (mkdir(path.c_str(), 0777) == 0) return true;
+    return errno == EEXIST && IsDirectory(path);
+}
+
+bool FileManager::RenameFile(const std::string& from, const std::string& to) {
+    return rename(from.c_str(), to.c_str()) == 0;
+}
+
+bool FileManager::RemoveFile(const std::string& path) {
+    return unlink(path.c_str()) == 0;
+}
+
+bool FileManager::GetFileEntry(const std::string& path, FileEntry& entry) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        return false;
+    }
+    entry.path = path;
+    entry.size = static_cast<unsigned long long>(st.st_size);
+    entry.modified = ModifiedTime(st);
+    return true;
+}
+
+bool FileManager::ReadFileContent(const std::string& path, std::vector<char>& buffer) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0) {
+        std::cerr << "Error opening file for reading: " << path << " Error: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        std::cerr << "Error getting file size: " << path << std::endl;
+        close(fd);
+        return false;
+    }
+
+    buffer.resize(static_cast<size_t>(st.st_size));
+    size_t total = 0;
+    while (total < buffer.size()) {
+        // pread keeps the offset explicit; read() may return short counts
+        ssize_t got = pread(fd, buffer.data() + total, buffer.size() - total, static_cast<off_t>(total));
+        if (got < 0) {
+            if (errno == EINTR) continue;
+            std::cerr << "Error reading file: " << path << " Error: " << strerror(errno) << std::endl;
+            close(fd);
+            return false;
+        }
+        if (got == 0) break; // File shrank while reading
+        total += static_cast<size_t>(got);
+    }
+    buffer.resize(total);
+
+    close(fd);
+    return true;
+}
+
+bool FileManager::OpenForRead(const std::string& path, NativeFile& file, unsigned long long& size) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        std::cerr << "Error opening file for reading: " << path << " Error: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    struct stat st;
+    size = (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) ? static_cast<unsigned long long>(st.st_size) : 0;
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL); // Ask for aggressive read-ahead
+#endif
+    file = fd;
+    return true;
+}
+
+bool FileManager::OpenOutput(const std::string& path, NativeFile& file, unsigned long long expectedSize, bool& direct) {
+    const int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+    int fd = -1;
+#ifdef O_DIRECT
+    if (direct) fd = open(path.c_str(), flags | O_DIRECT, 0644);
+#endif
+    if (fd < 0) {
+        direct = false; // Not supported here (e.g. tmpfs): use the page cache
+        fd = open(path.c_str(), flags, 0644);
+    }
+    if (fd < 0) {
+        std::cerr << "Error creating file for writing: " << path << " Error: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+#ifdef __linux__
+    // Best effort: without it the file simply grows as it is written
+    if (expectedSize > 0) fallocate(fd, 0, 0, static_cast<off_t>(expectedSize));
+#endif
+    file = fd;
+    return true;
+}
+
+bool FileManager::OpenForUpdate(const std::string& path, NativeFile& file, unsigned long long offset) {
+    int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        std::cerr << "Error opening file for writing: " << path << " Error: " << strerror(errno) << std::endl;
+        return false;
+    }
+    if (!SetFileEnd(fd, offset) || lseek(fd, static_cast<off_t>(offset), SEEK_SET) < 0) {
+        std::cerr << "Error positioning file: " << path << std::endl;
+        close(fd);
+        return false;
+    }
+    file = fd;
+    return true;
+}
+
+bool FileManager::SetFileEnd(NativeFile file, unsigned long long size) {
+    while (ftruncate(file, static_cast<off_t>(size)) != 0) {
+        if (errno == EINTR) continue;
+        std::cerr << "Error setting file size. Error: " << strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool FileManager::CopyContent(const std::string& inputPath, const std::string& outputPath) {
+    NativeFile in;
+    NativeFile out;
+    unsigned long long size = 0;
+    bool direct = false;
+    if (!OpenForRead(inputPath, in, size)) return false;
+    if (!OpenOutput(outputPath, out, size, direct)) {
+        close(in);
+        return false;
+    }
+
+    unsigned long long total = 0;
+    bool ok = true;
+    bool copied = false;
+#ifdef __linux__
+    struct stat st;
+    bool pipe = fstat(in, &st) == 0 && S_ISFIFO(st.st_mode);
+    for (;;) {
+        ssize_t moved = pipe ? splice(in, NULL, out, NULL, 1 << 30, SPLICE_F_MOVE)
+                             : copy_file_range(in, NULL, out, NULL, 1 << 30, 0);
+        if (moved < 0) {
+            if (errno == EINTR) continue;
+            // Unsupported for this pair of files: fall through to the loop
+            if (total == 0 && (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP)) break;
+            std::cerr << "Error copying file: " << inputPath << " Error: " << strerror(errno) << std::endl;
+            ok = false;
+            break;
+        }
+        if (moved == 0) {
+            copied = true;
+            break;
+        }
+        total += static_cast<unsigned long long>(moved);
+    }
+#endif
+
+    if (ok && !copied) {
+        std::vector<char> buffer(WriteChunkSize);
+        size_t got = 0;
+        do {
+            ok = ReadChunk(in, buffer.data(), buffer.size(), got) && WriteChunk(out, buffer.data(), got);
+            total += got;
+        } while (ok && got == buffer.size());
+    }
+
+    if (ok) ok = SetFileEnd(out, total);
+    close(in);
+    if (!CloseFile(out)) ok = false;
+    return ok;
+}
+
+bool FileManager::ReadChunk(NativeFile file, char* data, size_t size, size_t& bytesRead) {
+    bytesRead = 0;
+    while (bytesRead < size) {
+        ssize_t got = read(file, data + bytesRead, size - bytesRead);
+        if (got < 0) {
+            if (errno == EINTR) continue;
+            std::cerr << "Error reading file. Error: " << strerror(errno) << std::endl;
+            return false;
+        }
+        if (got == 0) break; // End of file
+        bytesRead += static_cast<size_t>(got);
+    }
+    return true;
+}
+
+bool FileManager::WriteChunk(NativeFile file, const char* data, size_t size) {
+    size_t total = 0;
+    while (total < size) {
+        ssize_t written = write(file, data + total, size - total);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            std::cerr << "Error writing to file. Error: " << strerror(errno) << std::endl;
+            return false;
+        }
+        total += static_cast<size_t>(written);
+    }
+    return true;
+}
+
+bool FileManager::CloseFile(NativeFile file) {
+    if (close(file) != 0) {
+        std::cerr << "Error closing file. Error: " << strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool FileManager::OpenView(const std::string& path, FileView& view, bool mapOnly) {
+    view.Close();
+
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        std::cerr << "Error opening file for reading: " << path << " Error: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        if (st.st_size == 0) {
+            // mmap rejects empty ranges; an empty view is all we need
+            view.mapped = true;
+            close(fd);
+            return true;
+        }
+
+        void* addr = mmap(NULL, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr != MAP_FAILED) {
+            madvise(addr, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+            view.data = static_cast<const char*>(addr);
+            view.size = static_cast<size_t>(st.st_size);
+            view.mapped = true;
+            close(fd); // The mapping keeps its own reference to the file
+            return true;
+        }
+    }
+
+    if (mapOnly) {
+        close(fd);
+        return false;
+    }
+
+    bool ok = ReadAll(fd, view.buffer);
+    close(fd);
+    if (!ok) {
+        std::cerr << "Error reading file: " << path << std::endl;
+        return false;
+    }
+    view.data = view.buffer.data();
+    view.size = view.buffer.size();
+    return true;
+}
+
+void FileManager::FileView::Close() {
+    if (mapped && data) {
+        munmap(const_cast<char*>(data), size);
+    }
+    std::vector<char>().swap(buffer);
+    data = nullptr;
+    size = 0;
+    mapped = false;
+}
@@ -0,0 +1,333 @@
+#ifdef __linux__
+
+#include "FileManager.h"
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+
+// io_uring through the raw system calls, so the build needs nothing beyond
+// the kernel headers. Each worker thread owns a ring; a batch is pushed
+// through it in three rounds (open every file, read or write every file,
+// close every file), each round a single io_uring_enter for up to
+// kRingEntries files. Anything that goes wrong for one file sends just that
+// file down the ordinary synchronous path, which also reports the error.
+
+namespace {
+
+const unsigned kRingEntries = 64;
+
+// Transfers are single requests; bigger files use the synchronous path
+const unsigned long long kMaxTransfer = 1ULL << 30;
+
+// Set once setup fails anywhere, so no thread tries again
+std::atomic<bool> ringUnavailable(false);
+
+int SetupRing(unsigned entries, io_uring_params* params) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+int EnterRing(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+    return static_cast<int>(syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, NULL, 0));
+}
+
+int RegisterRing(int fd, unsigned opcode, void* arg, unsigned count) {
+    return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, count));
+}
+
+class Ring {
+public:
+    Ring() : fd(-1), failed(false), sqRing(nullptr), cqRing(nullptr), sqRingSize(0), cqRingSize(0),
+             sqes(nullptr), sqesSize(0), entries(0) {}
+
+    ~Ring() { Close(); }
+
+    // Set up on first use by this thread
+    bool Ready() {
+        if (fd >= 0) return true;
+        if (failed || ringUnavailable) return false;
+        if (!Open()) {
+            Close();
+            failed = true;
+            ringUnavailable = true;
+            return false;
+        }
+        return true;
+    }
+
+    unsigned Entries() const { return entries; }
+
+    // Queue one request; Submit sends everything queued since the last call
+    io_uring_sqe* Next(unsigned long long userData) {
+        unsigned index = (*sqTail + queued) & *sqMask;
+        io_uring_sqe* sqe = &sqes[index];
+        std::memset(sqe, 0, sizeof(*sqe));
+        sqe->user_data = userData;
+        sqArray[index] = index;
+        queued++;
+        return sqe;
+    }
+
+    // Submit the queued requests and wait for all of them. results[userData]
+    // receives each request's return value (a count, an fd or -errno).
+    bool Submit(std::vector<int>& results) {
+        unsigned pending = queued;
+        unsigned remaining = queued;
+        // Publish the filled entries before the kernel looks at the tail
+        __atomic_store_n(sqTail, *sqTail + queued, __ATOMIC_RELEASE);
+        queued = 0;
+
+        while (remaining > 0) {
+            int ret = EnterRing(fd, pending, remaining, IORING_ENTER_GETEVENTS);
+            if (ret < 0) {
+                if (errno == EINTR || errno == EAGAIN || errno == EBUSY) continue;
+                // The kernel state is unknown from here on; stop using rings
+                failed = true;
+                ringUnavailable = true;
+                return false;
+            }
+            pending -= static_cast<unsigned>(ret);
+
+            unsigned head = *cqHead;
+            unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+            while (head != tail) {
+                const io_uring_cqe& cqe = cqes[head & *cqMask];
+                if (cqe.user_data < results.size()) results[cqe.user_data] = cqe.res;
+                head++;
+                remaining--;
+            }
+            __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+        }
+        return true;
+    }
+
+private:
+    Ring(const Ring&) = delete;
+    Ring& operator=(const Ring&) = delete;
+
+    bool Open() {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        fd = SetupRing(kRingEntries, &params);
+        if (fd < 0) return false;
+
+        sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single && cqRingSize > sqRingSize) sqRingSize = cqRingSize;
+
+        sqRing = Map(sqRingSize, IORING_OFF_SQ_RING);
+        if (!sqRing) return false;
+        if (single) {
+            cqRing = sqRing;
+        } else {
+            cqRing = Map(cqRingSize, IORING_OFF_CQ_RING);
+            if (!cqRing) return false;
+        }
+        sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = static_cast<io_uring_sqe*>(Map(sqesSize, IORING_OFF_SQES));
+        if (!sqes) return false;
+
+        char* sq = static_cast<char*>(sqRing);
+        char* cq = static_cast<char*>(cqRing);
+        sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sqMask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cqMask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        entries = params.sq_entries;
+        queued = 0;
+
+        return Supported();
+    }
+
+    // Open/read/write/close requests arrived in Linux 5.6; older kernels
+    // can set up a ring but not run these batches
+    bool Supported() {
+        const unsigned ops = 256;
+        std::vector<char> storage(sizeof(io_uring_probe) + ops * sizeof(io_uring_probe_op), 0);
+        io_uring_probe* probe = reinterpret_cast<io_uring_probe*>(storage.data());
+        if (RegisterRing(fd, IORING_REGISTER_PROBE, probe, ops) < 0) return false;
+
+        const unsigned needed[] = {IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_WRITE, IORING_OP_CLOSE};
+        for (unsigned op : needed) {
+            if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) return false;
+        }
+        return true;
+    }
+
+    void* Map(size_t size, off_t offset) {
+        void* addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+        return addr == MAP_FAILED ? nullptr : addr;
+    }
+
+    void Close() {
+        if (sqes) munmap(sqes, sqesSize);
+        if (cqRing && cqRing != sqRing) munmap(cqRing, cqRingSize);
+        if (sqRing) munmap(sqRing, sqRingSize);
+        if (fd >= 0) close(fd);
+        sqes = nullptr;
+        sqRing = cqRing = nullptr;
+        fd = -1;
+    }
+
+    int fd;
+    bool failed;
+    void* sqRing;
+    void* cqRing;
+    size_t sqRingSize;
+    size_t cqRingSize;
+    io_uring_sqe* sqes;
+    size_t sqesSize;
+    unsigned entries;
+    unsigned queued;
+
+    unsigned* sqTail;
+    unsigned* sqMask;
+    unsigned* sqArray;
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned* cqMask;
+    io_uring_cqe* cqes;
+};
+
+thread_local Ring ring;
+
+void QueueOpen(size_t slot, const std::string& path, int flags) {
+    io_uring_sqe* sqe = ring.Next(slot);
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = reinterpret_cast<unsigned long long>(path.c_str());
+    sqe->len = 0644;
+    sqe->open_flags = static_cast<unsigned>(flags | O_CLOEXEC);
+}
+
+void QueueClose(size_t slot, int fd) {
+    io_uring_sqe* sqe = ring.Next(slot);
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = fd;
+}
+
+// Read or write the buffer in one request at offset 0
+void QueueTransfer(size_t slot, int fd, unsigned char opcode, char* data, size_t size) {
+    io_uring_sqe* sqe = ring.Next(slot);
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<unsigned long long>(data);
+    sqe->len = static_cast<unsigned>(size);
+    sqe->off = 0;
+}
+
+// After a failed round, close the files the ring opened and did not close
+// itself, so the synchronous retry does not leak their descriptors
+void CloseOpened(const std::vector<int>& opened, const std::vector<int>& closed) {
+    for (size_t i = 0; i < opened.size(); ++i) {
+        if (opened[i] >= 0 && closed[i] == -1) close(opened[i]);
+    }
+}
+
+// Open, transfer and close files [first, first + count) through the ring.
+// done[i] is left false for files that still need the synchronous path.
+bool RunRounds(std::vector<FileManager::BatchFile>& files, size_t first, size_t count, bool write,
+               std::vector<bool>& done) {
+    std::vector<int> opened(count, -1);
+    std::vector<int> transferred(count, -1);
+    std::vector<int> closed(count, -1);
+
+    size_t queued = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const FileManager::BatchFile& file = files[first + i];
+        unsigned long long size = write ? file.data.size() : file.size;
+        if (size >= kMaxTransfer) continue;
+        QueueOpen(i, file.path, write ? (O_WRONLY | O_CREAT | O_TRUNC) : O_RDONLY);
+        queued++;
+    }
+    if (queued && !ring.Submit(opened)) {
+        CloseOpened(opened, closed); // Some opens may have completed
+        return false;
+    }
+
+    queued = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (opened[i] < 0) continue;
+        FileManager::BatchFile& file = files[first + i];
+        if (write) {
+            QueueTransfer(i, opened[i], IORING_OP_WRITE, file.data.data(), file.data.size());
+        } else {
+            // One byte more than expected tells a file that grew since the walk
+            file.data.resize(static_cast<size_t>(file.size) + 1);
+            QueueTransfer(i, opened[i], IORING_OP_READ, file.data.data(), file.data.size());
+        }
+        queued++;
+    }
+    if (queued && !ring.Submit(transferred)) {
+        CloseOpened(opened, closed);
+        return false;
+    }
+
+    queued = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (opened[i] < 0) continue;
+        QueueClose(i, opened[i]);
+        queued++;
+    }
+    if (queued && !ring.Submit(closed)) {
+        CloseOpened(opened, closed);
+        return false;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        FileManager::BatchFile& file = files[first + i];
+        if (opened[i] < 0 || transferred[i] < 0 || closed[i] < 0) continue;
+
+        size_t got = static_cast<size_t>(transferred[i]);
+        if (write) {
+            done[first + i] = (got == file.data.size()); // Short write: redo it the ordinary way
+        } else if (got < file.data.size()) {
+            file.data.resize(got);
+            done[first + i] = true;
+        }
+        file.ok = done[first + i];
+    }
+    return true;
+}
+
+void RunBatch(std::vector<FileManager::BatchFile>& files, bool write) {
+    std::vector<bool> done(files.size(), false);
+
+    if (ring.Ready()) {
+        size_t step = ring.Entries();
+        for (size_t first = 0; first < files.size(); first += step) {
+            size_t count = files.size() - first < step ? files.size() - first : step;
+            if (!RunRounds(files, first, count, write, done)) break;
+        }
+    }
+
+    for (size_t i = 0; i < files.size(); ++i) {
+        if (done[i]) continue;
+        files[i].ok = write ? FileManager::WriteFileContent(files[i].path, files[i].data)
+                            : FileManager::ReadFileContent(files[i].path, files[i].data);
+    }
+}
+
+} // namespace
+
+bool FileManager::AsyncIOAvailable() {
+    return ring.Ready();
+}
+
+void FileManager::ReadBatch(std::vector<BatchFile>& files) {
+    RunBatch(files, false);
+}
+
+void FileManager::WriteBatch(std::vector<BatchFile>& files) {
+    RunBatch(files, true);
+}
+
+#endif // __linux__
@@ -0,0 +1,160 @@
+#include "Manifest.h"
+#include "Checksum.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+const char* const Manifest::FileName = ".so_manifest";
+
+namespace {
+
+const char kHeader[] = "so_manifest 1";
+const char kHexDigits[] = "0123456789abcdef";
+
+int HexValue(char ch) {
+    if (ch >= '0' && ch <= '9') return ch - '0';
+    if (ch >= 'a' && ch <= 'f') return ch - 'a' + 10;
+    return -1;
+}
+
+// One decimal field followed by a space
+bool ParseNumber(const char*& p, unsigned long long& value) {
+    char* end = nullptr;
+    value = std::strtoull(p, &end, 10);
+    if (end == p || *end != ' ') return false;
+    p = end + 1;
+    return true;
+}
+
+// One "<size> <modified> <hash> <output size> <name>" line
+bool ParseEntry(const std::string& line, std::string& name, Manifest::Entry& entry) {
+    const char* p = line.c_str();
+    if (!ParseNumber(p, entry.size) || !ParseNumber(p, entry.modified)) return false;
+    for (size_t i = 0; i < Checksum::Sha256Size; ++i) {
+        int high = HexValue(p[2 * i]);
+        int low = high < 0 ? -1 : HexValue(p[2 * i + 1]);
+        if (low < 0) return false;
+        entry.hash[i] = static_cast<unsigned char>(high << 4 | low);
+    }
+    p += 2 * Checksum::Sha256Size;
+    if (*p++ != ' ' || !ParseNumber(p, entry.outputSize) || *p == '\0') return false;
+    name = p;
+    return true;
+}
+
+} // namespace
+
+void Manifest::Load(const std::string& directory, const std::string& options) {
+    path = FileManager::CreateOutputPath(FileName, directory, "");
+    this->options = options;
+    previous.clear();
+
+    unsigned long long size = 0;
+    std::vector<char> content;
+    if (!FileManager::GetFileSize(path, size) || !FileManager::ReadFileContent(path, content)) return;
+
+    std::string text(content.begin(), content.end());
+    size_t start = 0;
+    size_t lineNumber = 0;
+    std::map<std::string, Entry> entries;
+    while (start < text.size()) {
+        size_t newline = text.find('\n', start);
+        if (newline == std::string::npos) return; // Cut short: ignore it all
+        std::string line = text.substr(start, newline - start);
+        start = newline + 1;
+
+        if (lineNumber == 0 && line != kHeader) return;
+        if (lineNumber == 1 && line != "options " + options) return;
+        if (lineNumber >= 2) {
+            std::string file;
+            Entry entry;
+            if (!ParseEntry(line, file, entry)) return;
+            entries[file] = entry;
+        }
+        lineNumber++;
+    }
+    previous.swap(entries);
+}
+
+const Manifest::Entry* Manifest::Find(const std::string& name) const {
+    auto it = previous.find(name);
+    return it == previous.end() ? nullptr : &it->second;
+}
+
+bool Manifest::IsUnchanged(const std::string& name, const FileManager::FileEntry& file, const std::string& outputPath,
+                           Entry& entry) const {
+    const Entry* old = Find(name);
+    if (!old || old->size != file.size || old->modified != file.modified) return false;
+    unsigned long long outputSize = 0;
+    if (!FileManager::GetFileSize(outputPath, outputSize) || outputSize != old->outputSize) return false;
+    entry = *old;
+    return true;
+}
+
+Manifest::Change Manifest::Check(const std::string& name, const FileManager::FileEntry& file,
+                                 const std::string& outputPath, Entry& entry) const {
+    if (IsUnchanged(name, file, outputPath, entry)) return Unchanged;
+
+    entry = Entry();
+    entry.size = file.size;
+    entry.modified = file.modified;
+
+    const Entry* old = Find(name);
+    unsigned long long outputSize = 0;
+    bool intact = old && FileManager::GetFileSize(outputPath, outputSize) && outputSize == old->outputSize;
+
+    FileManager::FileView view;
+    if (!FileManager::OpenView(file.path, view, true)) return Changed;
+    entry.size = view.Size();
+
+    // A grown file is hashed in one pass, taking the digest of the old
+    // length on the way to compare it
+    Checksum::Sha256Hasher hasher;
+    unsigned char prefix[Checksum::Sha256Size];
+    bool grown = intact && view.Size() > old->size;
+    if (grown) {
+        hasher.Update(view.Data(), static_cast<size_t>(old->size));
+        hasher.Digest(prefix);
+        hasher.Update(view.Data() + old->size, static_cast<size_t>(view.Size() - old->size));
+    } else {
+        hasher.Update(view.Data(), view.Size());
+    }
+    hasher.Digest(entry.hash);
+
+    if (!intact) return Changed;
+    if (old->size == entry.size && std::memcmp(old->hash, entry.hash, sizeof(entry.hash)) == 0) {
+        entry.outputSize = old->outputSize;
+        return Unchanged;
+    }
+    return grown && std::memcmp(prefix, old->hash, sizeof(prefix)) == 0 ? Appended : Changed;
+}
+
+void Manifest::Hash(const char* data, size_t size, unsigned char hash[Checksum::Sha256Size]) {
+    Checksum::Sha256(data, size, hash);
+}
+
+void Manifest::Record(const std::string& name, const Entry& entry) {
+    // The format is line based; such a name is simply done every run
+    if (name.find_first_of("\r\n") != std::string::npos) return;
+    Concurrency::ScopedLock lock(mutex);
+    next[name] = entry;
+}
+
+bool Manifest::Save() {
+    Concurrency::ScopedLock lock(mutex);
+    std::string text = std::string(kHeader) + "\noptions " + options + "\n";
+    for (const auto& item : next) {
+        std::string hash;
+        for (unsigned char byte : item.second.hash) {
+            hash += kHexDigits[byte >> 4];
+            hash += kHexDigits[byte & 15];
+        }
+        char size[48];
+        char outputSize[24];
+        std::snprintf(size, sizeof(size), "%llu %llu ", item.second.size, item.second.modified);
+        std::snprintf(outputSize, sizeof(outputSize), " %llu ", item.second.outputSize);
+        text += size + hash + outputSize + item.first + "\n";
+    }
+    return FileManager::WriteFileContent(path, text.data(), text.size());
+}
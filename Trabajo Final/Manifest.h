@@ -0,0 +1,89 @@
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include "Checksum.h"
+#include "Concurrency.h"
+#include "FileManager.h"
+
+// Incremental runs (--incremental). A manifest in the output directory
+// records, for every input file whose output is up to date, what the
+// source looked like when that output was written: size, modification
+// time and a SHA-256 of the contents. The next run compares each file
+// against it:
+//
+//   unchanged  same size and time, or only the time moved and the contents
+//              still hash the same (a touch, a copy); the output must still
+//              be there at the size recorded. Nothing to do.
+//   appended   larger, and its first `size` bytes still hash as recorded:
+//              only the new bytes need encoding (BlockFormat::AppendFile)
+//   changed    anything else, including files not in the manifest
+//
+// Files are listed by their name relative to the input directory, so the
+// same tree given as "./logs" or "logs", or from another directory, still
+// matches. The manifest also records the run's options; one written with other
+// options (operations, algorithm, cipher, block size) is ignored, so every
+// file is done again. The key is not recorded: after changing it, delete
+// the manifest.
+//
+// Text, one file per line after two header lines:
+//   so_manifest 1
+//   options <options>
+//   <size> <modified> <sha-256, hex> <output size> <name>
+//
+// A CRC would do to spot accidents, but a skipped or appended file is
+// never read again, so the hash has to stand up to collisions too.
+class Manifest {
+public:
+    static const char* const FileName; // Inside the output directory
+
+    struct Entry {
+        unsigned long long size = 0;
+        unsigned long long modified = 0; // FileManager::FileEntry::modified
+        unsigned char hash[Checksum::Sha256Size] = {0}; // SHA-256 of the contents
+        unsigned long long outputSize = 0;
+    };
+
+    enum Change { Unchanged, Appended, Changed };
+
+    // Read the manifest in directory. A missing or damaged one, or one
+    // written with other options, leaves this manifest empty.
+    void Load(const std::string& directory, const std::string& options);
+
+    // Unchanged by size and time alone; the file is not read. On true,
+    // entry is the file's entry for the next manifest. name is the file's
+    // name relative to the input, as recorded.
+    bool IsUnchanged(const std::string& name, const FileManager::FileEntry& file, const std::string& outputPath,
+                     Entry& entry) const;
+
+    // Classify a file, hashing its contents when size and time are not
+    // enough. entry gets the file's size, time and hash as read now;
+    // outputSize is left for the caller once the output is written.
+    Change Check(const std::string& name, const FileManager::FileEntry& file, const std::string& outputPath,
+                 Entry& entry) const;
+
+    // Contents hash of a file already in memory (batched files)
+    static void Hash(const char* data, size_t size, unsigned char hash[Checksum::Sha256Size]);
+
+    // Keep name's entry in the next manifest; safe from any thread
+    void Record(const std::string& name, const Entry& entry);
+
+    // Write the recorded entries over the old manifest. Files that were not
+    // recorded (failed, or gone from the input) are left out, so the next
+    // run does them again.
+    bool Save();
+
+private:
+    const Entry* Find(const std::string& name) const;
+
+    std::string path;    // Of the manifest file
+    std::string options; // Of this run
+    std::map<std::string, Entry> previous;
+    Concurrency::Mutex mutex; // Guards next
+    std::map<std::string, Entry> next;
+};
+
+#endif // MANIFEST_H
@@ -0,0 +1,288 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "Compression.h"
+#include "Encryption.h"
+#include "FileManager.h"
+#include "Report.h"
+#include <cstring>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+// The legacy (unframed) RLE and Vigenère transforms, fused: instead of
+// running each one over the whole file and keeping every intermediate
+// result, a pipeline takes the input a chunk at a time and passes each
+// chunk through all its stages while it is still in cache. The stages are
+// template parameters, so the chain is resolved at compile time:
+//
+//   Pipeline<ReadStage, CompressStage, EncryptStage, WriteStage>   (-ce)
+//
+// A pipeline is a source, any number of transforms and a sink:
+//
+//   source     bool Next(const char*& data, size_t& size)
+//              false once the input is exhausted
+//   transform  Kind: the Report::Stage its time counts towards
+//              InPlace = true:  void Apply(const char* in, char* out, size_t size)
+//                               out may be in; the size does not change
+//              InPlace = false: size_t Apply(const char* in, size_t size, std::vector<char>& out)
+//                               size_t Finish(std::vector<char>& out)
+//                               results go to out[0..returned size); out is
+//                               reused from chunk to chunk. Finish returns
+//                               whatever was held back at the end.
+//   sink       bool Write(const char* data, size_t size), bool Finish()
+//
+// Transforms carry their state across chunks (the Vigenère key position,
+// the RLE run or pair that straddles a chunk boundary), so the output is
+// byte for byte that of the whole-file functions.
+
+// Input consumed per step: the chunk and the RLE output (up to twice as
+// large) stay in L2
+const size_t PipelineChunkSize = 64 << 10;
+
+template <class... Stages>
+class Pipeline {
+public:
+    explicit Pipeline(Stages... stages) : stages(std::move(stages)...) {}
+
+    // Push the whole input through; false if the sink fails. With stats,
+    // each transform's time is added to its stage.
+    bool Run(Report::FileStats* stats = nullptr) {
+        this->stats = stats;
+        const char* data;
+        size_t size;
+        while (std::get<0>(stages).Next(data, size)) {
+            if (!Push<1>(data, size, nullptr)) return false;
+        }
+        return Flush<1>();
+    }
+
+private:
+    static constexpr size_t Last = sizeof...(Stages) - 1;
+    static_assert(sizeof...(Stages) >= 2, "a pipeline needs a source and a sink");
+
+    // Hand a chunk to stage I. owned is data again when the chunk sits in
+    // one of the pipeline's buffers, so an in-place stage may overwrite it;
+    // it is null for chunks still in the source's memory.
+    template <size_t I>
+    bool Push(const char* data, size_t size, char* owned) {
+        auto& stage = std::get<I>(stages);
+        using Stage = typename std::tuple_element<I, std::tuple<Stages...>>::type;
+        if constexpr (I == Last) {
+            return stage.Write(data, size);
+        } else if constexpr (Stage::InPlace) {
+            char* out = owned;
+            if (!out) {
+                if (buffers[I].size() < size) buffers[I].resize(size);
+                out = buffers[I].data();
+            }
+            {
+                Report::Timer timer(stats, Stage::Kind, size);
+                stage.Apply(data, out, size);
+            }
+            return Push<I + 1>(out, size, out);
+        } else {
+            size_t produced;
+            {
+                Report::Timer timer(stats, Stage::Kind, size);
+                produced = stage.Apply(data, size, buffers[I]);
+            }
+            if (produced == 0) return true;
+            return Push<I + 1>(buffers[I].data(), produced, buffers[I].data());
+        }
+    }
+
+    // Drain what the stages from I on still hold, in order
+    template <size_t I>
+    bool Flush() {
+        auto& stage = std::get<I>(stages);
+        using Stage = typename std::tuple_element<I, std::tuple<Stages...>>::type;
+        if constexpr (I == Last) {
+            return stage.Finish();
+        } else {
+            if constexpr (!Stage::InPlace) {
+                size_t produced;
+                {
+                    Report::Timer timer(stats, Stage::Kind, 0);
+                    produced = stage.Finish(buffers[I]);
+                }
+                if (produced && !Push<I + 1>(buffers[I].data(), produced, buffers[I].data())) return false;
+            }
+            return Flush<I + 1>();
+        }
+    }
+
+    std::tuple<Stages...> stages;
+    std::vector<char> buffers[sizeof...(Stages)]; // Output of each transform
+    Report::FileStats* stats = nullptr;
+};
+
+// Source: memory the caller owns, such as a mapped file
+class ReadStage {
+public:
+    ReadStage(const char* data, size_t size) : data(data), remaining(size) {}
+
+    bool Next(const char*& chunk, size_t& size) {
+        if (remaining == 0) return false;
+        size = remaining < PipelineChunkSize ? remaining : PipelineChunkSize;
+        chunk = data;
+        data += size;
+        remaining -= size;
+        return true;
+    }
+
+private:
+    const char* data;
+    size_t remaining;
+};
+
+// RLE as in Compression::CompressRLE. A chunk's last run may go on in the
+// next chunk, so it is held back until a different byte shows up.
+class CompressStage {
+public:
+    static constexpr Report::Stage Kind = Report::StageCompress;
+    static constexpr bool InPlace = false;
+
+    size_t Apply(const char* in, size_t size, std::vector<char>& out) {
+        out.clear();
+        size_t lead = 0;
+        if (pending) {
+            while (lead < size && in[lead] == value) lead++;
+            if (lead == size) {
+                pending += size;
+                return 0;
+            }
+            PutRun(value, pending + lead, out);
+        }
+
+        // The chunk always ends in a run; hold it back
+        size_t tail = 1;
+        while (tail < size - lead && in[size - 1 - tail] == in[size - 1]) tail++;
+        Compression::CompressRLE(in + lead, size - lead - tail, out);
+        value = in[size - 1];
+        pending = tail;
+        return out.size();
+    }
+
+    size_t Finish(std::vector<char>& out) {
+        out.clear();
+        if (pending) PutRun(value, pending, out);
+        pending = 0;
+        return out.size();
+    }
+
+private:
+    // Same pairing as the whole-file encoder: pairs of 255, then the rest
+    static void PutRun(char value, size_t length, std::vector<char>& out) {
+        for (; length > 0; length -= length < 255 ? length : 255) {
+            out.push_back(value);
+            out.push_back(static_cast<char>(length < 255 ? length : 255));
+        }
+    }
+
+    char value = 0;
+    size_t pending = 0; // Length of the held-back run of value
+};
+
+// RLE decoding; a chunk of odd size ends inside a pair, whose first byte
+// waits for the next chunk
+class DecompressStage {
+public:
+    static constexpr Report::Stage Kind = Report::StageDecompress;
+    static constexpr bool InPlace = false;
+
+    size_t Apply(const char* in, size_t size, std::vector<char>& out) {
+        size_t produced = 0;
+        if (hasCarry) {
+            unsigned char count = static_cast<unsigned char>(in[0]);
+            if (out.size() < count) out.resize(count);
+            std::memset(out.data(), carry, count);
+            produced = count;
+            in++;
+            size--;
+            hasCarry = false;
+        }
+        if (size % 2 != 0) {
+            carry = in[size - 1];
+            hasCarry = true;
+            size--;
+        }
+        return Compression::DecompressRLE(in, size, out, produced);
+    }
+
+    // A lone trailing byte is ignored, as in the whole-file decoder
+    size_t Finish(std::vector<char>&) { return 0; }
+
+private:
+    bool hasCarry = false;
+    char carry = 0;
+};
+
+// Vigenère, the key position carried from chunk to chunk
+template <bool Decrypt>
+class VigenereStage {
+public:
+    static constexpr Report::Stage Kind = Decrypt ? Report::StageDecrypt : Report::StageEncrypt;
+    static constexpr bool InPlace = true;
+
+    explicit VigenereStage(const std::string& key) : key(key), offset(0) {}
+
+    void Apply(const char* in, char* out, size_t size) {
+        if (Decrypt) {
+            Encryption::Decrypt(Encryption::CipherVigenere, in, out, size, key, 0, offset);
+        } else {
+            Encryption::Encrypt(Encryption::CipherVigenere, in, out, size, key, 0, offset);
+        }
+        offset += size;
+    }
+
+private:
+    std::string key;
+    unsigned long long offset;
+};
+
+typedef VigenereStage<false> EncryptStage;
+typedef VigenereStage<true> DecryptStage;
+
+// Sink: a file, through a FileWriter the caller opened and finishes
+class WriteStage {
+public:
+    explicit WriteStage(FileManager::FileWriter& writer, Report::FileStats* stats = nullptr)
+        : writer(&writer), stats(stats) {}
+
+    bool Write(const char* data, size_t size) {
+        Report::Timer timer(stats, Report::StageWrite, size);
+        return writer->Write(data, size);
+    }
+    bool Finish() { return true; }
+
+private:
+    FileManager::FileWriter* writer;
+    Report::FileStats* stats;
+};
+
+// Sink: appended to a buffer (files of an --io-uring batch)
+class AppendStage {
+public:
+    explicit AppendStage(std::vector<char>& out) : out(&out) {}
+
+    bool Write(const char* data, size_t size) {
+        out->insert(out->end(), data, data + size);
+        return true;
+    }
+    bool Finish() { return true; }
+
+private:
+    std::vector<char>* out;
+};
+
+// The legacy operations that have a fused pipeline, by Sink
+template <class Sink> using CompressPipeline = Pipeline<ReadStage, CompressStage, Sink>;               // -c
+template <class Sink> using EncryptPipeline = Pipeline<ReadStage, EncryptStage, Sink>;                 // -e
+template <class Sink> using CompressEncryptPipeline = Pipeline<ReadStage, CompressStage, EncryptStage, Sink>; // -ce
+template <class Sink> using DecompressPipeline = Pipeline<ReadStage, DecompressStage, Sink>;           // -d
+template <class Sink> using DecryptPipeline = Pipeline<ReadStage, DecryptStage, Sink>;                 // -u
+template <class Sink> using DecryptDecompressPipeline = Pipeline<ReadStage, DecryptStage, DecompressStage, Sink>; // -ud
+
+#endif // PIPELINE_H
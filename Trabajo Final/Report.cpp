@@ -0,0 +1,217 @@
+#include "Report.h"
+#include "FileManager.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+namespace {
+
+double Milliseconds(uint64_t ns) {
+    return ns / 1e6;
+}
+
+double MegabytesPerSecond(unsigned long long bytes, uint64_t ns) {
+    return ns ? bytes / (ns / 1e9) / 1e6 : 0.0;
+}
+
+std::string Format(const char* format, double value) {
+    char text[64];
+    std::snprintf(text, sizeof(text), format, value);
+    return text;
+}
+
+std::string JsonString(const std::string& text) {
+    std::string out = "\"";
+    for (char ch : text) {
+        unsigned char c = static_cast<unsigned char>(ch);
+        if (ch == '"' || ch == '\\') {
+            out += '\\';
+            out += ch;
+        } else if (c < 0x20) {
+            char escape[8];
+            std::snprintf(escape, sizeof(escape), "\\u%04x", c);
+            out += escape;
+        } else {
+            out += ch;
+        }
+    }
+    return out + "\"";
+}
+
+std::string CsvField(const std::string& text) {
+    if (text.find_first_of(",\"\r\n") == std::string::npos) return text;
+    std::string out = "\"";
+    for (char ch : text) {
+        if (ch == '"') out += '"';
+        out += ch;
+    }
+    return out + "\"";
+}
+
+bool EndsWith(const std::string& text, const std::string& suffix) {
+    return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// What the whole run adds up to
+struct Totals {
+    size_t files = 0;
+    size_t failed = 0;
+    unsigned long long bytesIn = 0;
+    unsigned long long bytesOut = 0;
+    uint64_t queueWait = 0;
+    uint64_t stageTime[Report::StageCount] = {0};
+    unsigned long long stageBytes[Report::StageCount] = {0};
+};
+
+std::string WriteJson(const Totals& totals, const std::vector<const Report::FileStats*>& slowest, size_t threads,
+                      uint64_t wall) {
+    std::string out = "{\n";
+    out += "  \"files\": " + std::to_string(totals.files) + ",\n";
+    out += "  \"failed\": " + std::to_string(totals.failed) + ",\n";
+    out += "  \"threads\": " + std::to_string(threads) + ",\n";
+    out += "  \"wall_ms\": " + Format("%.3f", Milliseconds(wall)) + ",\n";
+    out += "  \"bytes_in\": " + std::to_string(totals.bytesIn) + ",\n";
+    out += "  \"bytes_out\": " + std::to_string(totals.bytesOut) + ",\n";
+    out += "  \"mb_per_s\": " + Format("%.1f", MegabytesPerSecond(totals.bytesIn, wall)) + ",\n";
+    out += "  \"queue_wait_ms\": " + Format("%.3f", Milliseconds(totals.queueWait)) + ",\n";
+
+    out += "  \"stages\": {\n";
+    for (int s = 0; s < Report::StageCount; ++s) {
+        out += "    " + JsonString(Report::StageName(static_cast<Report::Stage>(s))) + ": {";
+        out += "\"ms\": " + Format("%.3f", Milliseconds(totals.stageTime[s]));
+        out += ", \"bytes\": " + std::to_string(totals.stageBytes[s]);
+        out += ", \"mb_per_s\": " + Format("%.1f", MegabytesPerSecond(totals.stageBytes[s], totals.stageTime[s]));
+        out += s + 1 < Report::StageCount ? "},\n" : "}\n";
+    }
+    out += "  },\n";
+
+    out += "  \"slowest\": [";
+    for (size_t i = 0; i < slowest.size(); ++i) {
+        const Report::FileStats& file = *slowest[i];
+        out += i ? ",\n    {" : "\n    {";
+        out += "\"path\": " + JsonString(file.path);
+        out += ", \"thread\": " + std::to_string(file.thread);
+        out += std::string(", \"ok\": ") + (file.ok ? "true" : "false");
+        out += ", \"bytes_in\": " + std::to_string(file.bytesIn);
+        out += ", \"bytes_out\": " + std::to_string(file.bytesOut);
+        out += ", \"queue_ms\": " + Format("%.3f", Milliseconds(file.queueWait));
+        out += ", \"wall_ms\": " + Format("%.3f", Milliseconds(file.wall));
+        out += ", \"stages_ms\": {";
+        for (int s = 0; s < Report::StageCount; ++s) {
+            if (s) out += ", ";
+            out += JsonString(Report::StageName(static_cast<Report::Stage>(s))) + ": " +
+                   Format("%.3f", Milliseconds(file.stageTime[s].load()));
+        }
+        out += "}}";
+    }
+    out += slowest.empty() ? "]\n" : "\n  ]\n";
+    out += "}\n";
+    return out;
+}
+
+// One table: a total row, a row per stage, then the slowest files.
+// Cells that do not apply to a row's section are left empty.
+std::string WriteCsv(const Totals& totals, const std::vector<const Report::FileStats*>& slowest, size_t threads,
+                     uint64_t wall) {
+    std::string out = "section,name,thread,ok,bytes_in,bytes_out,queue_ms,wall_ms,mb_per_s";
+    for (int s = 0; s < Report::StageCount; ++s) {
+        out += std::string(",") + Report::StageName(static_cast<Report::Stage>(s)) + "_ms";
+    }
+    out += "\n";
+
+    out += "total," + std::to_string(totals.files) + " files," + std::to_string(threads) + "," +
+           (totals.failed ? "0" : "1") + "," + std::to_string(totals.bytesIn) + "," +
+           std::to_string(totals.bytesOut) + "," + Format("%.3f", Milliseconds(totals.queueWait)) + "," +
+           Format("%.3f", Milliseconds(wall)) + "," + Format("%.1f", MegabytesPerSecond(totals.bytesIn, wall));
+    for (int s = 0; s < Report::StageCount; ++s) out += "," + Format("%.3f", Milliseconds(totals.stageTime[s]));
+    out += "\n";
+
+    for (int s = 0; s < Report::StageCount; ++s) {
+        out += std::string("stage,") + Report::StageName(static_cast<Report::Stage>(s)) + ",,," +
+               std::to_string(totals.stageBytes[s]) + ",,," + Format("%.3f", Milliseconds(totals.stageTime[s])) +
+               "," + Format("%.1f", MegabytesPerSecond(totals.stageBytes[s], totals.stageTime[s]));
+        out += std::string(Report::StageCount, ',') + "\n";
+    }
+
+    for (const Report::FileStats* file : slowest) {
+        out += "file," + CsvField(file->path) + "," + std::to_string(file->thread) + "," + (file->ok ? "1" : "0") +
+               "," + std::to_string(file->bytesIn) + "," + std::to_string(file->bytesOut) + "," +
+               Format("%.3f", Milliseconds(file->queueWait)) + "," + Format("%.3f", Milliseconds(file->wall)) + "," +
+               Format("%.1f", MegabytesPerSecond(file->bytesIn, file->wall));
+        for (int s = 0; s < Report::StageCount; ++s) {
+            out += "," + Format("%.3f", Milliseconds(file->stageTime[s].load()));
+        }
+        out += "\n";
+    }
+    return out;
+}
+
+} // namespace
+
+const char* Report::StageName(Stage stage) {
+    switch (stage) {
+    case StageRead: return "read";
+    case StageCompress: return "compress";
+    case StageEncrypt: return "encrypt";
+    case StageDecrypt: return "decrypt";
+    case StageDecompress: return "decompress";
+    case StageChecksum: return "checksum";
+    case StageWrite: return "write";
+    default: return "unknown";
+    }
+}
+
+uint64_t Report::Now() {
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+            .count());
+}
+
+Report::FileStats::FileStats() {
+    for (int s = 0; s < StageCount; ++s) {
+        stageTime[s] = 0;
+        stageBytes[s] = 0;
+    }
+}
+
+void Report::FileStats::Add(Stage stage, uint64_t time, unsigned long long bytes) {
+    stageTime[stage].fetch_add(time, std::memory_order_relaxed);
+    stageBytes[stage].fetch_add(bytes, std::memory_order_relaxed);
+}
+
+Report::FileStats* Report::AddFile(const std::string& path) {
+    Concurrency::ScopedLock lock(mutex);
+    files.emplace_back();
+    FileStats* stats = &files.back();
+    stats->path = path;
+    stats->submitted = Now();
+    return stats;
+}
+
+bool Report::Write(const std::string& path, size_t top, size_t threads, uint64_t wall) {
+    Concurrency::ScopedLock lock(mutex);
+
+    Totals totals;
+    std::vector<const FileStats*> slowest;
+    for (const FileStats& file : files) {
+        totals.files++;
+        if (!file.ok) totals.failed++;
+        totals.bytesIn += file.bytesIn;
+        totals.bytesOut += file.bytesOut;
+        totals.queueWait += file.queueWait;
+        for (int s = 0; s < StageCount; ++s) {
+            totals.stageTime[s] += file.stageTime[s].load();
+            totals.stageBytes[s] += file.stageBytes[s].load();
+        }
+        slowest.push_back(&file);
+    }
+
+    std::stable_sort(slowest.begin(), slowest.end(),
+                     [](const FileStats* a, const FileStats* b) { return a->wall > b->wall; });
+    if (slowest.size() > top) slowest.resize(top);
+
+    std::string text = EndsWith(path, ".csv") ? WriteCsv(totals, slowest, threads, wall)
+                                              : WriteJson(totals, slowest, threads, wall);
+    return FileManager::WriteFileContent(path, text.data(), text.size());
+}
@@ -0,0 +1,93 @@
+#ifndef REPORT_H
+#define REPORT_H
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include "Concurrency.h"
+
+// Run report (--report): where the time of a run went, per file and per
+// stage, so a slow run can be traced to reads, a transform or writes
+// without an external profiler.
+//
+// Every file gets a FileStats. The code doing a stage's work wraps it in a
+// Report::Timer, which adds the elapsed monotonic time and the bytes the
+// stage consumed to that file's totals. With a null FileStats the timers do
+// nothing, so runs without --report pay only a pointer test.
+//
+// The blocks of one file run on several workers at once, so a file's stage
+// times add up worker time and can exceed its wall time. Mapped inputs are
+// read by page faults inside whichever stage first touches them; only
+// explicit reads (pipes, --stream, --io-uring batches) count as reads.
+class Report {
+public:
+    enum Stage {
+        StageRead,
+        StageCompress,
+        StageEncrypt,
+        StageDecrypt,
+        StageDecompress,
+        StageChecksum,
+        StageWrite,
+        StageCount
+    };
+
+    static const char* StageName(Stage stage);
+
+    // Monotonic clock (steady_clock), in nanoseconds from an arbitrary start
+    static uint64_t Now();
+
+    // Everything measured for one file. Stage totals are atomic: the
+    // file's blocks add to them from several workers.
+    struct FileStats {
+        std::string path;
+        int thread = -1;                 // Pool worker that ran the file; -1 outside the pool
+        bool ok = false;
+        unsigned long long bytesIn = 0;
+        unsigned long long bytesOut = 0;
+        uint64_t submitted = 0;          // Now() when queued
+        uint64_t queueWait = 0;          // Queued until a worker picked it up (ns)
+        uint64_t wall = 0;               // Picked up until done (ns)
+        std::atomic<uint64_t> stageTime[StageCount];  // ns
+        std::atomic<uint64_t> stageBytes[StageCount]; // Bytes each stage consumed
+
+        FileStats();
+        void Add(Stage stage, uint64_t time, unsigned long long bytes);
+    };
+
+    // Times the enclosing scope as one stage of a file's work
+    class Timer {
+    public:
+        Timer(FileStats* stats, Stage stage, unsigned long long bytes)
+            : stats(stats), stage(stage), bytes(bytes), start(stats ? Now() : 0) {}
+        ~Timer() {
+            if (stats) stats->Add(stage, Now() - start, bytes);
+        }
+
+        // For work whose size is only known once done, such as a read
+        void SetBytes(unsigned long long count) { bytes = count; }
+
+    private:
+        Timer(const Timer&) = delete;
+        Timer& operator=(const Timer&) = delete;
+        FileStats* stats;
+        Stage stage;
+        unsigned long long bytes;
+        uint64_t start;
+    };
+
+    // A new record for path, stamped as submitted now. It stays valid for
+    // the report's lifetime; safe to call from any thread.
+    FileStats* AddFile(const std::string& path);
+
+    // Totals, throughput per stage and the `top` slowest files. CSV if path
+    // ends in ".csv", JSON otherwise. wall is the run's wall time (ns).
+    bool Write(const std::string& path, size_t top, size_t threads, uint64_t wall);
+
+private:
+    Concurrency::Mutex mutex;
+    std::deque<FileStats> files; // A deque never moves its elements
+};
+
+#endif // REPORT_H
@@ -0,0 +1,236 @@
+#include "Streaming.h"
+#include "FileManager.h"
+#include "Concurrency.h"
+#include "Compression.h"
+#include "Encryption.h"
+#include <atomic>
+#include <deque>
+#include <vector>
+#include <iostream>
+
+namespace {
+
+// Buffers in flight between two stages. Three per side lets the reader fill
+// one block while the transform works on another and the writer drains a third.
+const size_t kBuffersPerStage = 3;
+
+// Queue of buffers handed from one stage to the next
+class BufferQueue {
+public:
+    BufferQueue() : closed(false) {}
+
+    void Push(std::vector<char>* buffer) {
+        {
+            Concurrency::ScopedLock lock(mutex);
+            items.push_back(buffer);
+        }
+        changed.Signal();
+    }
+
+    // Returns false once the queue is closed and drained
+    bool Pop(std::vector<char>*& buffer) {
+        Concurrency::ScopedLock lock(mutex);
+        while (items.empty() && !closed) {
+            changed.Wait(mutex);
+        }
+        if (items.empty()) return false;
+        buffer = items.front();
+        items.pop_front();
+        return true;
+    }
+
+    // No more buffers will be pushed; wakes every waiter
+    void Close() {
+        {
+            Concurrency::ScopedLock lock(mutex);
+            closed = true;
+        }
+        changed.Broadcast();
+    }
+
+private:
+    Concurrency::Mutex mutex;
+    Concurrency::Condition changed;
+    std::deque<std::vector<char>*> items;
+    bool closed;
+};
+
+// Everything the three stages of one file share
+struct StreamContext {
+    FileManager::NativeFile input;
+    FileManager::FileWriter output;
+    size_t blockSize;
+    Report::FileStats* stats;
+    std::atomic<bool> failed;
+
+    BufferQueue inFree;   // Empty input buffers, reader fills them
+    BufferQueue inFull;   // Raw blocks, transform consumes them
+    BufferQueue outFree;  // Spent output buffers, transform refills them
+    BufferQueue outFull;  // Transformed blocks, writer drains them
+
+    // Stop every stage: waiters wake up and the loops see `failed`
+    void Abort() {
+        failed = true;
+        inFree.Close();
+        inFull.Close();
+        outFree.Close();
+        outFull.Close();
+    }
+};
+
+int ReaderMain(void* param) {
+    StreamContext* ctx = static_cast<StreamContext*>(param);
+    std::vector<char>* buffer;
+
+    while (!ctx->failed && ctx->inFree.Pop(buffer)) {
+        buffer->resize(ctx->blockSize);
+        size_t bytesRead = 0;
+        bool ok;
+        {
+            Report::Timer timer(ctx->stats, Report::StageRead, ctx->blockSize);
+            ok = FileManager::ReadChunk(ctx->input, buffer->data(), ctx->blockSize, bytesRead);
+            timer.SetBytes(bytesRead);
+        }
+        if (!ok) {
+            ctx->Abort();
+            break;
+        }
+        if (bytesRead == 0) break; // End of file
+
+        buffer->resize(bytesRead);
+        ctx->inFull.Push(buffer);
+        if (bytesRead < ctx->blockSize) break; // Short block: end of file
+    }
+
+    ctx->inFull.Close();
+    return 0;
+}
+
+int WriterMain(void* param) {
+    StreamContext* ctx = static_cast<StreamContext*>(param);
+    std::vector<char>* buffer;
+
+    while (!ctx->failed && ctx->outFull.Pop(buffer)) {
+        Report::Timer timer(ctx->stats, Report::StageWrite, buffer->size());
+        if (!ctx->output.Write(buffer->data(), buffer->size())) {
+            ctx->Abort();
+            break;
+        }
+        ctx->outFree.Push(buffer);
+    }
+    return 0;
+}
+
+// Per-file state the transform carries from one block to the next
+struct TransformState {
+    unsigned long long encryptOffset = 0;  // Key position for the next encrypted byte
+    unsigned long long decryptOffset = 0;  // Key position for the next decrypted byte
+    bool hasCarry = false;                 // Half of an RLE pair left from the previous block
+    char carry = 0;
+};
+
+// Same order of operations as the whole-file path:
+// Compress -> Encrypt, Decrypt -> Decompress
+void TransformBlock(const Streaming::Options& options, TransformState& state, std::vector<char>& block) {
+    if (options.compress) {
+        Report::Timer timer(options.stats, Report::StageCompress, block.size());
+        block = Compression::CompressRLE(block);
+    }
+
+    if (options.encrypt) {
+        Report::Timer timer(options.stats, Report::StageEncrypt, block.size());
+        Encryption::EncryptVigenereInPlace(block.data(), block.size(), options.key, state.encryptOffset);
+        state.encryptOffset += block.size();
+    }
+
+    if (options.decrypt) {
+        Report::Timer timer(options.stats, Report::StageDecrypt, block.size());
+        Encryption::DecryptVigenereInPlace(block.data(), block.size(), options.key, state.decryptOffset);
+        state.decryptOffset += block.size();
+    }
+
+    if (options.decompress) {
+        Report::Timer timer(options.stats, Report::StageDecompress, block.size());
+        // RLE works on (value, count) pairs; an odd-sized block ends in the
+        // middle of a pair, so hold that byte back for the next block.
+        if (state.hasCarry) {
+            block.insert(block.begin(), state.carry);
+            state.hasCarry = false;
+        }
+        if (block.size() % 2 != 0) {
+            state.carry = block.back();
+            state.hasCarry = true;
+            block.pop_back();
+        }
+        block = Compression::DecompressRLE(block);
+    }
+}
+
+} // namespace
+
+bool Streaming::ProcessFile(const std::string& inputPath, const std::string& outputPath, const Options& options) {
+    StreamContext ctx;
+    ctx.blockSize = options.blockSize ? options.blockSize : DefaultBlockSize;
+    ctx.blockSize += ctx.blockSize % 2; // Keep RLE pairs aligned to block boundaries
+    ctx.failed = false;
+    ctx.stats = options.stats;
+
+    unsigned long long inputSize = 0;
+    if (!FileManager::OpenForRead(inputPath, ctx.input, inputSize)) {
+        return false;
+    }
+    // Sized like the input: exact for encryption, a starting point for RLE
+    if (!ctx.output.Open(outputPath, inputSize)) {
+        FileManager::CloseFile(ctx.input);
+        return false;
+    }
+
+    std::vector<char> buffers[2 * kBuffersPerStage];
+    for (size_t i = 0; i < kBuffersPerStage; ++i) {
+        ctx.inFree.Push(&buffers[i]);
+        ctx.outFree.Push(&buffers[kBuffersPerStage + i]);
+    }
+
+    std::vector<Concurrency::ThreadHandle> threads(2);
+    if (!Concurrency::RunTask(ReaderMain, &ctx, threads[0])) {
+        FileManager::CloseFile(ctx.input);
+        return false;
+    }
+    if (!Concurrency::RunTask(WriterMain, &ctx, threads[1])) {
+        ctx.Abort();
+        threads.resize(1);
+        Concurrency::WaitForAll(threads);
+        FileManager::CloseFile(ctx.input);
+        return false;
+    }
+
+    // The calling worker thread is the transform stage
+    TransformState state;
+    std::vector<char>* in;
+    while (!ctx.failed && ctx.inFull.Pop(in)) {
+        std::vector<char>* out;
+        if (!ctx.outFree.Pop(out)) break; // Writer gave up
+
+        out->swap(*in);
+        TransformBlock(options, state, *out);
+
+        in->clear();
+        ctx.inFree.Push(in);
+        ctx.outFull.Push(out);
+    }
+    ctx.outFull.Close();
+    ctx.inFree.Close(); // Unblocks the reader if the transform stopped early
+
+    Concurrency::WaitForAll(threads);
+
+    bool ok = !ctx.failed;
+    FileManager::CloseFile(ctx.input);
+    {
+        Report::Timer timer(options.stats, Report::StageWrite, 0);
+        if (!ctx.output.Finish()) ok = false;
+    }
+    if (!ok) {
+        std::cerr << "Error streaming file: " << inputPath << std::endl;
+    }
+    return ok;
+}
@@ -0,0 +1,36 @@
+#ifndef STREAMING_H
+#define STREAMING_H
+
+#include <string>
+#include <cstddef>
+#include "Report.h"
+
+// Streaming mode: instead of loading a whole file, the input is read in
+// fixed-size blocks that flow through three stages running concurrently:
+//
+//   reader thread --> transform (calling thread) --> writer thread
+//
+// The stages hand buffers to each other through small queues and recycle
+// them, so memory per file is a handful of blocks regardless of file size,
+// and disk reads/writes overlap with compression and encryption.
+// The output is compatible with the whole-file path: RLE pairs never span
+// blocks and the Vigenère key position carries over from block to block.
+class Streaming {
+public:
+    static constexpr size_t DefaultBlockSize = 1 << 20; // 1 MiB
+
+    struct Options {
+        bool compress = false;
+        bool decompress = false;
+        bool encrypt = false;
+        bool decrypt = false;
+        std::string key;
+        size_t blockSize = DefaultBlockSize;
+        Report::FileStats* stats = nullptr; // Stage timings, for --report
+    };
+
+    // Transform inputPath into outputPath block by block
+    static bool ProcessFile(const std::string& inputPath, const std::string& outputPath, const Options& options);
+};
+
+#endif // STREAMING_H
@@ -1,97 +1,698 @@
-#include <windows.h>
 #include <iostream>
 #include <string>
 #include <vector>
 #include <algorithm>
+#include <atomic>
+#include <map>
+#include <memory>
 #include "FileManager.h"
 #include "Concurrency.h"
 #include "Compression.h"
 #include "Encryption.h"
+#include "Streaming.h"
+#include "BlockFormat.h"
+#include "Pipeline.h"
+#include "Report.h"
+#include "Manifest.h"
+#include "Dedup.h"
+#include "Archive.h"
 
 struct Config {
     bool compress = false;
     bool decompress = false;
     bool encrypt = false;
     bool decrypt = false;
+    bool verify = false; // Check block containers' checksums; nothing is written
     std::string compAlg;
+    Compression::Algorithm algorithm = Compression::AlgorithmRLE; // Parsed from compAlg
+    unsigned lzwBits = Compression::DefaultLZWBits; // LZW dictionary size, as a code width
     std::string encAlg;
+    Encryption::Cipher cipher = Encryption::CipherVigenere; // Parsed from encAlg
     std::string inputPath;
     std::string outputPath;
     std::string key;
+    size_t jobs = 0; // Worker threads; 0 = one per core
+    bool stream = false; // Process files block by block instead of whole
+    bool legacy = false; // Write the old unframed format instead of block containers
+    bool ioUring = false; // Read/write small files in batches through io_uring
+    bool incremental = false; // Skip files the output directory's manifest shows unchanged
+    bool dedup = false; // Store content-defined chunks once, plus a recipe per file
+    bool archive = false; // Pack every file into one archive (-o), or unpack one (-i)
+    std::string member; // --member: extract only this archive member
+    bool range = false; // --range: decode only these raw bytes of each container
+    unsigned long long rangeStart = 0;
+    unsigned long long rangeLength = 0;
+    size_t blockSize = Streaming::DefaultBlockSize;
+    std::string reportPath; // --report: per-file, per-stage timings written here at exit
+    size_t reportTop = 10;  // Slowest files listed in the report
 };
 
 struct ThreadData {
-    std::string filePath;
-    Config config;
+    FileManager::FileEntry file;
+    const Config* config; // Shared by every task, owned by main()
+    Concurrency::ThreadPool* pool; // Blocks of large files are spread across it
+    std::atomic<size_t>* failures; // Files that failed, for the exit code
+    Report::FileStats* stats; // nullptr without --report
+    Manifest* manifest; // nullptr without --incremental
+    std::atomic<size_t>* skipped; // Files found unchanged
+    Dedup::Store* store; // nullptr without --dedup
 };
 
-DWORD WINAPI ProcessFile(LPVOID lpParam) {
-    ThreadData* data = static_cast<ThreadData*>(lpParam);
-    std::string inputPath = data->filePath;
-    Config config = data->config;
+// Construct output path
+// If output is a directory, append filename. If file, use as is (only for single file input).
+// For simplicity, let's assume -o specifies an output directory if input is a directory,
+// or a full path if input is a file.
+std::string BuildOutputPath(const std::string& inputPath, const Config& config) {
+    if (FileManager::IsDirectory(config.outputPath)) {
+         // It's a directory, append filename + suffix
+         std::string suffix = "";
+         if (config.compress) suffix += std::string(".") + Compression::AlgorithmName(config.algorithm);
+         if (config.encrypt) suffix += ".enc";
+         // If decrypting/decompressing, maybe remove suffix?
+         // For this simple implementation, let's just append ".out" if not specified.
+         if (config.decompress || config.decrypt) suffix += ".dec";
 
-    std::cout << "Processing: " << inputPath << std::endl;
+         return FileManager::CreateOutputPath(inputPath, config.outputPath, suffix);
+    }
+    // It's a file path
+    return config.outputPath;
+}
 
-    std::vector<char> buffer;
-    if (!FileManager::ReadFileContent(inputPath, buffer)) {
-        delete data;
-        return 1;
+// A file's name relative to the input directory, with '/' between parts;
+// just the file name when the input is a single file. Archive members and
+// manifest entries go by it, so the same tree matches however -i spells it.
+std::string RelativeName(const std::string& path, const Config& config) {
+    std::string name = path;
+    if (FileManager::IsDirectory(config.inputPath) && name.compare(0, config.inputPath.size(), config.inputPath) == 0) {
+        name = name.substr(config.inputPath.size());
+        while (!name.empty() && (name[0] == '/' || name[0] == '\\')) name.erase(0, 1);
+    } else {
+        size_t lastSlash = name.find_last_of("/\\");
+        if (lastSlash != std::string::npos) name = name.substr(lastSlash + 1);
     }
+    std::replace(name.begin(), name.end(), '\\', '/');
+    return name;
+}
+
+// Streaming mode: constant memory per file, I/O overlapped with the transforms
+bool StreamFile(const std::string& inputPath, const std::string& outPath, const Config& config,
+                Report::FileStats* stats) {
+    Streaming::Options options;
+    options.compress = config.compress;
+    options.decompress = config.decompress;
+    options.encrypt = config.encrypt;
+    options.decrypt = config.decrypt;
+    options.key = config.key;
+    options.blockSize = config.blockSize;
+    options.stats = stats;
+    return Streaming::ProcessFile(inputPath, outPath, options);
+}
+
+BlockFormat::Options MakeBlockOptions(const Config& config, Concurrency::ThreadPool* pool, Report::FileStats* stats) {
+    BlockFormat::Options options;
+    options.compress = config.compress;
+    options.decompress = config.decompress;
+    options.encrypt = config.encrypt;
+    options.decrypt = config.decrypt;
+    options.key = config.key;
+    options.cipher = config.cipher;
+    options.algorithm = config.algorithm;
+    options.lzwBits = config.lzwBits;
+    options.blockSize = config.blockSize;
+    options.pool = pool;
+    options.stats = stats;
+    return options;
+}
+
+// A manifest or chunk store found while walking an input directory
+bool IsBookkeeping(const std::string& path) {
+    size_t lastSlash = path.find_last_of("/\\");
+    std::string name = lastSlash == std::string::npos ? path : path.substr(lastSlash + 1);
+    return name == Manifest::FileName || Dedup::IsStoreFile(path);
+}
+
+// What an output depends on besides its input and the key. A manifest
+// written under different options is ignored (--incremental).
+std::string ManifestOptions(const Config& config) {
+    std::string text;
+    if (config.compress) text += 'c';
+    if (config.decompress) text += 'd';
+    if (config.encrypt) text += 'e';
+    if (config.decrypt) text += 'u';
+    if (config.compress || config.decompress) {
+        text += std::string(" ") + Compression::AlgorithmName(config.algorithm);
+        if (config.algorithm == Compression::AlgorithmLZW) text += "/" + std::to_string(config.lzwBits);
+    }
+    if (config.encrypt || config.decrypt) text += std::string(" ") + Encryption::CipherName(config.cipher);
+    text += " " + std::to_string(config.blockSize);
+    text += config.legacy ? " legacy" : config.stream ? " stream" : config.dedup ? " dedup" : " container";
+    return text;
+}
+
+// Block container: each block is compressed/encrypted on the worker pool.
+// append extends the container from an earlier run (--incremental).
+bool ProcessBlocks(const std::string& inputPath, const std::string& outPath, const Config& config,
+                   Concurrency::ThreadPool* pool, Report::FileStats* stats, bool encode, bool append) {
+    BlockFormat::Options options = MakeBlockOptions(config, pool, stats);
+    if (!encode && config.range) {
+        return BlockFormat::DecodeRange(inputPath, outPath, options, config.rangeStart, config.rangeLength);
+    }
+    if (!encode) return BlockFormat::DecodeFile(inputPath, outPath, options);
+    return append ? BlockFormat::AppendFile(inputPath, outPath, options)
+                  : BlockFormat::EncodeFile(inputPath, outPath, options);
+}
+
+// Original unframed format, whole file at once. The result ends up in
+// buffer; false if the input does not decompress (truncated or corrupt).
+bool TransformLegacy(const char* data, size_t size, std::vector<char>& buffer, const Config& config,
+                     Report::FileStats* stats) {
+    const char* current = data;
+    size_t currentSize = size;
 
     // Order of operations:
     // Compress -> Encrypt
     // Decrypt -> Decompress
 
     if (config.compress) {
-        // Only RLE supported for now
-        buffer = Compression::CompressRLE(buffer);
+        Report::Timer timer(stats, Report::StageCompress, currentSize);
+        buffer = Compression::Compress(config.algorithm, current, currentSize, config.lzwBits);
+        current = buffer.data();
+        currentSize = buffer.size();
     }
 
-    if (config.encrypt) {
-        buffer = Encryption::EncryptVigenere(buffer, config.key);
+    // Encryption overwrites the buffer when an earlier step produced it
+    if (config.encrypt && current == buffer.data()) {
+        Report::Timer timer(stats, Report::StageEncrypt, currentSize);
+        Encryption::EncryptVigenereInPlace(buffer.data(), buffer.size(), config.key);
+    } else if (config.encrypt) {
+        Report::Timer timer(stats, Report::StageEncrypt, currentSize);
+        buffer = Encryption::EncryptVigenere(current, currentSize, config.key);
+        current = buffer.data();
+        currentSize = buffer.size();
     }
 
     if (config.decrypt) {
-        buffer = Encryption::DecryptVigenere(buffer, config.key);
+        Report::Timer timer(stats, Report::StageDecrypt, currentSize);
+        buffer = Encryption::DecryptVigenere(current, currentSize, config.key);
+        current = buffer.data();
+        currentSize = buffer.size();
     }
 
     if (config.decompress) {
-        buffer = Compression::DecompressRLE(buffer);
+        Report::Timer timer(stats, Report::StageDecompress, currentSize);
+        std::vector<char> raw;
+        if (!Compression::Decompress(config.algorithm, current, currentSize, raw)) return false;
+        buffer.swap(raw);
+        current = buffer.data();
+        currentSize = buffer.size();
+    }
+
+    if (current == data) {
+        buffer.assign(data, data + size); // No operation requested: plain copy
+    }
+    return true;
+}
+
+// Legacy RLE/Vigenère operations in one direction run fused, a chunk at
+// a time (Pipeline.h); anything else goes through TransformLegacy
+bool HasPipeline(const Config& config) {
+    if ((config.compress || config.decompress) && config.algorithm != Compression::AlgorithmRLE) return false;
+    bool encode = config.compress || config.encrypt;
+    bool decode = config.decompress || config.decrypt;
+    return encode != decode;
+}
+
+template <class Sink>
+bool RunPipeline(const char* data, size_t size, Sink sink, const Config& config, Report::FileStats* stats) {
+    ReadStage source(data, size);
+    if (config.compress && config.encrypt) {
+        return CompressEncryptPipeline<Sink>(source, CompressStage(), EncryptStage(config.key), sink).Run(stats);
+    }
+    if (config.compress) return CompressPipeline<Sink>(source, CompressStage(), sink).Run(stats);
+    if (config.encrypt) return EncryptPipeline<Sink>(source, EncryptStage(config.key), sink).Run(stats);
+    if (config.decrypt && config.decompress) {
+        return DecryptDecompressPipeline<Sink>(source, DecryptStage(config.key), DecompressStage(), sink).Run(stats);
+    }
+    if (config.decompress) return DecompressPipeline<Sink>(source, DecompressStage(), sink).Run(stats);
+    return DecryptPipeline<Sink>(source, DecryptStage(config.key), sink).Run(stats);
+}
+
+// Transform (or verify) one file; false if anything went wrong. append:
+// the input only grew since its container was written (--incremental).
+// With a store (--dedup) the file is chunked into it, or rebuilt from it.
+bool TransformFile(const std::string& inputPath, const Config& config, Concurrency::ThreadPool* pool,
+                   Report::FileStats* stats, bool append, Dedup::Store* store) {
+    if (config.verify) {
+        std::cout << "Verifying: " << inputPath << std::endl;
+        BlockFormat::Options options = MakeBlockOptions(config, pool, stats);
+        options.verify = true;
+        bool ok = BlockFormat::VerifyFile(inputPath, options);
+        if (ok) std::cout << "OK: " << inputPath << std::endl;
+        return ok;
     }
 
-    // Construct output path
-    // If output is a directory, append filename. If file, use as is (only for single file input).
-    // For simplicity, let's assume -o specifies an output directory if input is a directory, 
-    // or a full path if input is a file.
-    
+    std::cout << "Processing: " << inputPath << std::endl;
+
+    std::string outPath = BuildOutputPath(inputPath, config);
+
+    // -c/-e write block containers; -d/-u recognise them by their header
+    // (piped input is taken as a container unless --legacy is given).
+    // Anything else (legacy files, --legacy, mixed operations) takes the
+    // original unframed path below.
+    bool encode = config.compress || config.encrypt;
+    bool decode = config.decompress || config.decrypt;
+    bool ok;
+    if (!encode && !decode) {
+        // Nothing to transform: let the kernel copy the bytes
+        Report::Timer timer(stats, Report::StageWrite, stats ? stats->bytesIn : 0);
+        ok = FileManager::CopyContent(inputPath, outPath);
+    } else if (store) {
+        // Every new chunk is its own small container, so appends need no
+        // special case: the unchanged chunks are found in the store
+        BlockFormat::Options options = MakeBlockOptions(config, pool, stats);
+        ok = encode ? Dedup::EncodeFile(inputPath, outPath, *store, options)
+                    : Dedup::DecodeFile(inputPath, outPath, *store, options);
+    } else if ((encode && !decode && !config.legacy) ||
+               (decode && !encode && BlockFormat::IsFramed(inputPath, !config.legacy))) {
+        ok = ProcessBlocks(inputPath, outPath, config, pool, stats, encode, append && encode);
+    } else if (config.range) {
+        std::cerr << "Error: --range needs a block container: " << inputPath << std::endl;
+        ok = false;
+    } else if (config.stream) {
+        ok = StreamFile(inputPath, outPath, config, stats);
+    } else {
+        // Mapped when possible: the first transform reads straight from the
+        // page cache instead of from a copy of the file
+        FileManager::FileView view;
+        {
+            // Only a buffered read (pipes, devices) counts; mapping reads nothing yet
+            Report::Timer timer(stats, Report::StageRead, 0);
+            if (!FileManager::OpenView(inputPath, view)) return false;
+            if (!view.IsMapped()) timer.SetBytes(view.Size());
+        }
+
+        if (HasPipeline(config)) {
+            // Sized like the input: exact for encryption, a starting point for RLE
+            FileManager::FileWriter writer;
+            ok = writer.Open(outPath, view.Size()) &&
+                 RunPipeline(view.Data(), view.Size(), WriteStage(writer, stats), config, stats);
+            Report::Timer timer(stats, Report::StageWrite, 0);
+            if (!writer.Finish()) ok = false;
+        } else {
+            // Nothing is written unless the whole file decoded
+            std::vector<char> buffer;
+            if (TransformLegacy(view.Data(), view.Size(), buffer, config, stats)) {
+                Report::Timer timer(stats, Report::StageWrite, buffer.size());
+                ok = FileManager::WriteFileContent(outPath, buffer);
+            } else {
+                std::cerr << "Error: truncated or corrupt compressed data in " << inputPath << std::endl;
+                ok = false;
+            }
+        }
+    }
+
+    if (ok) std::cout << "Finished: " << outPath << std::endl;
+    return ok;
+}
+
+int ProcessFile(void* param) {
+    ThreadData* data = static_cast<ThreadData*>(param);
+    Report::FileStats* stats = data->stats;
+    uint64_t start = stats ? Report::Now() : 0;
+    const std::string& path = data->file.path;
+
+    // --incremental: the manifest says whether there is anything to do
+    Manifest::Entry entry;
+    Manifest::Change change = Manifest::Changed;
     std::string outPath;
-    if (FileManager::IsDirectory(config.outputPath)) {
-         // It's a directory, append filename + suffix
-         std::string suffix = "";
-         if (config.compress) suffix += ".rle";
-         if (config.encrypt) suffix += ".enc";
-         // If decrypting/decompressing, maybe remove suffix? 
-         // For this simple implementation, let's just append ".out" if not specified.
-         if (config.decompress || config.decrypt) suffix += ".dec";
-         
-         outPath = FileManager::CreateOutputPath(inputPath, config.outputPath, suffix);
+    if (data->manifest) {
+        outPath = BuildOutputPath(path, *data->config);
+        change = data->manifest->Check(RelativeName(path, *data->config), data->file, outPath, entry);
+    }
+
+    bool ok = true;
+    if (change == Manifest::Unchanged) {
+        std::cout << "Unchanged: " << path << std::endl;
+        ++*data->skipped;
     } else {
-        // It's a file path
-        outPath = config.outputPath;
+        ok = TransformFile(path, *data->config, data->pool, stats, change == Manifest::Appended, data->store);
+        if (ok && data->manifest) FileManager::GetFileSize(outPath, entry.outputSize);
     }
+    if (ok && data->manifest) data->manifest->Record(RelativeName(path, *data->config), entry);
 
-    if (!FileManager::WriteFileContent(outPath, buffer)) {
-        delete data;
-        return 1;
+    if (stats) {
+        stats->queueWait = start - stats->submitted;
+        stats->wall = Report::Now() - start;
+        stats->thread = Concurrency::ThreadPool::CurrentWorker();
+        stats->ok = ok;
+        // Every path writes through a timed stage, so that is what went out
+        stats->bytesOut = stats->stageBytes[Report::StageWrite];
+    }
+    if (!ok) ++*data->failures;
+    delete data;
+    return ok ? 0 : 1;
+}
+
+// Files up to this size are grouped into batches under --io-uring
+const unsigned long long BatchFileLimit = 256 << 10;
+
+// Files per batch; one io_uring round covers the whole batch
+const size_t BatchFileCount = 64;
+
+// A batch of small files: read together, transformed in parallel on the
+// pool, written together
+struct BatchData {
+    std::vector<std::string> paths;
+    std::vector<unsigned long long> sizes;
+    std::vector<unsigned long long> modified;
+    const Config* config;
+    Concurrency::ThreadPool* pool;
+    std::atomic<size_t>* failures;
+    std::vector<Report::FileStats*> stats; // One per path; empty without --report
+    Manifest* manifest; // nullptr without --incremental
+};
+
+// One file of a batch, transformed in memory
+struct BatchItem {
+    const FileManager::BatchFile* input;
+    FileManager::BatchFile* output;
+    const Config* config;
+    Report::FileStats* stats;
+    bool ok;
+};
+
+// A batch is read and written in one go; each file is charged a share of
+// the time in proportion to its bytes
+void ChargeBatch(const std::vector<Report::FileStats*>& stats, const std::vector<unsigned long long>& bytes,
+                 Report::Stage stage, uint64_t time) {
+    unsigned long long total = 0;
+    for (unsigned long long count : bytes) total += count;
+    for (size_t i = 0; i < stats.size(); ++i) {
+        if (!stats[i]) continue;
+        uint64_t share = total ? static_cast<uint64_t>(static_cast<double>(time) * bytes[i] / total)
+                               : time / stats.size();
+        stats[i]->Add(stage, share, bytes[i]);
+    }
+}
+
+// Same choice of format as ProcessFile, on a buffer. The file is a single
+// block or a few, so the blocks run inline on this worker.
+int TransformBatchItem(void* param) {
+    BatchItem* item = static_cast<BatchItem*>(param);
+    const Config& config = *item->config;
+    const std::vector<char>& in = item->input->data;
+    std::vector<char>& out = item->output->data;
+
+    bool encode = config.compress || config.encrypt;
+    bool decode = config.decompress || config.decrypt;
+    BlockFormat::Options options = MakeBlockOptions(config, nullptr, item->stats);
+
+    item->ok = true;
+    if (encode && !decode && !config.legacy) {
+        item->ok = BlockFormat::EncodeBuffer(in.data(), in.size(), out, options);
+    } else if (decode && !encode && BlockFormat::IsFramed(in.data(), in.size())) {
+        item->ok = BlockFormat::DecodeBuffer(in.data(), in.size(), out, options, item->input->path);
+    } else if (HasPipeline(config)) {
+        out.clear();
+        item->ok = RunPipeline(in.data(), in.size(), AppendStage(out), config, item->stats);
+    } else {
+        item->ok = TransformLegacy(in.data(), in.size(), out, config, item->stats);
+    }
+    if (!item->ok) {
+        std::cerr << "Error processing file: " << item->input->path << std::endl;
+    }
+    return item->ok ? 0 : 1;
+}
+
+int ProcessBatch(void* param) {
+    BatchData* data = static_cast<BatchData*>(param);
+    const Config& config = *data->config;
+    bool measure = !data->stats.empty();
+    std::vector<Report::FileStats*> stats = data->stats;
+    stats.resize(data->paths.size(), nullptr);
+    uint64_t start = measure ? Report::Now() : 0;
+
+    std::vector<FileManager::BatchFile> inputs(data->paths.size());
+    std::vector<FileManager::BatchFile> outputs(data->paths.size());
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        std::cout << "Processing: " << data->paths[i] << std::endl;
+        inputs[i].path = data->paths[i];
+        inputs[i].size = data->sizes[i];
+        outputs[i].path = BuildOutputPath(data->paths[i], config);
+    }
+
+    uint64_t readStart = measure ? Report::Now() : 0;
+    FileManager::ReadBatch(inputs);
+    if (measure) {
+        std::vector<unsigned long long> bytes;
+        for (const auto& file : inputs) bytes.push_back(file.data.size());
+        ChargeBatch(stats, bytes, Report::StageRead, Report::Now() - readStart);
+    }
+
+    // The manifest gets the contents hash while they are in memory
+    std::vector<Manifest::Entry> entries(inputs.size());
+    for (size_t i = 0; data->manifest && i < inputs.size(); ++i) {
+        entries[i].size = inputs[i].data.size();
+        entries[i].modified = data->modified[i];
+        Manifest::Hash(inputs[i].data.data(), inputs[i].data.size(), entries[i].hash);
+    }
+
+    // Fan the transforms out as subtasks so idle workers can steal them
+    std::vector<BatchItem> items(inputs.size());
+    Concurrency::TaskGroup group;
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        items[i] = BatchItem{&inputs[i], &outputs[i], &config, stats[i], false};
+        if (stats[i]) stats[i]->bytesIn = inputs[i].data.size();
+        if (inputs[i].ok) data->pool->Submit(TransformBatchItem, &items[i], &group);
+    }
+    data->pool->Wait(group);
+
+    // Only the files that made it this far are written
+    std::vector<FileManager::BatchFile> ready;
+    std::vector<Report::FileStats*> readyStats;
+    std::vector<unsigned long long> readyBytes;
+    std::vector<Manifest::Entry> readyEntries;
+    std::vector<std::string> readySources;
+    for (size_t i = 0; i < items.size(); ++i) {
+        std::vector<char>().swap(inputs[i].data);
+        if (items[i].ok) {
+            readyEntries.push_back(entries[i]);
+            readySources.push_back(data->paths[i]);
+            readyStats.push_back(stats[i]);
+            readyBytes.push_back(outputs[i].data.size());
+            ready.push_back(std::move(outputs[i]));
+        }
+    }
+
+    uint64_t writeStart = measure ? Report::Now() : 0;
+    FileManager::WriteBatch(ready);
+    if (measure) ChargeBatch(readyStats, readyBytes, Report::StageWrite, Report::Now() - writeStart);
+
+    size_t failed = items.size() - ready.size();
+    for (size_t i = 0; i < ready.size(); ++i) {
+        if (ready[i].ok) std::cout << "Finished: " << ready[i].path << std::endl;
+        else failed++;
+        if (ready[i].ok && data->manifest) {
+            readyEntries[i].outputSize = readyBytes[i];
+            data->manifest->Record(RelativeName(readySources[i], *data->config), readyEntries[i]);
+        }
+        if (readyStats[i]) {
+            readyStats[i]->ok = ready[i].ok;
+            readyStats[i]->bytesOut = ready[i].ok ? readyBytes[i] : 0;
+        }
+    }
+
+    // A batched file's wall time is what it was charged: its own transform
+    // plus its shares of the batch's read and write
+    int worker = Concurrency::ThreadPool::CurrentWorker();
+    for (Report::FileStats* file : stats) {
+        if (!file) continue;
+        file->queueWait = start - file->submitted;
+        file->thread = worker;
+        file->wall = 0;
+        for (int s = 0; s < Report::StageCount; ++s) file->wall += file->stageTime[s];
+    }
+    bool ok = failed == 0;
+    *data->failures += failed;
+    delete data;
+    return ok ? 0 : 1;
+}
+
+// One archive member to pack or extract
+struct MemberData {
+    std::string name;
+    std::string path; // Input file when packing, output file when extracting
+    const Config* config;
+    Concurrency::ThreadPool* pool;
+    std::atomic<size_t>* failures;
+    Report::FileStats* stats; // nullptr without --report
+    Archive::Writer* writer;  // Set when packing
+    const Archive::Reader* reader; // Set when extracting
+    const Archive::Member* member;
+};
+
+int ProcessMember(void* param) {
+    MemberData* data = static_cast<MemberData*>(param);
+    Report::FileStats* stats = data->stats;
+    uint64_t start = stats ? Report::Now() : 0;
+    BlockFormat::Options options = MakeBlockOptions(*data->config, data->pool, stats);
+
+    bool ok;
+    if (data->writer) {
+        ok = data->writer->Add(data->name, data->path, options);
+        if (ok) std::cout << "Packed: " << data->name << std::endl;
+    } else {
+        size_t lastSlash = data->path.find_last_of("/\\");
+        ok = (lastSlash == std::string::npos || FileManager::MakeDirectories(data->path.substr(0, lastSlash))) &&
+             data->reader->Extract(*data->member, data->path, options);
+        if (ok) std::cout << "Extracted: " << data->path << std::endl;
     }
+    if (!ok) std::cerr << "Error with archive member: " << data->name << std::endl;
 
-    std::cout << "Finished: " << outPath << std::endl;
+    if (stats) {
+        stats->queueWait = start - stats->submitted;
+        stats->wall = Report::Now() - start;
+        stats->thread = Concurrency::ThreadPool::CurrentWorker();
+        stats->ok = ok;
+        stats->bytesOut = stats->stageBytes[Report::StageWrite];
+    }
+    if (!ok) ++*data->failures;
     delete data;
-    return 0;
+    return ok ? 0 : 1;
+}
+
+// --archive: pack every file into the archive at -o, or extract the members
+// of the archive at -i into the directory at -o. Members are handled on the
+// pool like files; false if the archive itself could not be read or
+// completed.
+bool RunArchive(const std::vector<FileManager::FileEntry>& files, const Config& config,
+                Concurrency::ThreadPool& pool, std::atomic<size_t>& failures, Report* report) {
+    BlockFormat::Options options = MakeBlockOptions(config, &pool, nullptr);
+    if (config.compress || config.encrypt) {
+        Archive::Writer writer;
+        if (!writer.Open(config.outputPath)) return false;
+        for (const auto& file : files) {
+            std::string name = RelativeName(file.path, config);
+            if (file.path == config.outputPath) continue; // The archive being written
+
+            Report::FileStats* stats = report ? report->AddFile(file.path) : nullptr;
+            if (stats) stats->bytesIn = file.size;
+            pool.Submit(ProcessMember,
+                        new MemberData{name, file.path, &config, &pool, &failures, stats, &writer, nullptr, nullptr});
+        }
+        pool.Wait();
+        return writer.Finish(options);
+    }
+
+    Archive::Reader reader;
+    if (!reader.Open(config.inputPath, options)) return false;
+    std::vector<const Archive::Member*> selected;
+    if (!config.member.empty()) {
+        const Archive::Member* member = reader.Find(config.member);
+        if (!member) {
+            std::cerr << "No member " << config.member << " in " << config.inputPath << std::endl;
+            return false;
+        }
+        selected.push_back(member);
+    } else {
+        for (const auto& member : reader.Members()) selected.push_back(&member);
+    }
+
+    // Largest first, as for files
+    std::stable_sort(selected.begin(), selected.end(),
+        [](const Archive::Member* a, const Archive::Member* b) { return a->rawSize > b->rawSize; });
+    for (const Archive::Member* member : selected) {
+        if (!Archive::IsSafeName(member->name)) {
+            std::cerr << "Skipping unsafe member name: " << member->name << std::endl;
+            failures++;
+            continue;
+        }
+        // CreateOutputPath keeps only the file name; members keep their directories
+        std::string path = member->name;
+        std::replace(path.begin(), path.end(), '/', FileManager::PathSeparator);
+        path = config.outputPath + FileManager::PathSeparator + path;
+        Report::FileStats* stats = report ? report->AddFile(member->name) : nullptr;
+        if (stats) stats->bytesIn = member->storedSize;
+        pool.Submit(ProcessMember,
+                    new MemberData{member->name, path, &config, &pool, &failures, stats, nullptr, &reader, member});
+    }
+    pool.Wait();
+    return true;
 }
 
 void PrintUsage() {
-    std::cout << "Usage: program -[c|d|e|u] -i <input> -o <output> [-k <key>] [--comp-alg <alg>] [--enc-alg <alg>]" << std::endl;
+    std::cout << "Usage: program -[c|d|e|u] -i <input> -o <output> [-k <key>] [-j <threads>] [--legacy] [--stream] [--io-uring] [--block-size <bytes>[K|M]] [--comp-alg <alg>] [--lzw-bits <9-16>] [--enc-alg <alg>]" << std::endl;
+    std::cout << "       program --verify -i <input> [-j <threads>]" << std::endl;
+    std::cout << "       any mode: [--report <file.json|file.csv>] [--report-top <n>]" << std::endl;
+    std::cout << "       with -o <directory>: [--incremental] [--dedup]" << std::endl;
+    std::cout << "       program -[c|e] --archive -i <input> -o <archive file>" << std::endl;
+    std::cout << "       program -[d|u] --archive -i <archive file> -o <directory> [--member <name>]" << std::endl;
+    std::cout << "       program -[d|u] --range <start>:<length>[K|M|G] -i <input> -o <output>" << std::endl;
+    std::cout << "Keys: aes128, aes256 and chacha20 stretch -k with PBKDF2-HMAC-SHA256 (" << Encryption::KdfIterations
+              << " rounds, fixed salt) and salt each file's key with its nonce; vigenere uses -k as is and only obfuscates." << std::endl;
+}
+
+// Parse a strictly positive decimal count (e.g. the -j value)
+bool ParseCount(const std::string& text, size_t& value) {
+    if (text.empty()) return false;
+    size_t result = 0;
+    for (char ch : text) {
+        if (ch < '0' || ch > '9') return false;
+        result = result * 10 + static_cast<size_t>(ch - '0');
+        if (result > 1000000) return false;
+    }
+    if (result == 0) return false;
+    value = result;
+    return true;
+}
+
+// Parse a byte offset or length: decimal, with an optional K, M or G suffix
+bool ParseOffset(const std::string& text, unsigned long long& value) {
+    std::string digits = text;
+    unsigned long long multiplier = 1;
+    char unit = digits.empty() ? '\0' : digits.back();
+    if (unit == 'K' || unit == 'k') multiplier = 1ULL << 10;
+    else if (unit == 'M' || unit == 'm') multiplier = 1ULL << 20;
+    else if (unit == 'G' || unit == 'g') multiplier = 1ULL << 30;
+    if (multiplier != 1) digits.pop_back();
+    if (digits.empty()) return false;
+
+    unsigned long long result = 0;
+    for (char ch : digits) {
+        if (ch < '0' || ch > '9') return false;
+        unsigned digit = static_cast<unsigned>(ch - '0');
+        if (result > (~0ULL - digit) / 10) return false;
+        result = result * 10 + digit;
+    }
+    if (result > ~0ULL / multiplier) return false;
+    value = result * multiplier;
+    return true;
+}
+
+// Parse a --range value: <start>:<length>, length above zero
+bool ParseRange(const std::string& text, unsigned long long& start, unsigned long long& length) {
+    size_t colon = text.find(':');
+    return colon != std::string::npos && ParseOffset(text.substr(0, colon), start) &&
+           ParseOffset(text.substr(colon + 1), length) && length > 0;
+}
+
+// Largest --block-size accepted; block headers store sizes in 32 bits
+const size_t MaxBlockSize = 256 << 20;
+
+// Parse a byte size with an optional K or M suffix (e.g. 256K, 4M)
+bool ParseSize(const std::string& text, size_t& value) {
+    if (text.empty()) return false;
+    std::string digits = text;
+    size_t multiplier = 1;
+    char unit = digits.back();
+    if (unit == 'K' || unit == 'k') multiplier = 1 << 10;
+    else if (unit == 'M' || unit == 'm') multiplier = 1 << 20;
+    if (multiplier != 1) digits.pop_back();
+
+    size_t count = 0;
+    if (!ParseCount(digits, count)) return false;
+    value = count * multiplier;
+    return true;
 }
 
 int main(int argc, char* argv[]) {
@@ -119,6 +720,13 @@ int main(int argc, char* argv[]) {
                     if (i + 1 < argc) config.key = argv[++i];
                     break;
                 }
+                else if (c == 'j') {
+                    if (i + 1 < argc && !ParseCount(argv[++i], config.jobs)) {
+                        std::cerr << "Invalid thread count for -j: " << argv[i] << std::endl;
+                        return 1;
+                    }
+                    break;
+                }
                 // Note: -i, -o, -k usually take next arg, but if they are combined like -io, it's ambiguous. 
                 // Standard behavior is usually not to combine taking-arg flags with others in a way that hides the arg.
                 // But for -ce, -ud it works.
@@ -145,14 +753,55 @@ int main(int argc, char* argv[]) {
             // But wait, if I have "-ce", loop runs for 'c', then 'e'.
             // If I have "-i", loop runs for 'i'.
         }
+        else if (arg == "--stream") config.stream = true;
+        else if (arg == "--legacy") config.legacy = true;
+        else if (arg == "--io-uring") config.ioUring = true;
+        else if (arg == "--incremental") config.incremental = true;
+        else if (arg == "--dedup") config.dedup = true;
+        else if (arg == "--archive") config.archive = true;
+        else if (arg == "--member" && i + 1 < argc) config.member = argv[++i];
+        else if (arg == "--range" && i + 1 < argc) {
+            if (!ParseRange(argv[++i], config.rangeStart, config.rangeLength)) {
+                std::cerr << "Invalid range: " << argv[i] << " (expected <start>:<length>, e.g. 1G:4K)" << std::endl;
+                return 1;
+            }
+            config.range = true;
+        }
+        else if (arg == "--verify") config.verify = true;
+        else if (arg == "--block-size" && i + 1 < argc) {
+            if (!ParseSize(argv[++i], config.blockSize) || config.blockSize > MaxBlockSize) {
+                std::cerr << "Invalid block size: " << argv[i] << std::endl;
+                return 1;
+            }
+        }
         else if (arg == "--comp-alg" && i + 1 < argc) config.compAlg = argv[++i];
+        else if (arg == "--lzw-bits" && i + 1 < argc) {
+            size_t bits = 0;
+            if (!ParseCount(argv[++i], bits) || bits < Compression::MinLZWBits || bits > Compression::MaxLZWBits) {
+                std::cerr << "Invalid LZW code width: " << argv[i] << " (expected 9 to 16)" << std::endl;
+                return 1;
+            }
+            config.lzwBits = static_cast<unsigned>(bits);
+        }
         else if (arg == "--enc-alg" && i + 1 < argc) config.encAlg = argv[++i];
+        else if (arg == "--report" && i + 1 < argc) config.reportPath = argv[++i];
+        else if (arg == "--report-top" && i + 1 < argc) {
+            if (!ParseCount(argv[++i], config.reportTop)) {
+                std::cerr << "Invalid count for --report-top: " << argv[i] << std::endl;
+                return 1;
+            }
+        }
     }
 
-    if (config.inputPath.empty() || config.outputPath.empty()) {
+    // --verify reads only; it takes no output path
+    if (config.inputPath.empty() || (config.outputPath.empty() && !config.verify)) {
         PrintUsage();
         return 1;
     }
+    if (config.verify && (config.compress || config.decompress || config.encrypt || config.decrypt)) {
+        std::cerr << "--verify cannot be combined with -c, -d, -e or -u." << std::endl;
+        return 1;
+    }
 
     // Validate logic
     if ((config.compress && config.decompress) || (config.encrypt && config.decrypt)) {
@@ -160,24 +809,212 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
-    std::vector<std::string> files;
+    if (!config.compAlg.empty() && !Compression::ParseAlgorithm(config.compAlg, config.algorithm)) {
+        std::cerr << "Unknown compression algorithm: " << config.compAlg << " (expected rle, rle2, lz, huff, rle+huff, lz+huff, lzw or auto)" << std::endl;
+        return 1;
+    }
+    // Streaming carries RLE pairs across block edges; other formats need
+    // the whole file or the block container
+    if (config.stream && (config.compress || config.decompress) && config.algorithm != Compression::AlgorithmRLE) {
+        std::cerr << "--stream only supports --comp-alg rle." << std::endl;
+        return 1;
+    }
+    if (!config.encAlg.empty() && !Encryption::ParseCipher(config.encAlg, config.cipher)) {
+        std::cerr << "Unknown encryption algorithm: " << config.encAlg << " (expected vigenere, aes128, aes256 or chacha20)" << std::endl;
+        return 1;
+    }
+    // The old format has nowhere to keep the nonce
+    if ((config.legacy || config.stream) && (config.encrypt || config.decrypt) && Encryption::UsesNonce(config.cipher)) {
+        std::cerr << "--enc-alg " << config.encAlg << " needs the block container and cannot be used with --legacy or --stream." << std::endl;
+        return 1;
+    }
+    if (config.encrypt && config.key.empty() && config.cipher != Encryption::CipherVigenere) {
+        std::cerr << "--enc-alg " << config.encAlg << " needs a key (-k)." << std::endl;
+        return 1;
+    }
+    // Only block headers can record a codec chosen per block
+    if (config.legacy && (config.compress || config.decompress) && config.algorithm == Compression::AlgorithmAuto) {
+        std::cerr << "--comp-alg auto needs the block container and cannot be used with --legacy." << std::endl;
+        return 1;
+    }
+    // The manifest lives next to the outputs it describes
+    if (config.incremental && (config.verify || !FileManager::IsDirectory(config.outputPath))) {
+        std::cerr << "--incremental needs an existing output directory (-o) and cannot be used with --verify." << std::endl;
+        return 1;
+    }
+
+    // The store lives in the output directory when writing, next to the
+    // recipes when reading. One direction at a time, as for containers.
+    bool encode = config.compress || config.encrypt;
+    bool decode = config.decompress || config.decrypt;
+    std::string storeDirectory = encode ? config.outputPath : config.inputPath;
+    if (decode && !FileManager::IsDirectory(storeDirectory)) {
+        size_t lastSlash = config.inputPath.find_last_of("/\\");
+        storeDirectory = lastSlash == std::string::npos ? "." : config.inputPath.substr(0, lastSlash);
+    }
+    if (config.dedup && (encode == decode || config.legacy || config.stream || config.verify ||
+                         !FileManager::IsDirectory(config.outputPath))) {
+        std::cerr << "--dedup needs -c/-e or -d/-u (not both), an existing output directory (-o), and cannot be used with --legacy, --stream or --verify." << std::endl;
+        return 1;
+    }
+    // Recipes decode to their chunk list, not to the files they stand for
+    unsigned long long storeSize = 0;
+    if (decode && !encode && !config.dedup && !config.archive &&
+        FileManager::GetFileSize(FileManager::CreateOutputPath(Dedup::IndexName, storeDirectory, ""), storeSize)) {
+        std::cerr << "Error: " << config.inputPath << " was written with --dedup; decode it with --dedup." << std::endl;
+        return 1;
+    }
+
+    // Packing: -o is the archive file. Extracting: -i is the archive file
+    // and -o the directory the members go to.
+    std::string archivePath = encode ? config.outputPath : config.inputPath;
+    if (config.archive && (encode == decode || config.legacy || config.stream || config.verify || config.incremental ||
+                           config.dedup || FileManager::IsDirectory(archivePath) ||
+                           (decode && !FileManager::IsDirectory(config.outputPath)))) {
+        std::cerr << "--archive needs -c/-e with an archive file as -o, or -d/-u with an archive file as -i and an existing output directory as -o; it cannot be used with --legacy, --stream, --verify, --incremental or --dedup." << std::endl;
+        return 1;
+    }
+    if (config.range && (!decode || encode || config.legacy || config.stream || config.dedup || config.archive ||
+                         config.incremental)) {
+        std::cerr << "--range needs -d/-u on block containers and cannot be used with --legacy, --stream, --dedup, --archive or --incremental." << std::endl;
+        return 1;
+    }
+    if (!config.member.empty() && !(config.archive && decode)) {
+        std::cerr << "--member needs --archive with -d/-u." << std::endl;
+        return 1;
+    }
+
+    std::vector<FileManager::FileEntry> files;
     if (FileManager::IsDirectory(config.inputPath)) {
-        files = FileManager::GetFiles(config.inputPath);
+        // This program's own bookkeeping (a manifest, a chunk store) is not input
+        for (const auto& file : FileManager::GetFiles(config.inputPath)) {
+            if (!IsBookkeeping(file.path)) files.push_back(file);
+        }
     } else {
-        files.push_back(config.inputPath);
+        FileManager::FileEntry entry{config.inputPath, 0};
+        FileManager::GetFileEntry(config.inputPath, entry);
+        files.push_back(entry);
     }
 
-    std::vector<HANDLE> threads;
-    for (const auto& file : files) {
-        ThreadData* data = new ThreadData{file, config};
-        HANDLE hThread = Concurrency::RunTask(ProcessFile, data);
-        if (hThread) {
-            threads.push_back(hThread);
+    // Largest files first: the pool deals tasks round-robin, so every worker
+    // starts on one of the long poles while the small files queue up behind
+    // them, ready to be stolen by whichever worker frees up first.
+    std::stable_sort(files.begin(), files.end(),
+        [](const FileManager::FileEntry& a, const FileManager::FileEntry& b) { return a.size > b.size; });
+
+    // A fixed number of workers pull files from the pool's deques, so the
+    // thread count (and the number of files held in memory at once) stays
+    // bounded by -j no matter how many files the directory contains.
+    // Not capped by the file count: the blocks of a single large file are
+    // spread across the same workers.
+    size_t workers = config.jobs ? config.jobs : Concurrency::GetCoreCount();
+
+    // --io-uring: the small files of a directory go out in batches, each
+    // batch read and written with a few calls to the async engine; larger
+    // files, --stream and --range keep the per-file paths. Without an engine
+    // batching gains nothing, so the flag is ignored.
+    bool batch = config.ioUring && !config.stream && !config.verify && !config.dedup && !config.archive &&
+                 !config.range && FileManager::IsDirectory(config.inputPath);
+    if (batch && !FileManager::AsyncIOAvailable()) {
+        std::cerr << "io_uring is not available; using ordinary file I/O." << std::endl;
+        batch = false;
+    }
+
+    // --incremental: outputs keep only the file name, so two inputs of the
+    // same name in different subdirectories would overwrite each other on
+    // every run while the manifest vouched for both
+    if (config.incremental) {
+        std::map<std::string, std::string> sources;
+        for (const auto& file : files) {
+            auto inserted = sources.emplace(BuildOutputPath(file.path, config), file.path);
+            if (!inserted.second) {
+                std::cerr << "Error: " << inserted.first->second << " and " << file.path << " would both be written to "
+                          << inserted.first->first << "; --incremental needs distinct file names." << std::endl;
+                return 1;
+            }
+        }
+    }
+
+    // --incremental: files the manifest shows unchanged by size and time
+    // are skipped right here; the workers hash the rest where needed
+    std::unique_ptr<Manifest> manifest(config.incremental ? new Manifest() : nullptr);
+    if (manifest) manifest->Load(config.outputPath, ManifestOptions(config));
+    std::atomic<size_t> skipped(0);
+
+    // --report: every file gets a record, stamped as it is queued
+    std::unique_ptr<Report> report(config.reportPath.empty() ? nullptr : new Report());
+    uint64_t runStart = Report::Now();
+
+    std::atomic<size_t> failures(0);
+    Concurrency::ThreadPool pool(workers);
+
+    // --dedup: one store shared by every file of the run
+    std::unique_ptr<Dedup::Store> store(config.dedup ? new Dedup::Store() : nullptr);
+    if (store && !store->Open(storeDirectory, MakeBlockOptions(config, &pool, nullptr))) return 1;
+
+    BatchData* pending = nullptr;
+    if (config.archive) {
+        if (!RunArchive(files, config, pool, failures, report.get())) failures++;
+    } else {
+        for (const auto& file : files) {
+            Manifest::Entry entry;
+            std::string name = manifest ? RelativeName(file.path, config) : std::string();
+            if (manifest && manifest->IsUnchanged(name, file, BuildOutputPath(file.path, config), entry)) {
+                std::cout << "Unchanged: " << file.path << std::endl;
+                manifest->Record(name, entry);
+                skipped++;
+                continue;
+            }
+
+            Report::FileStats* stats = report ? report->AddFile(file.path) : nullptr;
+            if (stats) stats->bytesIn = file.size;
+            if (!batch || file.size > BatchFileLimit) {
+                pool.Submit(ProcessFile, new ThreadData{file, &config, &pool, &failures, stats, manifest.get(), &skipped, store.get()});
+                continue;
+            }
+            if (!pending) pending = new BatchData{{}, {}, {}, &config, &pool, &failures, {}, manifest.get()};
+            pending->paths.push_back(file.path);
+            pending->sizes.push_back(file.size);
+            pending->modified.push_back(file.modified);
+            if (stats) pending->stats.push_back(stats);
+            if (pending->paths.size() == BatchFileCount) {
+                pool.Submit(ProcessBatch, pending);
+                pending = nullptr;
+            }
+        }
+        if (pending) pool.Submit(ProcessBatch, pending);
+    }
+    pool.Wait();
+
+    if (config.verify) {
+        std::cout << "Verified " << files.size() << " files, " << failures << " damaged." << std::endl;
+    } else {
+        std::cout << "All tasks completed." << std::endl;
+        if (skipped) std::cout << skipped << " of " << files.size() << " files unchanged since the last run." << std::endl;
+        if (failures) std::cerr << failures << " of " << files.size() << " files failed." << std::endl;
+    }
+
+    // Before the manifest: the recipes it vouches for need the index
+    if (store) {
+        if (!store->Close()) failures++;
+        else if (encode) {
+            std::cout << "Dedup: " << store->ChunkCount() << " chunks (" << store->ChunkBytes() << " bytes), "
+                      << store->NewCount() << " new (" << store->NewBytes() << " bytes, " << store->StoredBytes()
+                      << " stored)." << std::endl;
         }
     }
 
-    Concurrency::WaitForAll(threads);
+    // Written even after failures: the files that did make it are recorded
+    if (manifest && !manifest->Save()) {
+        std::cerr << "Error writing manifest in " << config.outputPath << std::endl;
+        failures++;
+    }
 
-    std::cout << "All tasks completed." << std::endl;
-    return 0;
+    bool reported = true;
+    if (report) {
+        reported = report->Write(config.reportPath, config.reportTop, pool.WorkerCount(), Report::Now() - runStart);
+        if (reported) std::cout << "Report written to: " << config.reportPath << std::endl;
+        else std::cerr << "Error writing report: " << config.reportPath << std::endl;
+    }
+    return failures || !reported ? 1 : 0;
 }